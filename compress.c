@@ -0,0 +1,460 @@
+/*
+ * Streaming (de)compression of trace files.
+ *
+ * Copyright: 2026 Xilinx Inc
+ * Written by Edgar E. Iglesias <edgar.iglesias@xilinx.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
+#ifdef CONFIG_LZ4
+#include <lz4frame.h>
+#endif
+
+#include "util.h"
+#include "safeio.h"
+#include "compress.h"
+
+/*
+ * A compressed trace is handed to the rest of qemu-etrace as a pipe. A
+ * thread per trace moves data between the pipe and the real fd and does
+ * the (de)compression, so it overlaps with decoding.
+ */
+#define COMPRESS_CHUNK (1024 * 1024)
+
+struct compress_job {
+	struct compress_job *next;
+	enum compress_fmt fmt;
+	bool write;
+	/* Compressed side.  */
+	int fd;
+	/* Our end of the pipe and the inode of the callers end.  */
+	int pipe_fd;
+	int user_fd;
+	ino_t user_ino;
+	pthread_t tid;
+};
+
+/* Compressors that must be drained at exit.  */
+static struct compress_job *compress_writers;
+
+static const struct {
+	const char *prefix;
+	const char *suffix;
+	uint8_t magic[4];
+	enum compress_fmt fmt;
+} compress_fmts[] = {
+	{ "zstd:", ".zst", { 0x28, 0xb5, 0x2f, 0xfd }, COMPRESS_ZSTD },
+	{ "lz4:", ".lz4", { 0x04, 0x22, 0x4d, 0x18 }, COMPRESS_LZ4 },
+};
+
+#define NR_FMTS (sizeof compress_fmts / sizeof compress_fmts[0])
+
+/* Strip a zstd: or lz4: prefix from *descr.  */
+enum compress_fmt compress_parse_prefix(const char **descr)
+{
+	unsigned int i;
+
+	for (i = 0; i < NR_FMTS; i++) {
+		size_t len = strlen(compress_fmts[i].prefix);
+
+		if (!strncmp(*descr, compress_fmts[i].prefix, len)) {
+			*descr += len;
+			return compress_fmts[i].fmt;
+		}
+	}
+	return COMPRESS_NONE;
+}
+
+/*
+ * Look at the magic of a regular file. Streams can't be peeked at
+ * without consuming data, so those need the prefix.
+ */
+enum compress_fmt compress_detect_fd(int fd)
+{
+	uint8_t magic[4];
+	struct stat st;
+	unsigned int i;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return COMPRESS_NONE;
+	if (pread(fd, magic, sizeof magic, 0) != sizeof magic)
+		return COMPRESS_NONE;
+
+	for (i = 0; i < NR_FMTS; i++) {
+		if (!memcmp(magic, compress_fmts[i].magic, sizeof magic))
+			return compress_fmts[i].fmt;
+	}
+	return COMPRESS_NONE;
+}
+
+enum compress_fmt compress_detect_suffix(const char *name)
+{
+	size_t len = strlen(name);
+	unsigned int i;
+
+	for (i = 0; i < NR_FMTS; i++) {
+		size_t slen = strlen(compress_fmts[i].suffix);
+
+		if (len > slen
+		    && !strcmp(name + len - slen, compress_fmts[i].suffix))
+			return compress_fmts[i].fmt;
+	}
+	return COMPRESS_NONE;
+}
+
+#if defined(CONFIG_ZSTD) || defined(CONFIG_LZ4)
+static ssize_t compress_read(int fd, void *buf, size_t len)
+{
+	ssize_t r;
+
+	do {
+		r = read(fd, buf, len);
+	} while (r < 0 && errno == EINTR);
+
+	if (r < 0)
+		perror("read");
+	return r;
+}
+
+static bool compress_write(int fd, const void *buf, size_t len)
+{
+	if (safe_write(fd, buf, len) != len) {
+		/* The reader going away is not an error.  */
+		if (errno != EPIPE)
+			perror("write");
+		return false;
+	}
+	return true;
+}
+#endif
+
+#ifdef CONFIG_ZSTD
+static void zstd_decompress(int in, int out)
+{
+	ZSTD_DCtx *dctx = ZSTD_createDCtx();
+	uint8_t *ibuf = safe_malloc(COMPRESS_CHUNK);
+	uint8_t *obuf = safe_malloc(COMPRESS_CHUNK);
+	ssize_t r;
+
+	while ((r = compress_read(in, ibuf, COMPRESS_CHUNK)) > 0) {
+		ZSTD_inBuffer input = { ibuf, r, 0 };
+		ZSTD_outBuffer output;
+
+		do {
+			size_t ret;
+
+			output.dst = obuf;
+			output.size = COMPRESS_CHUNK;
+			output.pos = 0;
+			ret = ZSTD_decompressStream(dctx, &output, &input);
+			if (ZSTD_isError(ret)) {
+				fprintf(stderr, "zstd: %s\n",
+					ZSTD_getErrorName(ret));
+				goto done;
+			}
+			if (!compress_write(out, obuf, output.pos))
+				goto done;
+		} while (input.pos < input.size
+			 || output.pos == output.size);
+	}
+done:
+	ZSTD_freeDCtx(dctx);
+	free(ibuf);
+	free(obuf);
+}
+
+static void zstd_compress(int in, int out)
+{
+	ZSTD_CCtx *cctx = ZSTD_createCCtx();
+	uint8_t *ibuf = safe_malloc(COMPRESS_CHUNK);
+	size_t osize = ZSTD_CStreamOutSize();
+	uint8_t *obuf = safe_malloc(osize);
+	ZSTD_EndDirective mode;
+	ssize_t r;
+
+	do {
+		ZSTD_inBuffer input;
+		bool finished;
+
+		r = compress_read(in, ibuf, COMPRESS_CHUNK);
+		mode = r > 0 ? ZSTD_e_continue : ZSTD_e_end;
+		input.src = ibuf;
+		input.size = r > 0 ? r : 0;
+		input.pos = 0;
+
+		do {
+			ZSTD_outBuffer output = { obuf, osize, 0 };
+			size_t remaining;
+
+			remaining = ZSTD_compressStream2(cctx, &output, &input,
+							 mode);
+			if (ZSTD_isError(remaining)) {
+				fprintf(stderr, "zstd: %s\n",
+					ZSTD_getErrorName(remaining));
+				goto done;
+			}
+			if (!compress_write(out, obuf, output.pos))
+				goto done;
+
+			if (mode == ZSTD_e_end)
+				finished = remaining == 0;
+			else
+				finished = input.pos == input.size;
+		} while (!finished);
+	} while (mode != ZSTD_e_end);
+done:
+	ZSTD_freeCCtx(cctx);
+	free(ibuf);
+	free(obuf);
+}
+#endif
+
+#ifdef CONFIG_LZ4
+static void lz4_decompress(int in, int out)
+{
+	LZ4F_dctx *dctx;
+	uint8_t *ibuf = safe_malloc(COMPRESS_CHUNK);
+	uint8_t *obuf = safe_malloc(COMPRESS_CHUNK);
+	LZ4F_errorCode_t err;
+	ssize_t r;
+
+	err = LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION);
+	if (LZ4F_isError(err)) {
+		fprintf(stderr, "lz4: %s\n", LZ4F_getErrorName(err));
+		goto fail;
+	}
+
+	while ((r = compress_read(in, ibuf, COMPRESS_CHUNK)) > 0) {
+		size_t pos = 0;
+		size_t osize;
+
+		/* Also drains concatenated frames. A full output buffer
+		   may leave more decoded data behind.  */
+		do {
+			size_t isize = r - pos;
+			size_t ret;
+
+			osize = COMPRESS_CHUNK;
+			ret = LZ4F_decompress(dctx, obuf, &osize,
+					      ibuf + pos, &isize, NULL);
+			if (LZ4F_isError(ret)) {
+				fprintf(stderr, "lz4: %s\n",
+					LZ4F_getErrorName(ret));
+				goto done;
+			}
+			pos += isize;
+			if (!compress_write(out, obuf, osize))
+				goto done;
+		} while (pos < (size_t) r || osize == COMPRESS_CHUNK);
+	}
+done:
+	LZ4F_freeDecompressionContext(dctx);
+fail:
+	free(ibuf);
+	free(obuf);
+}
+
+static void lz4_compress(int in, int out)
+{
+	LZ4F_preferences_t prefs;
+	LZ4F_cctx *cctx;
+	uint8_t *ibuf = safe_malloc(COMPRESS_CHUNK);
+	uint8_t *obuf;
+	size_t osize;
+	size_t ret;
+	ssize_t r;
+
+	memset(&prefs, 0, sizeof prefs);
+	prefs.frameInfo.blockSizeID = LZ4F_max4MB;
+	osize = LZ4F_compressBound(COMPRESS_CHUNK, &prefs);
+	obuf = safe_malloc(osize);
+
+	ret = LZ4F_createCompressionContext(&cctx, LZ4F_VERSION);
+	if (LZ4F_isError(ret)) {
+		fprintf(stderr, "lz4: %s\n", LZ4F_getErrorName(ret));
+		goto fail;
+	}
+
+	ret = LZ4F_compressBegin(cctx, obuf, osize, &prefs);
+	if (LZ4F_isError(ret) || !compress_write(out, obuf, ret))
+		goto done;
+
+	while ((r = compress_read(in, ibuf, COMPRESS_CHUNK)) > 0) {
+		ret = LZ4F_compressUpdate(cctx, obuf, osize, ibuf, r, NULL);
+		if (LZ4F_isError(ret) || !compress_write(out, obuf, ret))
+			goto done;
+	}
+
+	ret = LZ4F_compressEnd(cctx, obuf, osize, NULL);
+	if (!LZ4F_isError(ret))
+		compress_write(out, obuf, ret);
+done:
+	if (LZ4F_isError(ret))
+		fprintf(stderr, "lz4: %s\n", LZ4F_getErrorName(ret));
+	LZ4F_freeCompressionContext(cctx);
+fail:
+	free(ibuf);
+	free(obuf);
+}
+#endif
+
+static void *compress_thread(void *opaque)
+{
+	struct compress_job *job = opaque;
+	bool write = job->write;
+	sigset_t set;
+
+	/* Leave signal handling to the main thread.  */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	switch (job->fmt) {
+#ifdef CONFIG_ZSTD
+	case COMPRESS_ZSTD:
+		if (write)
+			zstd_compress(job->pipe_fd, job->fd);
+		else
+			zstd_decompress(job->fd, job->pipe_fd);
+		break;
+#endif
+#ifdef CONFIG_LZ4
+	case COMPRESS_LZ4:
+		if (write)
+			lz4_compress(job->pipe_fd, job->fd);
+		else
+			lz4_decompress(job->fd, job->pipe_fd);
+		break;
+#endif
+	default:
+		break;
+	}
+
+	close(job->pipe_fd);
+	close(job->fd);
+	/* Writers stay around for compress_drain.  */
+	if (!write)
+		free(job);
+	return NULL;
+}
+
+/*
+ * Runs at exit. Flush what stdio still buffers for the pipes, close
+ * them and wait for the compressors to finish their frames.
+ */
+static void compress_drain(void)
+{
+	struct compress_job *job;
+
+	fflush(NULL);
+	for (job = compress_writers; job; job = job->next) {
+		struct stat st;
+
+		/* Only close the users fd if it still is our pipe.  */
+		if (fstat(job->user_fd, &st) == 0
+		    && st.st_ino == job->user_ino)
+			close(job->user_fd);
+		pthread_join(job->tid, NULL);
+	}
+}
+
+static bool compress_supported(enum compress_fmt fmt)
+{
+	switch (fmt) {
+#ifdef CONFIG_ZSTD
+	case COMPRESS_ZSTD:
+		return true;
+#endif
+#ifdef CONFIG_LZ4
+	case COMPRESS_LZ4:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+/*
+ * Return a pipe carrying the uncompressed data of fd. fd is owned by
+ * the (de)compressor from now on.
+ */
+int compress_wrap_fd(int fd, enum compress_fmt fmt, bool write)
+{
+	struct compress_job *job;
+	struct stat st;
+	int p[2];
+	int err;
+
+	if (!compress_supported(fmt)) {
+		fprintf(stderr, "qemu-etrace was built without support for "
+			"this compression format\n");
+		close(fd);
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	if (pipe2(p, O_CLOEXEC) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	job = safe_mallocz(sizeof *job);
+	job->fmt = fmt;
+	job->write = write;
+	job->fd = fd;
+	job->pipe_fd = write ? p[0] : p[1];
+	job->user_fd = write ? p[1] : p[0];
+
+	if (write) {
+		fstat(job->user_fd, &st);
+		job->user_ino = st.st_ino;
+	}
+
+	/* Larger pipes mean fewer context switches.  */
+	fcntl(p[1], F_SETPIPE_SZ, COMPRESS_CHUNK);
+
+	err = pthread_create(&job->tid, NULL, compress_thread, job);
+	if (err) {
+		fprintf(stderr, "pthread_create: %s\n", strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	if (write) {
+		if (!compress_writers)
+			atexit(compress_drain);
+		job->next = compress_writers;
+		compress_writers = job;
+	} else {
+		pthread_detach(job->tid);
+	}
+	return job->user_fd;
+}
@@ -0,0 +1,37 @@
+/*
+ * Streaming (de)compression of trace files.
+ *
+ * Copyright: 2026 Xilinx Inc
+ * Written by Edgar E. Iglesias <edgar.iglesias@xilinx.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+#ifndef _COMPRESS_H
+#define _COMPRESS_H
+
+#include <stdbool.h>
+
+enum compress_fmt {
+	COMPRESS_NONE = 0,
+	COMPRESS_ZSTD,
+	COMPRESS_LZ4,
+};
+
+enum compress_fmt compress_parse_prefix(const char **descr);
+enum compress_fmt compress_detect_fd(int fd);
+enum compress_fmt compress_detect_suffix(const char *name);
+
+int compress_wrap_fd(int fd, enum compress_fmt fmt, bool write);
+#endif
@@ -45,7 +45,7 @@ static void coverage_dump_sym(struct sym *s, FILE *fp)
 {
 	fprintf(fp, "fn=%s\n%u %" PRIu64 "\n",
 		s->name,
-		0 /*dummy*/, s->total_time);
+		0 /*dummy*/, s->cnt.total_time);
 }
 
 void cachegrind_coverage_dump(struct sym *s, size_t nr_syms,
@@ -0,0 +1,542 @@
+/*
+ * Binary coverage database.
+ *
+ * Copyright: 2026 Xilinx Inc
+ * Written by Edgar E. Iglesias <edgar.iglesias@xilinx.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+
+#include "util.h"
+#include "safeio.h"
+#include "syms.h"
+#include "sym-cache.h"
+#include "cov-db.h"
+
+/* The counter sets stored by sym.  */
+#define COV_DB_SETS	(SYM_CNT_COV | SYM_CNT_ENT | SYM_CNT_HITS)
+
+static inline unsigned int cov_db_nr_chunks(unsigned int nr)
+{
+	return (nr + SYM_COV_CHUNK - 1) >> SYM_COV_CHUNK_SHIFT;
+}
+
+static inline unsigned int cov_db_chunk_len(unsigned int nr, unsigned int i)
+{
+	unsigned int n = nr - (i << SYM_COV_CHUNK_SHIFT);
+
+	return n > SYM_COV_CHUNK ? SYM_COV_CHUNK : n;
+}
+
+/* A mapped database, pos moves on as its parts are taken.  */
+struct cov_db_in {
+	const char *filename;
+	const uint8_t *p;
+	uint64_t len;
+	uint64_t pos;
+};
+
+/*
+ * Runs keep adding to the database, so one that can't be read must
+ * not be overwritten either.
+ */
+static void cov_db_invalid(struct cov_db_in *in)
+{
+	fprintf(stderr, "%s: invalid coverage database\n", in->filename);
+	exit(EXIT_FAILURE);
+}
+
+static const void *cov_db_take(struct cov_db_in *in, uint64_t len)
+{
+	const void *r;
+
+	if (len > in->len - in->pos)
+		cov_db_invalid(in);
+	r = in->p + in->pos;
+	in->pos += len;
+	return r;
+}
+
+static struct sym_coverage *cov_db_get_cov(struct cov_db_in *in,
+					   unsigned int nr)
+{
+	unsigned int nr_chunks = cov_db_nr_chunks(nr), i;
+	struct sym_coverage *c;
+	const uint64_t *map;
+
+	map = cov_db_take(in, sizeof map[0] * ((nr_chunks + 63) / 64));
+	c = safe_mallocz(sizeof *c + sizeof c->chunks[0] * nr_chunks);
+	c->nr = nr;
+	for (i = 0; i < nr_chunks; i++) {
+		size_t len = sizeof c->chunks[i][0] * cov_db_chunk_len(nr, i);
+
+		if (!(map[i / 64] & (1ULL << (i % 64))))
+			continue;
+		c->chunks[i] = safe_malloc(len);
+		memcpy(c->chunks[i], cov_db_take(in, len), len);
+	}
+	return c;
+}
+
+/* The sym of obj at addr with size, NULL if there is none.  */
+static struct sym *cov_db_find_sym(struct sym *s, size_t nr, unsigned int obj,
+				   uint64_t addr, uint64_t size)
+{
+	size_t lo = 0, hi = nr;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (s[mid].addr < addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	/* Aliases share the address.  */
+	for (; lo < nr && s[lo].addr == addr; lo++) {
+		if (s[lo].obj == obj && s[lo].size == size)
+			return &s[lo];
+	}
+	return NULL;
+}
+
+static void cov_db_load_elf(struct cov_db_in *in, void **store,
+			    unsigned int obj, uint32_t nr_syms,
+			    unsigned int sets)
+{
+	struct sym *s = NULL;
+	size_t nr = 0;
+	uint64_t bias;
+	uint32_t i;
+
+	sym_store_obj(store, obj, &bias);
+	s = sym_get_all(store, &nr);
+
+	for (i = 0; i < nr_syms; i++) {
+		const struct cov_db_sym *cs = cov_db_take(in, sizeof *cs);
+		struct sym_counters cnt = { 0 };
+		struct sym *sym;
+		unsigned int nr_words;
+
+		sym = cov_db_find_sym(s, nr, obj, cs->addr + bias, cs->size);
+		if (!sym || (cs->sets & ~sets))
+			cov_db_invalid(in);
+
+		nr_words = sym->size / 4 + 1;
+		cnt.total_time = cs->total_time;
+		if (cs->sets & SYM_CNT_COV)
+			cnt.cov = cov_db_get_cov(in, nr_words);
+		if (cs->sets & SYM_CNT_ENT)
+			cnt.cov_ent = cov_db_get_cov(in, nr_words);
+		if (cs->sets & SYM_CNT_HITS) {
+			size_t len = sizeof cnt.hits[0] * ((nr_words + 63) / 64);
+
+			cnt.hits = safe_malloc(len);
+			memcpy(cnt.hits, cov_db_take(in, len), len);
+		}
+		sym_store_add_counters(store, sym, &cnt);
+	}
+}
+
+/*
+ * Look up the build-ids of the ELFs of store, by which loads and saves
+ * find their coverage in the database. It is done once, by the first
+ * load or save if not before; bfd can't be used by several threads.
+ */
+void cov_db_init(struct cov_db *db, void **store)
+{
+	unsigned int o;
+
+	if (db->ids)
+		return;
+
+	db->nr_ids = sym_store_nr_objs(store);
+	db->ids = safe_mallocz(sizeof db->ids[0]
+			       * (db->nr_ids ? db->nr_ids : 1));
+	for (o = 0; o < db->nr_ids; o++) {
+		uint64_t bias;
+
+		db->ids[o] = sym_cache_build_id(sym_store_obj(store, o,
+							      &bias));
+	}
+}
+
+static void cov_db_check_hdr(struct cov_db_in *in,
+			     const struct cov_db_hdr *hdr, void **store)
+{
+	if (hdr->magic != COV_DB_MAGIC || hdr->version != COV_DB_VERSION)
+		cov_db_invalid(in);
+	if (hdr->cnt_flags != sym_store_get_counters(store)) {
+		fprintf(stderr, "%s: holds other counters than this run, "
+			"see --coverage-hits\n", in->filename);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/*
+ * Check up front that a run can add to the database filename, before
+ * it spends its time on a trace. The counters are loaded at the end.
+ */
+void cov_db_check(void **store, const char *filename)
+{
+	struct cov_db_in in = { .filename = filename };
+	struct cov_db_hdr hdr;
+	ssize_t r;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		if (errno == ENOENT)
+			return;
+		perror(filename);
+		exit(EXIT_FAILURE);
+	}
+	r = safe_read(fd, &hdr, sizeof hdr);
+	close(fd);
+	if (r < 0) {
+		perror(filename);
+		exit(EXIT_FAILURE);
+	}
+	/* No database yet.  */
+	if (!r)
+		return;
+	if (r != sizeof hdr)
+		cov_db_invalid(&in);
+	cov_db_check_hdr(&in, &hdr, store);
+}
+
+/*
+ * Lock the database filename against other runs until cov_db_save, so
+ * that the load, the merge and the save of a run don't interleave with
+ * those of another and lose its counts. Creates an empty file if there
+ * is no database yet, which loads as none.
+ */
+void cov_db_lock(struct cov_db *db, const char *filename)
+{
+	struct stat st_fd, st_path;
+	int fd;
+
+	for (;;) {
+		fd = open(filename, O_RDWR | O_CREAT, 0644);
+		if (fd < 0 || flock(fd, LOCK_EX) < 0
+		    || fstat(fd, &st_fd) < 0) {
+			perror(filename);
+			exit(EXIT_FAILURE);
+		}
+		/* A save may have replaced the file while we waited.  */
+		if (stat(filename, &st_path) == 0
+		    && st_path.st_dev == st_fd.st_dev
+		    && st_path.st_ino == st_fd.st_ino)
+			break;
+		close(fd);
+	}
+	db->lock_fd = fd;
+	db->locked = true;
+}
+
+static void cov_db_unlock(struct cov_db *db)
+{
+	if (!db->locked)
+		return;
+	close(db->lock_fd);
+	db->locked = false;
+}
+
+/*
+ * Add the counters in the database filename to those of store, which
+ * must keep the same counter sets. Returns false if there is no
+ * database yet, or only the empty file of cov_db_lock. Exits if it
+ * can't be read, rather than losing it.
+ */
+bool cov_db_load(struct cov_db *db, void **store, const char *filename)
+{
+	struct cov_db_in in = { .filename = filename };
+	const struct cov_db_hdr *hdr;
+	unsigned int nr_objs = sym_store_nr_objs(store), o;
+	bool *matched;
+	struct stat st;
+	uint32_t e;
+	void *p;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		if (errno == ENOENT)
+			return false;
+		perror(filename);
+		exit(EXIT_FAILURE);
+	}
+	if (fstat(fd, &st) < 0) {
+		perror(filename);
+		exit(EXIT_FAILURE);
+	}
+	if (!st.st_size) {
+		close(fd);
+		return false;
+	}
+	if (st.st_size < sizeof *hdr)
+		cov_db_invalid(&in);
+
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		perror(filename);
+		exit(EXIT_FAILURE);
+	}
+	in.p = p;
+	in.len = st.st_size;
+
+	hdr = cov_db_take(&in, sizeof *hdr);
+	cov_db_check_hdr(&in, hdr, store);
+
+	cov_db_init(db, store);
+	matched = safe_mallocz(sizeof matched[0] * (nr_objs ? nr_objs : 1));
+
+	for (e = 0; e < hdr->nr_elfs; e++) {
+		uint64_t start = in.pos;
+		const struct cov_db_elf *ce = cov_db_take(&in, sizeof *ce);
+		const char *id;
+
+		if (ce->size > in.len - in.pos)
+			cov_db_invalid(&in);
+		id = cov_db_take(&in, align_pow2(ce->id_len, 8));
+
+		/* An ELF that is loaded several times comes several times.  */
+		for (o = 0; o < nr_objs; o++) {
+			if (!matched[o] && db->ids[o]
+			    && strlen(db->ids[o]) == ce->id_len
+			    && !memcmp(db->ids[o], id, ce->id_len))
+				break;
+		}
+
+		if (o == nr_objs) {
+			size_t len = sizeof *ce + ce->size;
+
+			db->other = safe_realloc(db->other,
+						 db->other_len + len);
+			memcpy(db->other + db->other_len, in.p + start, len);
+			db->other_len += len;
+			db->nr_other++;
+			in.pos = start + len;
+			continue;
+		}
+
+		matched[o] = true;
+		cov_db_load_elf(&in, store, o, ce->nr_syms,
+				hdr->cnt_flags & COV_DB_SETS);
+		if (in.pos != start + sizeof *ce + ce->size)
+			cov_db_invalid(&in);
+	}
+
+	db->nr_runs += hdr->nr_runs;
+	fprintf(stderr, "Loaded the coverage of %" PRIu64 " runs from %s\n",
+		hdr->nr_runs, filename);
+
+	free(matched);
+	munmap(p, st.st_size);
+	return true;
+}
+
+/* The database as it is built up for a save.  */
+struct cov_db_out {
+	uint8_t *p;
+	size_t len;
+	size_t nr_alloc;
+};
+
+static void *cov_db_put(struct cov_db_out *out, const void *data, size_t len)
+{
+	void *r;
+
+	if (out->len + len > out->nr_alloc) {
+		out->nr_alloc = (out->len + len) * 2;
+		out->p = safe_realloc(out->p, out->nr_alloc);
+	}
+	r = out->p + out->len;
+	if (data)
+		memcpy(r, data, len);
+	else
+		memset(r, 0, len);
+	out->len += len;
+	return r;
+}
+
+static void cov_db_put_cov(struct cov_db_out *out, struct sym_coverage *c)
+{
+	unsigned int nr_chunks = cov_db_nr_chunks(c->nr), i;
+	uint64_t *map;
+	size_t map_off;
+
+	map_off = out->len;
+	cov_db_put(out, NULL, sizeof map[0] * ((nr_chunks + 63) / 64));
+	for (i = 0; i < nr_chunks; i++) {
+		if (!c->chunks[i])
+			continue;
+		/* out moves as it grows.  */
+		map = (uint64_t *) (out->p + map_off);
+		map[i / 64] |= 1ULL << (i % 64);
+		cov_db_put(out, c->chunks[i], sizeof c->chunks[i][0]
+			   * cov_db_chunk_len(c->nr, i));
+	}
+}
+
+/* Returns the nr of syms of obj that were put.  */
+static uint32_t cov_db_put_elf(struct cov_db_out *out, struct sym *s,
+			       size_t nr, unsigned int obj, uint64_t bias)
+{
+	uint32_t nr_syms = 0;
+	size_t i;
+
+	for (i = 0; i < nr; i++) {
+		struct sym_counters *cnt = &s[i].cnt;
+		struct cov_db_sym cs = { 0 };
+
+		if (s[i].obj != obj
+		    || (!cnt->total_time && !sym_counters_ran(cnt)))
+			continue;
+
+		cs.addr = s[i].addr - bias;
+		cs.size = s[i].size;
+		cs.total_time = cnt->total_time;
+		cs.sets = (cnt->cov ? SYM_CNT_COV : 0)
+			  | (cnt->cov_ent ? SYM_CNT_ENT : 0)
+			  | (cnt->hits ? SYM_CNT_HITS : 0);
+		cov_db_put(out, &cs, sizeof cs);
+
+		if (cnt->cov)
+			cov_db_put_cov(out, cnt->cov);
+		if (cnt->cov_ent)
+			cov_db_put_cov(out, cnt->cov_ent);
+		if (cnt->hits)
+			cov_db_put(out, cnt->hits, sizeof cnt->hits[0]
+				   * ((s[i].size / 4 + 1 + 63) / 64));
+		nr_syms++;
+	}
+	return nr_syms;
+}
+
+/*
+ * Write the counters of store, with what db kept from the loads, to
+ * filename. It goes through a temporary file so that an interrupted
+ * save never loses the database. The caller counts its own runs into
+ * db->nr_runs. Unlocks the database.
+ */
+bool cov_db_save(struct cov_db *db, void **store, const char *filename)
+{
+	struct cov_db_out out = { 0 };
+	struct cov_db_hdr hdr = { 0 };
+	unsigned int nr_objs = sym_store_nr_objs(store), o;
+	struct sym *s;
+	size_t nr = 0;
+	char *tmpname;
+	bool ok = false;
+	int fd;
+
+	cov_db_init(db, store);
+	sym_store_flush(store);
+	s = sym_get_all(store, &nr);
+
+	cov_db_put(&out, NULL, sizeof hdr);
+	for (o = 0; o < nr_objs; o++) {
+		struct cov_db_elf ce = { 0 };
+		size_t elf_off;
+		const char *elf;
+		uint64_t bias;
+		const char *id = db->ids[o];
+
+		elf = sym_store_obj(store, o, &bias);
+		if (!id) {
+			fprintf(stderr, "%s has no build-id, its coverage is "
+				"not saved\n", elf);
+			continue;
+		}
+
+		elf_off = out.len;
+		cov_db_put(&out, NULL, sizeof ce);
+		ce.id_len = strlen(id);
+		cov_db_put(&out, id, ce.id_len);
+		cov_db_put(&out, NULL, align_pow2(ce.id_len, 8) - ce.id_len);
+		ce.nr_syms = cov_db_put_elf(&out, s, nr, o, bias);
+		ce.size = out.len - elf_off - sizeof ce;
+		memcpy(out.p + elf_off, &ce, sizeof ce);
+		hdr.nr_elfs++;
+	}
+	if (db->other_len) {
+		cov_db_put(&out, db->other, db->other_len);
+		hdr.nr_elfs += db->nr_other;
+	}
+
+	hdr.magic = COV_DB_MAGIC;
+	hdr.version = COV_DB_VERSION;
+	hdr.cnt_flags = sym_store_get_counters(store);
+	hdr.nr_runs = db->nr_runs;
+	memcpy(out.p, &hdr, sizeof hdr);
+
+	if (asprintf(&tmpname, "%s.%d", filename, getpid()) < 0)
+		goto out;
+
+	fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror(tmpname);
+		free(tmpname);
+		goto out;
+	}
+	if (safe_write(fd, out.p, out.len) != out.len) {
+		close(fd);
+		goto fail_unlink;
+	}
+	close(fd);
+	if (rename(tmpname, filename) < 0)
+		goto fail_unlink;
+	free(tmpname);
+	ok = true;
+	goto out;
+
+fail_unlink:
+	perror(filename);
+	unlink(tmpname);
+	free(tmpname);
+out:
+	cov_db_unlock(db);
+	free(out.p);
+	return ok;
+}
+
+void cov_db_free(struct cov_db *db)
+{
+	unsigned int o;
+
+	for (o = 0; o < db->nr_ids; o++)
+		free(db->ids[o]);
+	free(db->ids);
+	free(db->other);
+	cov_db_unlock(db);
+	memset(db, 0, sizeof *db);
+}
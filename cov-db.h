@@ -0,0 +1,95 @@
+/*
+ * Binary coverage database.
+ *
+ * Copyright: 2026 Xilinx Inc
+ * Written by Edgar E. Iglesias <edgar.iglesias@xilinx.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+#ifndef _COV_DB_H
+#define _COV_DB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * A coverage database holds the counters of the syms that ran, for
+ * each ELF by its build-id, so that runs can keep adding to it. It
+ * holds the header, then per ELF a cov_db_elf, the build-id in hex
+ * padded to 8 bytes and the cov_db_syms with their counters.
+ *
+ * The counters of a sym follow its cov_db_sym, by the sets it has.
+ * For cov and cov_ent a bitmap of the chunks with a word that ran,
+ * see SYM_COV_CHUNK, and the counters of those chunks. For hits the
+ * bitmap of the words that ran.
+ */
+#define COV_DB_MAGIC		0x44435145	/* "EQCD" */
+#define COV_DB_VERSION		1
+
+struct cov_db_hdr {
+	uint32_t magic;
+	uint32_t version;
+	/* The counter sets kept, see enum sym_cnt_flags.  */
+	uint32_t cnt_flags;
+	uint32_t nr_elfs;
+	/* Nr of runs that went into it.  */
+	uint64_t nr_runs;
+} __attribute__ ((packed));
+
+struct cov_db_elf {
+	uint32_t id_len;
+	uint32_t nr_syms;
+	/* Bytes of build-id and syms that follow.  */
+	uint64_t size;
+} __attribute__ ((packed));
+
+struct cov_db_sym {
+	/* Without the bias of the ELF.  */
+	uint64_t addr;
+	uint64_t size;
+	uint64_t total_time;
+	/* The counter sets that follow.  */
+	uint32_t sets;
+	uint32_t reserved;
+} __attribute__ ((packed));
+
+/*
+ * What a load keeps for the save: the nr of runs and the ELFs of the
+ * database that aren't in this run, which are written back as they
+ * were.
+ */
+struct cov_db {
+	uint64_t nr_runs;
+	uint8_t *other;
+	size_t other_len;
+	unsigned int nr_other;
+
+	/* Build-ids of the ELFs of the store, NULL for those without.  */
+	char **ids;
+	unsigned int nr_ids;
+
+	/* The database file while it is locked, see cov_db_lock.  */
+	bool locked;
+	int lock_fd;
+};
+
+void cov_db_init(struct cov_db *db, void **store);
+void cov_db_check(void **store, const char *filename);
+void cov_db_lock(struct cov_db *db, const char *filename);
+bool cov_db_load(struct cov_db *db, void **store, const char *filename);
+bool cov_db_save(struct cov_db *db, void **store, const char *filename);
+void cov_db_free(struct cov_db *db);
+#endif
@@ -40,6 +40,7 @@
 #include "util.h"
 #include "safeio.h"
 #include "syms.h"
+#include "intern.h"
 #include "disas.h"
 #include "run.h"
 
@@ -76,6 +77,9 @@ struct gcov_file {
 };
 
 struct gcov_file *gcov_files = NULL;
+/* gcov_files indexed by the str_id of their filename.  */
+static struct gcov_file **gcov_files_by_id;
+static uint32_t nr_gcov_files_by_id;
 
 struct gcda_file {
 	struct gcda_file *next;
@@ -107,30 +111,40 @@ void gcda_add_file(const char *name)
 	gcda_files = g;
 }
 
-struct gcov_file *gcov_find_file(const char *name)
+/* The file by the str_id of its name, see str_intern.  */
+struct gcov_file *gcov_find_file(uint32_t id)
 {
-	struct gcov_file *f = gcov_files;
-
-	while (f) {
-		if (strcmp(name, f->filename) == 0)
-			break;
-		f = f->next;
-	}
-	return f;
+	if (id >= nr_gcov_files_by_id)
+		return NULL;
+	return gcov_files_by_id[id];
 }
 
-struct gcov_file *gcov_find_file_no_fail(const char *name, unsigned int maxline)
+struct gcov_file *gcov_find_file_no_fail(uint32_t id, unsigned int maxline)
 {
 	struct gcov_file *f;
-	f = gcov_find_file(name);
+
+	assert(id < str_nr_ids());
+	f = gcov_find_file(id);
 	if (!f) {
 		f = safe_mallocz(sizeof *f);
 		f->lines = safe_mallocz(maxline * sizeof f->lines[0]);
 		f->instr_lines = safe_mallocz(maxline * sizeof f->instr_lines[0]);
 		f->nr_lines = maxline;
-		f->filename = strdup(name);
+		f->filename = str_by_id(id);
 		f->next = gcov_files;
 		gcov_files = f;
+
+		if (id >= nr_gcov_files_by_id) {
+			uint32_t nr = str_nr_ids();
+
+			gcov_files_by_id = safe_realloc(gcov_files_by_id,
+					nr * sizeof gcov_files_by_id[0]);
+			memset(&gcov_files_by_id[nr_gcov_files_by_id], 0,
+				(nr - nr_gcov_files_by_id)
+				* sizeof gcov_files_by_id[0]);
+			nr_gcov_files_by_id = nr;
+		}
+		gcov_files_by_id[id] = f;
 	} else {
 		if (maxline > f->nr_lines) {
 			f->lines = safe_realloc(f->lines,
@@ -147,14 +161,11 @@ struct gcov_file *gcov_find_file_no_fail(const char *name, unsigned int maxline)
 	return f;
 }
 
+/* Syms are processed one at a time, so s can only be the last one.  */
 void gcov_file_add_sym(struct gcov_file *f, struct sym *s)
 {
-	unsigned int i;
-
-	for (i = 0; i < f->nr_syms; i++) {
-		if (f->syms[i] == s)
-			return;
-	}
+	if (f->nr_syms && f->syms[f->nr_syms - 1] == s)
+		return;
 
 	f->nr_syms++;
 	f->syms = safe_realloc(f->syms, sizeof f->syms[0] * f->nr_syms);
@@ -543,33 +554,31 @@ void gcov_process_func(struct gcov_ctx *ctx)
 	rec->counts.nr_counts = num_counts;
 	rec->counts.counts = safe_mallocz(num_counts * sizeof rec->counts.counts[0]);
 
-	if (s && s->linemap && s->cov) {
-		for (off = 0; off < (s->size / 4); off++) {
-			struct sym_src_loc *loc;
+	if (s && s->linemap && sym_ran(s)) {
+		struct sym_linemap_iter it;
+		struct sym_src_loc loc;
 
-			loc = &s->linemap->locs[off];
-			if (!loc->filename)
-				continue;
+		sym_linemap_iter(&it, s);
+		while (sym_linemap_next(&it, &loc)) {
+			unsigned int block_nr;
+			uint64_t v;
 
-			do {
-				unsigned int block_nr;
-				uint64_t v = 0;
-
-				if (s->cov_ent)
-					v = s->cov_ent->counter[off];
-
-				block_nr = gcov_match_line(ctx, loc, off == 0);
-				if (block_nr >= 0
-					&& block_nr < rec->counts.nr_counts
-					&& !rec->counts.counts[block_nr]) {
-					rec->counts.counts[block_nr] = v;
-				}
-
-				/* FIXME: Prologue???   */
-				if (off == 0)
-					rec->counts.counts[0] = v;
-				loc = loc->next;
-			} while (loc);
+			off = loc.word;
+			if (off >= s->size / 4)
+				break;
+
+			v = sym_word_count(s, off);
+
+			block_nr = gcov_match_line(ctx, &loc, off == 0);
+			if (block_nr >= 0
+				&& block_nr < rec->counts.nr_counts
+				&& !rec->counts.counts[block_nr]) {
+				rec->counts.counts[block_nr] = v;
+			}
+
+			/* FIXME: Prologue???   */
+			if (off == 0)
+				rec->counts.counts[0] = v;
 		}
 	}
 
@@ -769,49 +778,40 @@ done:
 
 static void gcov_process_sym(struct sym *s, FILE *fp)
 {
-	uint64_t addr, end = s->addr + s->size;
 	struct gcov_file *f_src, *f;
+	struct sym_linemap_iter it;
+	struct sym_src_loc loc;
 
 	if (!s->src_filename)
 		return;
 	if (!s->linemap)
 		return;
 
-	f_src = gcov_find_file_no_fail(s->src_filename, s->maxline + 1);
-
-	for (addr = s->addr; addr < end; addr += 4) {
-		uint64_t v = 0;
-		struct sym_src_loc *loc;
-		uint64_t off = (addr - s->addr) / 4;
-
-		if (s->cov_ent)
-			v = s->cov_ent->counter[off];
-
-		loc = &s->linemap->locs[off];
-		if (!loc->filename)
-			continue;
-
-		do {
-			unsigned int l = loc->linenr;
-			if (loc->filename == s->src_filename)
-				f = f_src;
-			else
-				f = gcov_find_file_no_fail(
-						loc->filename,
-						s->maxline + 1);
-
-			assert(l < f->nr_lines);
-			/* Debug info line numbers are indexed from 1.
-			Some unknown entries come with ??:0  */
-			if (l > 0) {
-				if (v > f->lines[l - 1])
-					f->lines[l - 1] += v;
-				f->instr_lines[l - 1] = true;
-			}
+	/* The filenames of syms are interned.  */
+	f_src = gcov_find_file_no_fail(str_id(s->src_filename),
+				       s->maxline + 1);
+
+	sym_linemap_iter(&it, s);
+	while (sym_linemap_next(&it, &loc)) {
+		unsigned int l = loc.linenr;
+		uint64_t v = sym_word_count(s, loc.word);
+
+		if (loc.filename == s->src_filename)
+			f = f_src;
+		else
+			f = gcov_find_file_no_fail(loc.file,
+						   s->maxline + 1);
+
+		assert(l < f->nr_lines);
+		/* Debug info line numbers are indexed from 1.
+		Some unknown entries come with ??:0  */
+		if (l > 0) {
+			if (v > f->lines[l - 1])
+				f->lines[l - 1] += v;
+			f->instr_lines[l - 1] = true;
+		}
 
-			loc = loc->next;
-			gcov_file_add_sym(f, s);
-		} while (loc);
+		gcov_file_add_sym(f, s);
 	}
 }
 
@@ -876,23 +876,24 @@ done:
 		fclose(fp_out);
 }
 
-struct sym_src_loc *gcov_find_decl_line(struct sym *s, const char *filename)
+/* The lowest line of filename at the start of s, false if there is none.  */
+bool gcov_find_decl_line(struct sym *s, const char *filename,
+			 struct sym_src_loc *ret)
 {
-	struct sym_src_loc *loc;
-	struct sym_src_loc *ret = NULL;
-
-	loc = &s->linemap->locs[0];
-	if (!loc->filename)
-		return ret;
-
-	do {
-		if (!strcmp(filename, loc->filename)
-			&& !(loc->flags & LOC_F_INLINED)
-			&& (!ret || ret->linenr > loc->linenr))
-			ret = loc;
-		loc = loc->next;
-	} while (loc);
-	return ret;
+	struct sym_linemap_iter it;
+	struct sym_src_loc loc;
+	bool found = false;
+
+	sym_linemap_iter(&it, s);
+	while (sym_linemap_next(&it, &loc) && loc.word == 0) {
+		if (!strcmp(filename, loc.filename)
+			&& !(loc.flags & (LOC_F_INLINED | LOC_F_NOT_STMT))
+			&& (!found || ret->linenr > loc.linenr)) {
+			*ret = loc;
+			found = true;
+		}
+	}
+	return found;
 }
 
 void lcov_emit_info(struct gcov_file *f, FILE *fp, void *exclude)
@@ -915,18 +916,18 @@ void lcov_emit_info(struct gcov_file *f, FILE *fp, void *exclude)
 
 	if (!filename_is_likely_header(f->filename) || 1) {
 		for (i = 0; i < f->nr_syms; i++) {
-			struct sym_src_loc *loc;
+			struct sym_src_loc loc;
 
-			loc = gcov_find_decl_line(f->syms[i], f->filename);
-			if (!loc) {
+			if (!gcov_find_decl_line(f->syms[i], f->filename,
+						 &loc)) {
 				continue;
 			}
 
 			fprintf(fp, "FN:%u,%s\n",
-				loc->linenr, f->syms[i]->name);
-			if (f->syms[i]->cov_ent) {
+				loc.linenr, f->syms[i]->name);
+			if (sym_ran(f->syms[i])) {
 				fprintf(fp, "FNDA:%" PRIu64 ",%s\n",
-					f->syms[i]->cov_ent->counter[0],
+					sym_word_count(f->syms[i], 0),
 					f->syms[i]->name);
 			}
 		}
@@ -942,7 +943,7 @@ void lcov_emit_info(struct gcov_file *f, FILE *fp, void *exclude)
 
 		instr_lines += f->instr_lines[i];
 		if (f->instr_lines[i]) {
-			exec_lines++;
+			exec_lines += !!f->lines[i];
 			fprintf(fp, "DA:%u,%u\n", i + 1, f->lines[i]);
 		}
 
@@ -952,6 +953,24 @@ void lcov_emit_info(struct gcov_file *f, FILE *fp, void *exclude)
 	fprintf(fp, "end_of_record\n");
 }
 
+/* Forget the line counts of an earlier emit.  */
+static void gcov_files_free(void)
+{
+	struct gcov_file *f;
+
+	while (gcov_files) {
+		f = gcov_files;
+		gcov_files = f->next;
+		free(f->syms);
+		free(f->lines);
+		free(f->instr_lines);
+		free(f);
+	}
+	free(gcov_files_by_id);
+	gcov_files_by_id = NULL;
+	nr_gcov_files_by_id = 0;
+}
+
 void gcov_emit_gcov(void **store, struct sym *s, size_t nr_syms,
 		struct sym *unknown, FILE *fp,
 		const char *gcov_strip, const char *gcov_prefix,
@@ -961,6 +980,7 @@ void gcov_emit_gcov(void **store, struct sym *s, size_t nr_syms,
 	struct gcov_file *f;
 	int i;
 
+	gcov_files_free();
 	for (i = 0; i < nr_syms; i++) {
 		gcov_process_sym(&s[i], fp);
 	}
@@ -0,0 +1,758 @@
+/*
+ * Parallel merge of coverage databases and lcov info files.
+ *
+ * Copyright: 2026 Xilinx Inc
+ * Written by Edgar E. Iglesias <edgar.iglesias@xilinx.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "util.h"
+#include "safeio.h"
+#include "intern.h"
+#include "syms.h"
+#include "excludes.h"
+#include "coverage.h"
+#include "cov-db.h"
+#include "cov-merge.h"
+
+/*
+ * A kind of input that is summed up by cov_merge_reduce. Sums are
+ * created and added to by one thread at a time.
+ */
+struct cov_merge_ops {
+	void *(*create)(void *opaque);
+	/* Add the input filename to sum.  */
+	void (*add)(void *sum, const char *filename, void *opaque);
+	/* Add sum b to a and free b.  */
+	void (*merge)(void *a, void *b, void *opaque);
+};
+
+struct cov_merge_job {
+	pthread_t tid;
+	const struct cov_merge_ops *ops;
+	void *opaque;
+	void *sum;
+
+	/* The share of the inputs to add.  */
+	char **files;
+	unsigned int nr_files;
+	/* The sum to merge in, in the rounds.  */
+	void *other;
+};
+
+static void cov_merge_block_signals(void)
+{
+	sigset_t set;
+
+	/* Leave signal handling to the main thread.  */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+}
+
+static void *cov_merge_add_thread(void *opaque)
+{
+	struct cov_merge_job *j = opaque;
+	unsigned int i;
+
+	cov_merge_block_signals();
+	for (i = 0; i < j->nr_files; i++)
+		j->ops->add(j->sum, j->files[i], j->opaque);
+	return NULL;
+}
+
+static void *cov_merge_pair_thread(void *opaque)
+{
+	struct cov_merge_job *j = opaque;
+
+	cov_merge_block_signals();
+	j->ops->merge(j->sum, j->other, j->opaque);
+	j->other = NULL;
+	return NULL;
+}
+
+static void cov_merge_start(struct cov_merge_job *j, void *(*fn)(void *))
+{
+	int err;
+
+	err = pthread_create(&j->tid, NULL, fn, j);
+	if (err) {
+		fprintf(stderr, "pthread_create: %s\n", strerror(err));
+		exit(EXIT_FAILURE);
+	}
+}
+
+static unsigned int cov_merge_nr_jobs(unsigned int jobs, unsigned int nr_files)
+{
+	long n = jobs;
+
+	if (!n)
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n < 1)
+		n = 1;
+	return n < nr_files ? n : nr_files;
+}
+
+/*
+ * Sum up nr_files inputs, at least one. Every thread sums up an equal
+ * share of them, in order. The sums of the threads are then added up
+ * pairwise in log2(threads) rounds, those of a round in parallel.
+ * Sums keep the order of the inputs, so the result doesn't depend on
+ * the nr of threads.
+ */
+static void *cov_merge_reduce(const struct cov_merge_ops *ops, void *opaque,
+			      char **files, unsigned int nr_files,
+			      unsigned int jobs)
+{
+	struct cov_merge_job *j;
+	unsigned int n, i, step;
+	void *sum;
+
+	n = cov_merge_nr_jobs(jobs, nr_files);
+	j = safe_mallocz(sizeof *j * n);
+	for (i = 0; i < n; i++) {
+		unsigned int first = (uint64_t) nr_files * i / n;
+
+		j[i].ops = ops;
+		j[i].opaque = opaque;
+		j[i].sum = ops->create(opaque);
+		j[i].files = files + first;
+		j[i].nr_files = (uint64_t) nr_files * (i + 1) / n - first;
+		cov_merge_start(&j[i], cov_merge_add_thread);
+	}
+	for (i = 0; i < n; i++)
+		pthread_join(j[i].tid, NULL);
+
+	for (step = 1; step < n; step *= 2) {
+		for (i = 0; i + step < n; i += step * 2) {
+			j[i].other = j[i + step].sum;
+			cov_merge_start(&j[i], cov_merge_pair_thread);
+		}
+		for (i = 0; i + step < n; i += step * 2)
+			pthread_join(j[i].tid, NULL);
+	}
+
+	sum = j[0].sum;
+	free(j);
+	return sum;
+}
+
+/* Coverage databases are summed up in clones of the store.  */
+struct cov_merge_db {
+	void *clone;
+	struct cov_db db;
+};
+
+struct cov_merge_db_ctx {
+	void **store;
+	struct cov_db *db;
+};
+
+static void *cov_merge_db_create(void *opaque)
+{
+	struct cov_merge_db_ctx *ctx = opaque;
+	struct cov_merge_db *s = safe_mallocz(sizeof *s);
+
+	s->clone = sym_store_clone(ctx->store);
+	/* Those of the main db, bfd isn't thread-safe.  */
+	s->db.ids = ctx->db->ids;
+	s->db.nr_ids = ctx->db->nr_ids;
+	return s;
+}
+
+static void cov_merge_db_add(void *sum, const char *filename, void *opaque)
+{
+	struct cov_merge_db *s = sum;
+
+	if (!cov_db_load(&s->db, &s->clone, filename)) {
+		fprintf(stderr, "%s: %s\n", filename, strerror(ENOENT));
+		exit(EXIT_FAILURE);
+	}
+
+	/* ELFs without --elf can't be emitted, only count them.  */
+	free(s->db.other);
+	s->db.other = NULL;
+	s->db.other_len = 0;
+}
+
+static void cov_merge_db_free(struct cov_merge_db *s)
+{
+	s->db.ids = NULL;
+	s->db.nr_ids = 0;
+	cov_db_free(&s->db);
+	free(s);
+}
+
+static void cov_merge_db_merge(void *a, void *b, void *opaque)
+{
+	struct cov_merge_db *sa = a, *sb = b;
+
+	sym_store_merge(&sa->clone, sb->clone);
+	sa->db.nr_runs += sb->db.nr_runs;
+	sa->db.nr_other += sb->db.nr_other;
+	cov_merge_db_free(sb);
+}
+
+static const struct cov_merge_ops cov_merge_db_ops = {
+	.create = cov_merge_db_create,
+	.add = cov_merge_db_add,
+	.merge = cov_merge_db_merge,
+};
+
+static void cov_merge_dbs(void **store, struct cov_db *db, char **files,
+			  unsigned int nr_files, unsigned int jobs)
+{
+	struct cov_merge_db_ctx ctx = { .store = store, .db = db };
+	struct cov_merge_db *s;
+
+	cov_db_init(db, store);
+	s = cov_merge_reduce(&cov_merge_db_ops, &ctx, files, nr_files, jobs);
+	sym_store_merge(store, s->clone);
+	db->nr_runs += s->db.nr_runs;
+	if (s->db.nr_other)
+		fprintf(stderr, "Skipped the coverage of %u ELFs that weren't "
+			"given with --elf\n", s->db.nr_other);
+	cov_merge_db_free(s);
+}
+
+/*
+ * lcov info files have no addresses, so they are summed up by source
+ * line instead. Files and functions are looked up by their interned
+ * name.
+ */
+struct lcov_hash_slot {
+	const char *name;
+	unsigned int idx;
+};
+
+struct lcov_hash {
+	struct lcov_hash_slot *slots;
+	unsigned int size;
+	unsigned int nr;
+};
+
+struct lcov_fn {
+	const char *name;
+	/* 0 if there was no FN record.  */
+	unsigned int linenr;
+	uint64_t count;
+	/* There was an FNDA record.  */
+	bool ran;
+};
+
+struct lcov_file {
+	const char *name;
+	uint64_t *lines;
+	bool *instr_lines;
+	unsigned int nr_lines;
+
+	struct lcov_fn *fns;
+	unsigned int nr_fns, nr_fns_alloc;
+	struct lcov_hash fn_hash;
+};
+
+struct lcov_set {
+	/* In the order they first came.  */
+	struct lcov_file **files;
+	unsigned int nr_files, nr_files_alloc;
+	struct lcov_hash file_hash;
+};
+
+/* Guards against lines that would take GBs.  */
+#define LCOV_MAX_LINE	(1U << 24)
+
+static bool lcov_warned_branches;
+
+static inline unsigned int lcov_hash_fn(const char *name, unsigned int size)
+{
+	return (str_id(name) * 2654435761U) & (size - 1);
+}
+
+static void lcov_hash_grow(struct lcov_hash *h)
+{
+	struct lcov_hash_slot *old = h->slots;
+	unsigned int old_size = h->size, i, j;
+
+	h->size = h->size ? h->size * 2 : 16;
+	h->slots = safe_mallocz(sizeof h->slots[0] * h->size);
+	for (i = 0; i < old_size; i++) {
+		if (!old[i].name)
+			continue;
+		j = lcov_hash_fn(old[i].name, h->size);
+		while (h->slots[j].name)
+			j = (j + 1) & (h->size - 1);
+		h->slots[j] = old[i];
+	}
+	free(old);
+}
+
+/*
+ * The index of the entry for name. Names that aren't there yet get
+ * next, the caller then adds their entry there.
+ */
+static unsigned int lcov_hash_get(struct lcov_hash *h, const char *name,
+				  unsigned int next)
+{
+	unsigned int i;
+
+	if (h->nr >= h->size / 2)
+		lcov_hash_grow(h);
+
+	i = lcov_hash_fn(name, h->size);
+	while (h->slots[i].name) {
+		if (h->slots[i].name == name)
+			return h->slots[i].idx;
+		i = (i + 1) & (h->size - 1);
+	}
+	h->slots[i].name = name;
+	h->slots[i].idx = next;
+	h->nr++;
+	return next;
+}
+
+static struct lcov_file *lcov_file_get(struct lcov_set *set, const char *name)
+{
+	unsigned int i = lcov_hash_get(&set->file_hash, name, set->nr_files);
+
+	if (i < set->nr_files)
+		return set->files[i];
+
+	if (set->nr_files == set->nr_files_alloc) {
+		set->nr_files_alloc = set->nr_files_alloc * 2 + 16;
+		set->files = safe_realloc(set->files, sizeof set->files[0]
+					  * set->nr_files_alloc);
+	}
+	set->files[i] = safe_mallocz(sizeof *set->files[i]);
+	set->files[i]->name = name;
+	set->nr_files++;
+	return set->files[i];
+}
+
+static struct lcov_fn *lcov_fn_get(struct lcov_file *f, const char *name)
+{
+	unsigned int i = lcov_hash_get(&f->fn_hash, name, f->nr_fns);
+
+	if (i < f->nr_fns)
+		return &f->fns[i];
+
+	if (f->nr_fns == f->nr_fns_alloc) {
+		f->nr_fns_alloc = f->nr_fns_alloc * 2 + 16;
+		f->fns = safe_realloc(f->fns, sizeof f->fns[0]
+				      * f->nr_fns_alloc);
+	}
+	memset(&f->fns[i], 0, sizeof f->fns[i]);
+	f->fns[i].name = name;
+	f->nr_fns++;
+	return &f->fns[i];
+}
+
+static void lcov_file_grow(struct lcov_file *f, unsigned int nr_lines)
+{
+	unsigned int n = f->nr_lines;
+
+	if (nr_lines <= n)
+		return;
+
+	nr_lines = nr_lines > n * 2 ? nr_lines : n * 2;
+	f->lines = safe_realloc(f->lines, sizeof f->lines[0] * nr_lines);
+	f->instr_lines = safe_realloc(f->instr_lines,
+				      sizeof f->instr_lines[0] * nr_lines);
+	memset(f->lines + n, 0, sizeof f->lines[0] * (nr_lines - n));
+	memset(f->instr_lines + n, 0,
+	       sizeof f->instr_lines[0] * (nr_lines - n));
+	f->nr_lines = nr_lines;
+}
+
+static void lcov_file_free(struct lcov_file *f)
+{
+	free(f->lines);
+	free(f->instr_lines);
+	free(f->fns);
+	free(f->fn_hash.slots);
+	free(f);
+}
+
+static void lcov_invalid(const char *filename, unsigned int nr)
+{
+	fprintf(stderr, "%s:%u: invalid lcov record\n", filename, nr);
+	exit(EXIT_FAILURE);
+}
+
+/*
+ * Add a record of an info file to set. Only the line and function
+ * counts are summed up, LF, LH, FNF and FNH are worked out again when
+ * written.
+ */
+static void lcov_parse_record(struct lcov_set *set, struct lcov_file **fp,
+			      char *line, const char *filename,
+			      unsigned int nr)
+{
+	struct lcov_file *f = *fp;
+	unsigned long l;
+	uint64_t count;
+	char *end;
+
+	if (!strncmp(line, "SF:", 3)) {
+		*fp = lcov_file_get(set, str_intern(line + 3));
+	} else if (!strcmp(line, "end_of_record")) {
+		*fp = NULL;
+	} else if (!strncmp(line, "DA:", 3)) {
+		l = strtoul(line + 3, &end, 10);
+		if (!f || *end != ',' || !l || l > LCOV_MAX_LINE)
+			lcov_invalid(filename, nr);
+		count = strtoull(end + 1, &end, 10);
+		/* lcov may add a checksum of the line.  */
+		if (*end && *end != ',')
+			lcov_invalid(filename, nr);
+
+		lcov_file_grow(f, l);
+		f->lines[l - 1] += count;
+		f->instr_lines[l - 1] = true;
+	} else if (!strncmp(line, "FN:", 3)) {
+		struct lcov_fn *fn;
+		char *name;
+
+		l = strtoul(line + 3, &end, 10);
+		if (!f || *end != ',')
+			lcov_invalid(filename, nr);
+		/* lcov 2 puts the last line of the function first.  */
+		name = end + 1;
+		if (isdigit(*name)) {
+			strtoul(name, &end, 10);
+			if (*end == ',')
+				name = end + 1;
+		}
+
+		fn = lcov_fn_get(f, str_intern(name));
+		if (!fn->linenr)
+			fn->linenr = l;
+	} else if (!strncmp(line, "FNDA:", 5)) {
+		struct lcov_fn *fn;
+
+		count = strtoull(line + 5, &end, 10);
+		if (!f || *end != ',')
+			lcov_invalid(filename, nr);
+
+		fn = lcov_fn_get(f, str_intern(end + 1));
+		fn->count += count;
+		fn->ran = true;
+	} else if (!strncmp(line, "BRDA:", 5)) {
+		if (!__atomic_exchange_n(&lcov_warned_branches, true,
+					 __ATOMIC_RELAXED))
+			fprintf(stderr, "Branch coverage is not merged\n");
+	}
+}
+
+static void lcov_parse(struct lcov_set *set, const char *filename)
+{
+	struct lcov_file *f = NULL;
+	char *buf = NULL, *p, *end;
+	size_t buf_size = 0;
+	unsigned int nr = 0;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		perror(filename);
+		exit(EXIT_FAILURE);
+	}
+	if (!st.st_size) {
+		close(fd);
+		return;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror(filename);
+		exit(EXIT_FAILURE);
+	}
+
+	p = map;
+	end = p + st.st_size;
+	while (p < end) {
+		char *nl = memchr(p, '\n', end - p);
+		size_t len;
+
+		if (!nl)
+			nl = end;
+		len = nl - p;
+		if (len && p[len - 1] == '\r')
+			len--;
+
+		/* Records are parsed in place of a copy with a 0 after.  */
+		if (len + 1 > buf_size) {
+			buf_size = len + 1 > 256 ? len + 1 : 256;
+			buf = safe_realloc(buf, buf_size);
+		}
+		memcpy(buf, p, len);
+		buf[len] = 0;
+		lcov_parse_record(set, &f, buf, filename, ++nr);
+		p = nl + 1;
+	}
+
+	free(buf);
+	munmap(map, st.st_size);
+}
+
+static void *lcov_create(void *opaque)
+{
+	return safe_mallocz(sizeof(struct lcov_set));
+}
+
+static void lcov_add(void *sum, const char *filename, void *opaque)
+{
+	lcov_parse(sum, filename);
+}
+
+static void lcov_file_merge(struct lcov_file *a, struct lcov_file *b)
+{
+	unsigned int i;
+
+	lcov_file_grow(a, b->nr_lines);
+	for (i = 0; i < b->nr_lines; i++) {
+		a->lines[i] += b->lines[i];
+		a->instr_lines[i] |= b->instr_lines[i];
+	}
+
+	for (i = 0; i < b->nr_fns; i++) {
+		struct lcov_fn *fn = lcov_fn_get(a, b->fns[i].name);
+
+		if (!fn->linenr)
+			fn->linenr = b->fns[i].linenr;
+		fn->count += b->fns[i].count;
+		fn->ran |= b->fns[i].ran;
+	}
+}
+
+static void lcov_set_free(struct lcov_set *set)
+{
+	free(set->files);
+	free(set->file_hash.slots);
+	free(set);
+}
+
+static void lcov_merge(void *a, void *b, void *opaque)
+{
+	struct lcov_set *sa = a, *sb = b;
+	unsigned int i;
+
+	for (i = 0; i < sb->nr_files; i++) {
+		struct lcov_file *fb = sb->files[i];
+		struct lcov_file *fa = lcov_file_get(sa, fb->name);
+
+		lcov_file_merge(fa, fb);
+		lcov_file_free(fb);
+	}
+	lcov_set_free(sb);
+}
+
+static const struct cov_merge_ops lcov_ops = {
+	.create = lcov_create,
+	.add = lcov_add,
+	.merge = lcov_merge,
+};
+
+static void lcov_write(struct lcov_set *set, FILE *fp, void *exclude,
+		       bool hits)
+{
+	unsigned int i, l;
+
+	for (i = 0; i < set->nr_files; i++) {
+		struct lcov_file *f = set->files[i];
+		unsigned int instr_lines = 0, exec_lines = 0;
+		bool file_has_excludes = false;
+
+		if (exclude)
+			file_has_excludes = excludes_match(exclude, f->name,
+							   -1);
+
+		fprintf(fp, "TN:\n");
+		fprintf(fp, "SF:%s\n", f->name);
+		for (l = 0; l < f->nr_fns; l++) {
+			struct lcov_fn *fn = &f->fns[l];
+
+			/* genhtml wants the line of every function.  */
+			if (!fn->linenr)
+				continue;
+
+			fprintf(fp, "FN:%u,%s\n", fn->linenr, fn->name);
+			if (fn->ran) {
+				fprintf(fp, "FNDA:%" PRIu64 ",%s\n",
+					hits ? !!fn->count : fn->count,
+					fn->name);
+			}
+		}
+
+		for (l = 0; l < f->nr_lines; l++) {
+			uint64_t v = f->lines[l];
+
+			if (!f->instr_lines[l])
+				continue;
+			if (file_has_excludes
+			    && excludes_match(exclude, f->name, l + 1))
+				continue;
+
+			instr_lines++;
+			exec_lines += !!v;
+			fprintf(fp, "DA:%u,%" PRIu64 "\n", l + 1,
+				hits ? !!v : v);
+		}
+		fprintf(fp, "LF:%u\n", instr_lines);
+		fprintf(fp, "LH:%u\n", exec_lines);
+		fprintf(fp, "end_of_record\n");
+	}
+}
+
+/* Coverage databases start with their magic, anything else is lcov.  */
+static bool cov_merge_is_db(const char *filename)
+{
+	uint32_t magic = 0;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		perror(filename);
+		exit(EXIT_FAILURE);
+	}
+	if (safe_read(fd, &magic, sizeof magic) != sizeof magic)
+		magic = 0;
+	close(fd);
+	return magic == COV_DB_MAGIC;
+}
+
+/*
+ * Sum up the coverage databases and lcov info files in files and emit
+ * the sum in opts->fmt. Databases are added to the counters of store,
+ * and their runs to db if the sum is saved to a database. lcov info
+ * files can only be emitted as lcov. With databases among them, the
+ * lcov of those is merged in as one more info file.
+ */
+bool cov_merge(void **store, struct cov_db *db, char **files,
+	       unsigned int nr_files, const struct cov_merge_opts *opts)
+{
+	struct cov_db local = { 0 };
+	unsigned int nr_dbs = 0, nr_infos = 0, i;
+	char **dbs, **infos, *tmpname = NULL;
+	struct lcov_set *set;
+	bool ok = false;
+	void *ex;
+	FILE *fp;
+
+	dbs = safe_malloc(sizeof dbs[0] * nr_files);
+	infos = safe_malloc(sizeof infos[0] * (nr_files + 1));
+	for (i = 0; i < nr_files; i++) {
+		if (cov_merge_is_db(files[i]))
+			dbs[nr_dbs++] = files[i];
+		else
+			infos[nr_infos++] = files[i];
+	}
+
+	if (nr_dbs && !sym_store_nr_objs(store)) {
+		fprintf(stderr, "Coverage databases can only be merged "
+			"with --elf\n");
+		goto out;
+	}
+	if (nr_infos && opts->fmt != LCOV) {
+		fprintf(stderr, "lcov info files can only be merged into "
+			"lcov\n");
+		goto out;
+	}
+	/* The sum of info files is written by hand, not by a format.  */
+	if (nr_infos && !opts->output) {
+		fprintf(stderr, "Merging lcov info files needs "
+			"--coverage-output\n");
+		goto out;
+	}
+	if (nr_infos && db) {
+		fprintf(stderr, "lcov info files can't be added to a "
+			"coverage database\n");
+		goto out;
+	}
+
+	fprintf(stderr, "Merging %u coverage databases and %u lcov info "
+		"files\n", nr_dbs, nr_infos);
+
+	if (nr_dbs)
+		cov_merge_dbs(store, db ? db : &local, dbs, nr_dbs,
+			      opts->jobs);
+
+	if (!nr_infos) {
+		if (opts->fmt != NONE)
+			coverage_emit(store, opts->output, opts->fmt,
+				      opts->gcov_strip, opts->gcov_prefix,
+				      opts->exclude);
+		ok = true;
+		goto out;
+	}
+
+	if (nr_dbs) {
+		if (asprintf(&tmpname, "%s.%d", opts->output, getpid()) < 0) {
+			tmpname = NULL;
+			goto out;
+		}
+		/* Excludes apply once, to the sum.  */
+		coverage_emit(store, tmpname, LCOV, opts->gcov_strip,
+			      opts->gcov_prefix, NULL);
+		infos[nr_infos++] = tmpname;
+	}
+
+	set = cov_merge_reduce(&lcov_ops, NULL, infos, nr_infos, opts->jobs);
+
+	fp = fopen(opts->output, "w");
+	if (!fp) {
+		perror(opts->output);
+	} else {
+		ex = excludes_create(opts->exclude);
+		lcov_write(set, fp, ex, opts->hits);
+		ok = !ferror(fp);
+		if (fclose(fp) || !ok) {
+			perror(opts->output);
+			ok = false;
+		}
+	}
+
+	for (i = 0; i < set->nr_files; i++)
+		lcov_file_free(set->files[i]);
+	lcov_set_free(set);
+out:
+	if (tmpname) {
+		unlink(tmpname);
+		free(tmpname);
+	}
+	cov_db_free(&local);
+	free(dbs);
+	free(infos);
+	return ok;
+}
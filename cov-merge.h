@@ -0,0 +1,42 @@
+/*
+ * Parallel merge of coverage databases and lcov info files.
+ *
+ * Copyright: 2026 Xilinx Inc
+ * Written by Edgar E. Iglesias <edgar.iglesias@xilinx.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+#ifndef _COV_MERGE_H
+#define _COV_MERGE_H
+
+#include <stdbool.h>
+
+#include "coverage.h"
+#include "cov-db.h"
+
+struct cov_merge_opts {
+	enum cov_format fmt;
+	const char *output;
+	const char *gcov_strip;
+	const char *gcov_prefix;
+	const char *exclude;
+	bool hits;
+	/* Nr of threads, 0 uses all online CPUs.  */
+	unsigned int jobs;
+};
+
+bool cov_merge(void **store, struct cov_db *db, char **files,
+	       unsigned int nr_files, const struct cov_merge_opts *opts);
+#endif
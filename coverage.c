@@ -48,18 +48,30 @@ static void coverage_dump_sym(struct sym *s, FILE *fp)
 	uint64_t addr, end = s->addr + s->size;
 	unsigned int i =  0;
 	uint64_t accounted = 0;
+	struct sym_linemap_iter it;
+	struct sym_src_loc loc;
+	bool more;
 
+	sym_linemap_iter(&it, s);
+	more = sym_linemap_next(&it, &loc);
 	for (addr = s->addr; addr < end; addr += 4) {
+		unsigned int linenr = 0;
 		uint64_t v = 0;
 
-		if (s->cov)
-			v = s->cov->counter[i];
+		if (s->cnt.cov)
+			v = sym_cov_get(s->cnt.cov, i);
 		accounted += v;
 
+		/* The first row of the word gives its line.  */
+		while (more && loc.word < i)
+			more = sym_linemap_next(&it, &loc);
+		if (more && loc.word == i)
+			linenr = loc.linenr;
+
 		fprintf(fp, "%" PRId64 " %" PRIx64 " %s %s:%d\n",
 			v, addr, s->name,
 			s->src_filename ? s->src_filename : "unknown",
-			s->linemap ? s->linemap->locs[i].linenr : 0);
+			linenr);
 		i++;
 	}
 }
@@ -72,7 +84,7 @@ static void coverage_dump(struct sym *s, size_t nr_syms,
 	for (i = 0; i < nr_syms; i++) {
 		coverage_dump_sym(&s[i], fp);
 	}
-	fprintf(fp, "%" PRId64 " x unknown\n", unknown->total_time);
+	fprintf(fp, "%" PRId64 " x unknown\n", unknown->cnt.total_time);
 }
 
 void coverage_emit(void **store, const char *filename, enum cov_format fmt,
@@ -87,6 +99,8 @@ void coverage_emit(void **store, const char *filename, enum cov_format fmt,
 	printf("%s\n", __func__);
 	ex = excludes_create(exclude);
 
+	sym_store_flush(store);
+	sym_store_load_linemaps(store);
 	s = sym_get_all(store, &nr_syms);
 	if (!s)
 		return;
@@ -123,6 +137,25 @@ void coverage_emit(void **store, const char *filename, enum cov_format fmt,
 }
 
 void coverage_init(void **store, const char *filename, enum cov_format fmt,
-		const char *gcov_strip, const char *gcov_prefix)
+		const char *gcov_strip, const char *gcov_prefix, bool hits)
 {
+	unsigned int flags = 0;
+
+	/* Only keep the counters that fmt reads.  */
+	switch (fmt) {
+	case ETRACE:
+		flags = SYM_CNT_COV;
+		break;
+	case CACHEGRIND:
+		flags = SYM_CNT_TIME;
+		break;
+	case GCOV:
+	case QCOV:
+	case LCOV:
+		flags = hits ? SYM_CNT_HITS : SYM_CNT_ENT;
+		break;
+	default:
+		break;
+	}
+	sym_store_set_counters(store, flags);
 }
@@ -32,6 +32,6 @@ void coverage_emit(void **store, const char *filename, enum cov_format fmt,
 		const char *gcov_strip, const char *gcov_prefix,
 		const char *exclude);
 void coverage_init(void **store, const char *filename, enum cov_format fmt,
-                const char *gcov_strip, const char *gcov_prefix);
+                const char *gcov_strip, const char *gcov_prefix, bool hits);
 
 #endif
@@ -0,0 +1,1571 @@
+/*
+ * Decoder for DWARF 2 - 5 line tables.
+ *
+ * Copyright: 2026 Xilinx Inc
+ * Written by Edgar E. Iglesias <edgar.iglesias@xilinx.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <bfd.h>
+
+#include "util.h"
+#include "filename.h"
+#include "intern.h"
+#include "dwarf.h"
+
+/* The few DWARF constants we need, dwarf.h isn't always installed.  */
+#define DW_UT_compile			0x01
+#define DW_UT_partial			0x03
+#define DW_UT_skeleton			0x04
+
+#define DW_TAG_inlined_subroutine	0x1d
+
+#define DW_AT_name			0x03
+#define DW_AT_stmt_list			0x10
+#define DW_AT_low_pc			0x11
+#define DW_AT_high_pc			0x12
+#define DW_AT_comp_dir			0x1b
+#define DW_AT_ranges			0x55
+#define DW_AT_str_offsets_base		0x72
+#define DW_AT_addr_base			0x73
+#define DW_AT_rnglists_base		0x74
+#define DW_AT_GNU_addr_base		0x2133
+
+#define DW_FORM_addr			0x01
+#define DW_FORM_block2			0x03
+#define DW_FORM_block4			0x04
+#define DW_FORM_data2			0x05
+#define DW_FORM_data4			0x06
+#define DW_FORM_data8			0x07
+#define DW_FORM_string			0x08
+#define DW_FORM_block			0x09
+#define DW_FORM_block1			0x0a
+#define DW_FORM_data1			0x0b
+#define DW_FORM_flag			0x0c
+#define DW_FORM_sdata			0x0d
+#define DW_FORM_strp			0x0e
+#define DW_FORM_udata			0x0f
+#define DW_FORM_ref_addr		0x10
+#define DW_FORM_ref1			0x11
+#define DW_FORM_ref2			0x12
+#define DW_FORM_ref4			0x13
+#define DW_FORM_ref8			0x14
+#define DW_FORM_ref_udata		0x15
+#define DW_FORM_indirect		0x16
+#define DW_FORM_sec_offset		0x17
+#define DW_FORM_exprloc			0x18
+#define DW_FORM_flag_present		0x19
+#define DW_FORM_strx			0x1a
+#define DW_FORM_addrx			0x1b
+#define DW_FORM_ref_sup4		0x1c
+#define DW_FORM_strp_sup		0x1d
+#define DW_FORM_data16			0x1e
+#define DW_FORM_line_strp		0x1f
+#define DW_FORM_ref_sig8		0x20
+#define DW_FORM_implicit_const		0x21
+#define DW_FORM_loclistx		0x22
+#define DW_FORM_rnglistx		0x23
+#define DW_FORM_ref_sup8		0x24
+#define DW_FORM_strx1			0x25
+#define DW_FORM_strx2			0x26
+#define DW_FORM_strx3			0x27
+#define DW_FORM_strx4			0x28
+#define DW_FORM_addrx1			0x29
+#define DW_FORM_addrx2			0x2a
+#define DW_FORM_addrx3			0x2b
+#define DW_FORM_addrx4			0x2c
+#define DW_FORM_GNU_addr_index		0x1f01
+#define DW_FORM_GNU_str_index		0x1f02
+#define DW_FORM_GNU_ref_alt		0x1f20
+#define DW_FORM_GNU_strp_alt		0x1f21
+
+#define DW_RLE_end_of_list		0x00
+#define DW_RLE_base_addressx		0x01
+#define DW_RLE_startx_endx		0x02
+#define DW_RLE_startx_length		0x03
+#define DW_RLE_offset_pair		0x04
+#define DW_RLE_base_address		0x05
+#define DW_RLE_start_end		0x06
+#define DW_RLE_start_length		0x07
+
+#define DW_LNS_copy			0x01
+#define DW_LNS_advance_pc		0x02
+#define DW_LNS_advance_line		0x03
+#define DW_LNS_set_file			0x04
+#define DW_LNS_set_column		0x05
+#define DW_LNS_negate_stmt		0x06
+#define DW_LNS_set_basic_block		0x07
+#define DW_LNS_const_add_pc		0x08
+#define DW_LNS_fixed_advance_pc		0x09
+
+#define DW_LNE_end_sequence		0x01
+#define DW_LNE_set_address		0x02
+#define DW_LNE_define_file		0x03
+
+#define DW_LNCT_path			0x01
+#define DW_LNCT_directory_index		0x02
+
+enum {
+	SECT_INFO,
+	SECT_ABBREV,
+	SECT_LINE,
+	SECT_LINE_STR,
+	SECT_STR,
+	SECT_STR_OFFSETS,
+	SECT_ADDR,
+	SECT_RANGES,
+	SECT_RNGLISTS,
+	NR_SECTS
+};
+
+static const char *dwarf_sect_names[NR_SECTS] = {
+	[SECT_INFO] = ".debug_info",
+	[SECT_ABBREV] = ".debug_abbrev",
+	[SECT_LINE] = ".debug_line",
+	[SECT_LINE_STR] = ".debug_line_str",
+	[SECT_STR] = ".debug_str",
+	[SECT_STR_OFFSETS] = ".debug_str_offsets",
+	[SECT_ADDR] = ".debug_addr",
+	[SECT_RANGES] = ".debug_ranges",
+	[SECT_RNGLISTS] = ".debug_rnglists",
+};
+
+struct dwarf_sect {
+	uint8_t *data;
+	uint64_t size;
+};
+
+/* What we need to know about a compilation unit to decode its lines.  */
+struct dwarf_cu {
+	unsigned int version;
+	unsigned int offsize;
+	unsigned int addr_size;
+	/* .debug_info offsets of the abbrevs, the first DIE and the end.  */
+	uint64_t abbrev_off;
+	uint64_t die_off;
+	uint64_t end;
+
+	uint64_t line_off;
+	const char *comp_dir;
+	uint64_t base_addr;
+	uint64_t str_offsets_base;
+	uint64_t addr_base;
+	uint64_t rnglists_base;
+	bool has_info;
+	/* Other units were dropped for sharing this unit's line table.  */
+	bool shared;
+};
+
+struct dwarf {
+	bool big_endian;
+	struct dwarf_sect sect[NR_SECTS];
+
+	struct dwarf_cu *units;
+	unsigned int nr_units;
+	/* The units to decode, handed out to the workers in turn.  */
+	unsigned int *todo;
+	unsigned int nr_todo;
+	unsigned int next_unit;
+};
+
+/* Bounds checked reader, running off the end sets err and reads zeros.  */
+struct dwarf_buf {
+	const uint8_t *p, *end;
+	bool big_endian;
+	bool err;
+};
+
+static void buf_init(struct dwarf_buf *b, const struct dwarf *d,
+		     const struct dwarf_sect *s, uint64_t off, uint64_t end)
+{
+	if (end > s->size)
+		end = s->size;
+	if (off > end)
+		off = end;
+	b->p = s->data + off;
+	b->end = s->data + end;
+	b->big_endian = d->big_endian;
+	b->err = false;
+}
+
+static bool buf_need(struct dwarf_buf *b, uint64_t n)
+{
+	if (b->err || b->end - b->p < n) {
+		b->err = true;
+		b->p = b->end;
+		return false;
+	}
+	return true;
+}
+
+static void buf_skip(struct dwarf_buf *b, uint64_t n)
+{
+	if (buf_need(b, n))
+		b->p += n;
+}
+
+static uint64_t buf_uN(struct dwarf_buf *b, unsigned int n)
+{
+	uint64_t v = 0;
+	unsigned int i;
+
+	if (!buf_need(b, n))
+		return 0;
+
+	for (i = 0; i < n; i++) {
+		unsigned int shift = b->big_endian ? (n - 1 - i) * 8 : i * 8;
+
+		v |= (uint64_t) b->p[i] << shift;
+	}
+	b->p += n;
+	return v;
+}
+
+static inline uint8_t buf_u8(struct dwarf_buf *b)
+{
+	return buf_uN(b, 1);
+}
+
+static inline uint16_t buf_u16(struct dwarf_buf *b)
+{
+	return buf_uN(b, 2);
+}
+
+static uint64_t buf_uleb(struct dwarf_buf *b)
+{
+	uint64_t v = 0;
+	unsigned int shift = 0;
+	uint8_t c;
+
+	do {
+		if (!buf_need(b, 1))
+			return 0;
+		c = *b->p++;
+		if (shift < 64)
+			v |= (uint64_t) (c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+	return v;
+}
+
+static int64_t buf_sleb(struct dwarf_buf *b)
+{
+	uint64_t v = 0;
+	unsigned int shift = 0;
+	uint8_t c;
+
+	do {
+		if (!buf_need(b, 1))
+			return 0;
+		c = *b->p++;
+		if (shift < 64)
+			v |= (uint64_t) (c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	if (shift < 64 && (c & 0x40))
+		v |= ~0ULL << shift;
+	return v;
+}
+
+static const char *buf_str(struct dwarf_buf *b)
+{
+	const char *s = (const char *) b->p;
+	size_t len;
+
+	if (b->err)
+		return NULL;
+	len = strnlen(s, b->end - b->p);
+	if (!buf_need(b, len + 1))
+		return NULL;
+	b->p += len + 1;
+	return s;
+}
+
+/* Unit length, sets the offset size to 4 or 8 for 32/64bit DWARF.  */
+static uint64_t buf_unit_length(struct dwarf_buf *b, unsigned int *offsize)
+{
+	uint64_t len = buf_uN(b, 4);
+
+	*offsize = 4;
+	if (len == 0xffffffff) {
+		len = buf_uN(b, 8);
+		*offsize = 8;
+	}
+	return len;
+}
+
+static const char *dwarf_sect_str(const struct dwarf *d, unsigned int sect,
+				  uint64_t off)
+{
+	const struct dwarf_sect *s = &d->sect[sect];
+
+	if (off >= s->size || !memchr(s->data + off, 0, s->size - off))
+		return NULL;
+	return (const char *) s->data + off;
+}
+
+static uint64_t dwarf_sect_uN(const struct dwarf *d, unsigned int sect,
+			      uint64_t off, unsigned int n)
+{
+	struct dwarf_buf b;
+
+	buf_init(&b, d, &d->sect[sect], off, d->sect[sect].size);
+	return buf_uN(&b, n);
+}
+
+/* A decoded attribute value, see dwarf_read_form.  */
+struct dwarf_val {
+	uint64_t form;
+	uint64_t u;
+	const char *str;
+};
+
+static bool form_is_strx(uint64_t form)
+{
+	return form == DW_FORM_strx || form == DW_FORM_GNU_str_index
+		|| (form >= DW_FORM_strx1 && form <= DW_FORM_strx4);
+}
+
+static bool form_is_addrx(uint64_t form)
+{
+	return form == DW_FORM_addrx || form == DW_FORM_GNU_addr_index
+		|| (form >= DW_FORM_addrx1 && form <= DW_FORM_addrx4);
+}
+
+/*
+ * Read a value of form. Constants, offsets, refs, addresses and indexes
+ * end up in v->u, strings that need no unit state in v->str. Returns
+ * false for forms we don't know how to skip.
+ */
+static bool dwarf_read_form(const struct dwarf *d, const struct dwarf_cu *cu,
+			    struct dwarf_buf *b, uint64_t form,
+			    int64_t implicit, struct dwarf_val *v)
+{
+	v->form = form;
+	v->u = 0;
+	v->str = NULL;
+
+	switch (form) {
+	case DW_FORM_addr:
+		v->u = buf_uN(b, cu->addr_size);
+		break;
+	case DW_FORM_flag:
+	case DW_FORM_data1:
+	case DW_FORM_ref1:
+	case DW_FORM_strx1:
+	case DW_FORM_addrx1:
+		v->u = buf_uN(b, 1);
+		break;
+	case DW_FORM_data2:
+	case DW_FORM_ref2:
+	case DW_FORM_strx2:
+	case DW_FORM_addrx2:
+		v->u = buf_uN(b, 2);
+		break;
+	case DW_FORM_strx3:
+	case DW_FORM_addrx3:
+		v->u = buf_uN(b, 3);
+		break;
+	case DW_FORM_data4:
+	case DW_FORM_ref4:
+	case DW_FORM_ref_sup4:
+	case DW_FORM_strx4:
+	case DW_FORM_addrx4:
+		v->u = buf_uN(b, 4);
+		break;
+	case DW_FORM_data8:
+	case DW_FORM_ref8:
+	case DW_FORM_ref_sig8:
+	case DW_FORM_ref_sup8:
+		v->u = buf_uN(b, 8);
+		break;
+	case DW_FORM_data16:
+		buf_skip(b, 16);
+		break;
+	case DW_FORM_sdata:
+		v->u = buf_sleb(b);
+		break;
+	case DW_FORM_udata:
+	case DW_FORM_ref_udata:
+	case DW_FORM_strx:
+	case DW_FORM_addrx:
+	case DW_FORM_loclistx:
+	case DW_FORM_rnglistx:
+	case DW_FORM_GNU_addr_index:
+	case DW_FORM_GNU_str_index:
+		v->u = buf_uleb(b);
+		break;
+	case DW_FORM_string:
+		v->str = buf_str(b);
+		break;
+	case DW_FORM_strp:
+		v->u = buf_uN(b, cu->offsize);
+		v->str = dwarf_sect_str(d, SECT_STR, v->u);
+		break;
+	case DW_FORM_line_strp:
+		v->u = buf_uN(b, cu->offsize);
+		v->str = dwarf_sect_str(d, SECT_LINE_STR, v->u);
+		break;
+	case DW_FORM_ref_addr:
+		v->u = buf_uN(b, cu->version <= 2 ? cu->addr_size
+						  : cu->offsize);
+		break;
+	case DW_FORM_sec_offset:
+	case DW_FORM_strp_sup:
+	case DW_FORM_GNU_ref_alt:
+	case DW_FORM_GNU_strp_alt:
+		v->u = buf_uN(b, cu->offsize);
+		break;
+	case DW_FORM_block1:
+		buf_skip(b, buf_uN(b, 1));
+		break;
+	case DW_FORM_block2:
+		buf_skip(b, buf_uN(b, 2));
+		break;
+	case DW_FORM_block4:
+		buf_skip(b, buf_uN(b, 4));
+		break;
+	case DW_FORM_block:
+	case DW_FORM_exprloc:
+		buf_skip(b, buf_uleb(b));
+		break;
+	case DW_FORM_flag_present:
+		v->u = 1;
+		break;
+	case DW_FORM_implicit_const:
+		v->u = implicit;
+		break;
+	case DW_FORM_indirect:
+		form = buf_uleb(b);
+		if (form == DW_FORM_indirect)
+			return false;
+		return dwarf_read_form(d, cu, b, form, implicit, v);
+	default:
+		return false;
+	}
+	return !b->err;
+}
+
+/* String of a strx form, or v->str for the others.  */
+static const char *dwarf_val_str(const struct dwarf *d,
+				 const struct dwarf_cu *cu,
+				 const struct dwarf_val *v)
+{
+	uint64_t off;
+
+	if (!form_is_strx(v->form))
+		return v->str;
+
+	off = dwarf_sect_uN(d, SECT_STR_OFFSETS,
+			    cu->str_offsets_base + v->u * cu->offsize,
+			    cu->offsize);
+	return dwarf_sect_str(d, SECT_STR, off);
+}
+
+static uint64_t dwarf_addrx(const struct dwarf *d, const struct dwarf_cu *cu,
+			    uint64_t idx)
+{
+	return dwarf_sect_uN(d, SECT_ADDR, cu->addr_base + idx * cu->addr_size,
+			     cu->addr_size);
+}
+
+static uint64_t dwarf_val_addr(const struct dwarf *d,
+			       const struct dwarf_cu *cu,
+			       const struct dwarf_val *v)
+{
+	if (form_is_addrx(v->form))
+		return dwarf_addrx(d, cu, v->u);
+	return v->u;
+}
+
+struct dwarf_abbrev {
+	uint64_t code;
+	uint64_t tag;
+	bool children;
+	/* (name, form [, implicit const]) specs, ending with (0, 0).  */
+	const uint8_t *attrs;
+};
+
+struct dwarf_abbrevs {
+	struct dwarf_abbrev *tab;
+	size_t nr, nr_alloc;
+};
+
+/*
+ * Parse the abbrev table at off. If stop_code is non zero, parsing
+ * stops once that code has been seen.
+ */
+static bool dwarf_abbrevs_parse(const struct dwarf *d, uint64_t off,
+				uint64_t stop_code, struct dwarf_abbrevs *a)
+{
+	struct dwarf_buf b;
+
+	memset(a, 0, sizeof *a);
+	buf_init(&b, d, &d->sect[SECT_ABBREV], off, d->sect[SECT_ABBREV].size);
+
+	while (!b.err) {
+		struct dwarf_abbrev *ab;
+		uint64_t code, name, form;
+
+		code = buf_uleb(&b);
+		if (!code)
+			break;
+
+		if (a->nr == a->nr_alloc) {
+			a->nr_alloc = a->nr_alloc ? a->nr_alloc * 2 : 64;
+			a->tab = safe_realloc(a->tab,
+					      sizeof a->tab[0] * a->nr_alloc);
+		}
+		ab = &a->tab[a->nr++];
+		ab->code = code;
+		ab->tag = buf_uleb(&b);
+		ab->children = buf_u8(&b);
+		ab->attrs = b.p;
+		do {
+			name = buf_uleb(&b);
+			form = buf_uleb(&b);
+			if (form == DW_FORM_implicit_const)
+				buf_sleb(&b);
+		} while ((name || form) && !b.err);
+
+		if (code == stop_code)
+			break;
+	}
+	return !b.err;
+}
+
+static const struct dwarf_abbrev *dwarf_abbrev_find(
+				const struct dwarf_abbrevs *a, uint64_t code)
+{
+	size_t i;
+
+	/* Producers number abbrevs from 1 and up.  */
+	if (code - 1 < a->nr && a->tab[code - 1].code == code)
+		return &a->tab[code - 1];
+
+	for (i = 0; i < a->nr; i++) {
+		if (a->tab[i].code == code)
+			return &a->tab[i];
+	}
+	return NULL;
+}
+
+/*
+ * Read the attributes of a DIE. fn is called for each one. Returns
+ * false if the DIE can't be parsed.
+ */
+static bool dwarf_die_attrs(const struct dwarf *d, const struct dwarf_cu *cu,
+			    struct dwarf_buf *b, const struct dwarf_abbrev *ab,
+			    void (*fn)(void *opaque, uint64_t name,
+				       const struct dwarf_val *v),
+			    void *opaque)
+{
+	struct dwarf_buf spec = {
+		.p = ab->attrs,
+		.end = d->sect[SECT_ABBREV].data + d->sect[SECT_ABBREV].size,
+	};
+
+	while (true) {
+		struct dwarf_val v;
+		uint64_t name, form;
+		int64_t implicit = 0;
+
+		name = buf_uleb(&spec);
+		form = buf_uleb(&spec);
+		if (!name && !form)
+			break;
+		if (form == DW_FORM_implicit_const)
+			implicit = buf_sleb(&spec);
+
+		if (!dwarf_read_form(d, cu, b, form, implicit, &v))
+			return false;
+		if (fn)
+			fn(opaque, name, &v);
+	}
+	return !spec.err;
+}
+
+struct dwarf_cu_attrs {
+	struct dwarf_val name, comp_dir, low_pc;
+	bool has_stmt_list;
+	bool has_str_offsets_base;
+	uint64_t stmt_list;
+	uint64_t str_offsets_base;
+	uint64_t addr_base;
+	uint64_t rnglists_base;
+};
+
+static void dwarf_cu_attr(void *opaque, uint64_t name,
+			  const struct dwarf_val *v)
+{
+	struct dwarf_cu_attrs *ca = opaque;
+
+	switch (name) {
+	case DW_AT_name:
+		ca->name = *v;
+		break;
+	case DW_AT_comp_dir:
+		ca->comp_dir = *v;
+		break;
+	case DW_AT_low_pc:
+		ca->low_pc = *v;
+		break;
+	case DW_AT_stmt_list:
+		ca->stmt_list = v->u;
+		ca->has_stmt_list = true;
+		break;
+	case DW_AT_str_offsets_base:
+		ca->str_offsets_base = v->u;
+		ca->has_str_offsets_base = true;
+		break;
+	case DW_AT_addr_base:
+	case DW_AT_GNU_addr_base:
+		ca->addr_base = v->u;
+		break;
+	case DW_AT_rnglists_base:
+		ca->rnglists_base = v->u;
+		break;
+	}
+}
+
+/*
+ * Parse the unit header at off and its root DIE. Returns the offset of
+ * the next unit, or 0 once there are no more. cu->line_off is left at
+ * UINT64_MAX for units without a line table.
+ */
+static uint64_t dwarf_cu_parse(const struct dwarf *d, uint64_t off,
+			       struct dwarf_cu *cu)
+{
+	const struct dwarf_sect *s = &d->sect[SECT_INFO];
+	struct dwarf_cu_attrs ca = { };
+	const struct dwarf_abbrev *ab;
+	struct dwarf_abbrevs abbrevs;
+	struct dwarf_buf b;
+	unsigned int unit_type = DW_UT_compile;
+	uint64_t len, code;
+
+	memset(cu, 0, sizeof *cu);
+	cu->line_off = UINT64_MAX;
+	cu->has_info = true;
+
+	buf_init(&b, d, s, off, s->size);
+	len = buf_unit_length(&b, &cu->offsize);
+	if (b.err || len > b.end - b.p)
+		return 0;
+	cu->end = b.p - s->data + len;
+	b.end = b.p + len;
+
+	cu->version = buf_u16(&b);
+	if (cu->version < 2 || cu->version > 5)
+		return cu->end;
+
+	if (cu->version >= 5) {
+		unit_type = buf_u8(&b);
+		cu->addr_size = buf_u8(&b);
+		cu->abbrev_off = buf_uN(&b, cu->offsize);
+	} else {
+		cu->abbrev_off = buf_uN(&b, cu->offsize);
+		cu->addr_size = buf_u8(&b);
+	}
+	if (unit_type == DW_UT_skeleton)
+		buf_skip(&b, 8);
+	else if (unit_type != DW_UT_compile && unit_type != DW_UT_partial)
+		return cu->end;
+	if (b.err || cu->addr_size < 1 || cu->addr_size > 8)
+		return cu->end;
+	cu->die_off = b.p - s->data;
+
+	code = buf_uleb(&b);
+	if (!code)
+		return cu->end;
+	ab = NULL;
+	if (dwarf_abbrevs_parse(d, cu->abbrev_off, code, &abbrevs))
+		ab = dwarf_abbrev_find(&abbrevs, code);
+	if (ab && dwarf_die_attrs(d, cu, &b, ab, dwarf_cu_attr, &ca)
+	    && ca.has_stmt_list) {
+		cu->line_off = ca.stmt_list;
+		cu->addr_base = ca.addr_base;
+		cu->rnglists_base = ca.rnglists_base;
+		cu->str_offsets_base = ca.str_offsets_base;
+		/* Without a base, strx index the first offsets table.  */
+		if (!ca.has_str_offsets_base && cu->version >= 5)
+			cu->str_offsets_base = cu->offsize == 8 ? 16 : 8;
+		cu->comp_dir = dwarf_val_str(d, cu, &ca.comp_dir);
+		cu->base_addr = dwarf_val_addr(d, cu, &ca.low_pc);
+	}
+	free(abbrevs.tab);
+	return cu->end;
+}
+
+static int dwarf_cu_compare(const void *pa, const void *pb)
+{
+	const struct dwarf_cu *a = pa, *b = pb;
+
+	if (a->line_off < b->line_off)
+		return -1;
+	return a->line_off > b->line_off;
+}
+
+static void dwarf_add_unit(struct dwarf *d, const struct dwarf_cu *cu,
+			   unsigned int *nr_alloc)
+{
+	if (d->nr_units == *nr_alloc) {
+		*nr_alloc = *nr_alloc ? *nr_alloc * 2 : 64;
+		d->units = safe_realloc(d->units,
+					sizeof d->units[0] * *nr_alloc);
+	}
+	d->units[d->nr_units++] = *cu;
+}
+
+/*
+ * Find the line tables to decode. Normally through the compilation
+ * units in .debug_info, which also give us the compilation directory
+ * and the inlined subroutines. Without .debug_info we fall back to
+ * walking .debug_line itself.
+ */
+static void dwarf_find_units(struct dwarf *d)
+{
+	unsigned int nr_alloc = 0, i, n;
+	struct dwarf_cu cu;
+	uint64_t off = 0;
+
+	if (d->sect[SECT_INFO].data) {
+		while (off < d->sect[SECT_INFO].size) {
+			off = dwarf_cu_parse(d, off, &cu);
+			if (!off)
+				break;
+			if (cu.line_off < d->sect[SECT_LINE].size)
+				dwarf_add_unit(d, &cu, &nr_alloc);
+		}
+
+		/* Partial units may share the line table of another.  */
+		qsort(d->units, d->nr_units, sizeof d->units[0],
+		      dwarf_cu_compare);
+		for (i = 0, n = 0; i < d->nr_units; i++) {
+			if (n && d->units[n - 1].line_off == d->units[i].line_off) {
+				d->units[n - 1].shared = true;
+				continue;
+			}
+			d->units[n++] = d->units[i];
+		}
+		d->nr_units = n;
+		return;
+	}
+
+	while (off < d->sect[SECT_LINE].size) {
+		struct dwarf_buf b;
+		unsigned int offsize;
+		uint64_t len;
+
+		buf_init(&b, d, &d->sect[SECT_LINE], off,
+			 d->sect[SECT_LINE].size);
+		len = buf_unit_length(&b, &offsize);
+		if (b.err || len > b.end - b.p)
+			break;
+
+		memset(&cu, 0, sizeof cu);
+		cu.line_off = off;
+		dwarf_add_unit(d, &cu, &nr_alloc);
+		off = b.p - d->sect[SECT_LINE].data + len;
+	}
+}
+
+/* Address ranges, e.g covered by the inlined subroutines of a unit.  */
+struct dwarf_ranges {
+	struct dwarf_range {
+		uint64_t lo, hi;
+	} *r;
+	size_t nr, nr_alloc;
+};
+
+static void dwarf_ranges_add(struct dwarf_ranges *rs, uint64_t lo,
+			     uint64_t hi)
+{
+	if (lo >= hi)
+		return;
+
+	if (rs->nr == rs->nr_alloc) {
+		rs->nr_alloc = rs->nr_alloc ? rs->nr_alloc * 2 : 64;
+		rs->r = safe_realloc(rs->r, sizeof rs->r[0] * rs->nr_alloc);
+	}
+	rs->r[rs->nr].lo = lo;
+	rs->r[rs->nr].hi = hi;
+	rs->nr++;
+}
+
+static int dwarf_range_compare(const void *pa, const void *pb)
+{
+	const struct dwarf_range *a = pa, *b = pb;
+
+	if (a->lo < b->lo)
+		return -1;
+	return a->lo > b->lo;
+}
+
+/* Sort and merge overlapping ranges, nested inlines are common.  */
+static void dwarf_ranges_finish(struct dwarf_ranges *rs)
+{
+	size_t i, n = 0;
+
+	qsort(rs->r, rs->nr, sizeof rs->r[0], dwarf_range_compare);
+	for (i = 0; i < rs->nr; i++) {
+		if (n && rs->r[i].lo <= rs->r[n - 1].hi) {
+			if (rs->r[i].hi > rs->r[n - 1].hi)
+				rs->r[n - 1].hi = rs->r[i].hi;
+			continue;
+		}
+		rs->r[n++] = rs->r[i];
+	}
+	rs->nr = n;
+}
+
+static bool dwarf_ranges_find(const struct dwarf_ranges *rs, uint64_t addr)
+{
+	size_t lo = 0, hi = rs->nr;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (addr < rs->r[mid].lo)
+			hi = mid;
+		else if (addr >= rs->r[mid].hi)
+			lo = mid + 1;
+		else
+			return true;
+	}
+	return false;
+}
+
+/* DWARF 2 - 4 .debug_ranges list.  */
+static void dwarf_read_ranges(const struct dwarf *d, const struct dwarf_cu *cu,
+			      uint64_t off, struct dwarf_ranges *rs)
+{
+	uint64_t base = cu->base_addr;
+	uint64_t max = cu->addr_size == 8 ? ~0ULL
+					  : (1ULL << (cu->addr_size * 8)) - 1;
+	struct dwarf_buf b;
+
+	buf_init(&b, d, &d->sect[SECT_RANGES], off, d->sect[SECT_RANGES].size);
+	while (!b.err) {
+		uint64_t start = buf_uN(&b, cu->addr_size);
+		uint64_t end = buf_uN(&b, cu->addr_size);
+
+		if (b.err || (!start && !end))
+			break;
+		if (start == max)
+			base = end;
+		else
+			dwarf_ranges_add(rs, base + start, base + end);
+	}
+}
+
+/* DWARF 5 .debug_rnglists list.  */
+static void dwarf_read_rnglist(const struct dwarf *d, const struct dwarf_cu *cu,
+			       uint64_t off, struct dwarf_ranges *rs)
+{
+	uint64_t base = cu->base_addr;
+	struct dwarf_buf b;
+
+	buf_init(&b, d, &d->sect[SECT_RNGLISTS], off,
+		 d->sect[SECT_RNGLISTS].size);
+	while (!b.err) {
+		uint64_t start, end;
+
+		switch (buf_u8(&b)) {
+		case DW_RLE_end_of_list:
+			return;
+		case DW_RLE_base_addressx:
+			base = dwarf_addrx(d, cu, buf_uleb(&b));
+			break;
+		case DW_RLE_startx_endx:
+			start = dwarf_addrx(d, cu, buf_uleb(&b));
+			end = dwarf_addrx(d, cu, buf_uleb(&b));
+			dwarf_ranges_add(rs, start, end);
+			break;
+		case DW_RLE_startx_length:
+			start = dwarf_addrx(d, cu, buf_uleb(&b));
+			dwarf_ranges_add(rs, start, start + buf_uleb(&b));
+			break;
+		case DW_RLE_offset_pair:
+			start = base + buf_uleb(&b);
+			end = base + buf_uleb(&b);
+			dwarf_ranges_add(rs, start, end);
+			break;
+		case DW_RLE_base_address:
+			base = buf_uN(&b, cu->addr_size);
+			break;
+		case DW_RLE_start_end:
+			start = buf_uN(&b, cu->addr_size);
+			end = buf_uN(&b, cu->addr_size);
+			dwarf_ranges_add(rs, start, end);
+			break;
+		case DW_RLE_start_length:
+			start = buf_uN(&b, cu->addr_size);
+			dwarf_ranges_add(rs, start, start + buf_uleb(&b));
+			break;
+		default:
+			return;
+		}
+	}
+}
+
+/* The code of a DIE, from its low and high pc or DW_AT_ranges.  */
+struct dwarf_pc_die {
+	const struct dwarf *d;
+	const struct dwarf_cu *cu;
+	struct dwarf_ranges *rs;
+	struct dwarf_val low_pc, high_pc, ranges;
+	bool has_low_pc, has_high_pc, has_ranges;
+};
+
+static void dwarf_pc_attr(void *opaque, uint64_t name,
+			  const struct dwarf_val *v)
+{
+	struct dwarf_pc_die *id = opaque;
+
+	switch (name) {
+	case DW_AT_low_pc:
+		id->low_pc = *v;
+		id->has_low_pc = true;
+		break;
+	case DW_AT_high_pc:
+		id->high_pc = *v;
+		id->has_high_pc = true;
+		break;
+	case DW_AT_ranges:
+		id->ranges = *v;
+		id->has_ranges = true;
+		break;
+	}
+}
+
+static void dwarf_pc_die_ranges(struct dwarf_pc_die *id)
+{
+	const struct dwarf *d = id->d;
+	const struct dwarf_cu *cu = id->cu;
+	uint64_t lo, hi, off;
+
+	if (id->has_low_pc && id->has_high_pc) {
+		lo = dwarf_val_addr(d, cu, &id->low_pc);
+		/* DWARF 4 and up give the high pc as an offset.  */
+		if (id->high_pc.form == DW_FORM_addr
+		    || form_is_addrx(id->high_pc.form))
+			hi = dwarf_val_addr(d, cu, &id->high_pc);
+		else
+			hi = lo + id->high_pc.u;
+		dwarf_ranges_add(id->rs, lo, hi);
+	} else if (id->has_ranges) {
+		if (cu->version < 5) {
+			dwarf_read_ranges(d, cu, id->ranges.u, id->rs);
+			return;
+		}
+
+		off = id->ranges.u;
+		if (id->ranges.form == DW_FORM_rnglistx)
+			off = cu->rnglists_base
+				+ dwarf_sect_uN(d, SECT_RNGLISTS,
+					cu->rnglists_base + off * cu->offsize,
+					cu->offsize);
+		dwarf_read_rnglist(d, cu, off, id->rs);
+	}
+}
+
+/* Collect the address ranges of all inlined subroutines of cu.  */
+static void dwarf_cu_inlined(const struct dwarf *d, const struct dwarf_cu *cu,
+			     struct dwarf_ranges *rs)
+{
+	const struct dwarf_sect *s = &d->sect[SECT_INFO];
+	struct dwarf_abbrevs abbrevs;
+	unsigned int depth = 0;
+	struct dwarf_buf b;
+
+	if (!cu->has_info)
+		return;
+	if (!dwarf_abbrevs_parse(d, cu->abbrev_off, 0, &abbrevs))
+		goto done;
+
+	buf_init(&b, d, s, cu->die_off, cu->end);
+	while (!b.err && b.p < b.end) {
+		struct dwarf_pc_die id = { .d = d, .cu = cu, .rs = rs };
+		const struct dwarf_abbrev *ab;
+		bool inlined;
+		uint64_t code;
+
+		code = buf_uleb(&b);
+		if (!code) {
+			if (depth <= 1)
+				break;
+			depth--;
+			continue;
+		}
+
+		ab = dwarf_abbrev_find(&abbrevs, code);
+		if (!ab)
+			break;
+		inlined = ab->tag == DW_TAG_inlined_subroutine;
+		if (!dwarf_die_attrs(d, cu, &b, ab,
+				     inlined ? dwarf_pc_attr : NULL, &id))
+			break;
+		if (inlined)
+			dwarf_pc_die_ranges(&id);
+		if (ab->children)
+			depth++;
+		else if (!depth)
+			break;
+	}
+	dwarf_ranges_finish(rs);
+done:
+	free(abbrevs.tab);
+}
+
+/*
+ * Whether want takes any of the code ranges of cu. Units we know
+ * nothing about, i.e without .debug_info or ranges on the root DIE or
+ * sharing their line table with others, are always taken.
+ */
+static bool dwarf_cu_wanted(const struct dwarf *d, const struct dwarf_cu *cu,
+			    dwarf_want_fn want, void *opaque)
+{
+	const struct dwarf_sect *s = &d->sect[SECT_INFO];
+	struct dwarf_ranges rs = { };
+	struct dwarf_pc_die id = { .d = d, .cu = cu, .rs = &rs };
+	const struct dwarf_abbrev *ab = NULL;
+	struct dwarf_abbrevs abbrevs;
+	bool wanted = true;
+	struct dwarf_buf b;
+	uint64_t code;
+	size_t i;
+
+	if (!cu->has_info || cu->shared)
+		return true;
+
+	buf_init(&b, d, s, cu->die_off, cu->end);
+	code = buf_uleb(&b);
+	if (dwarf_abbrevs_parse(d, cu->abbrev_off, code, &abbrevs))
+		ab = dwarf_abbrev_find(&abbrevs, code);
+	if (ab && dwarf_die_attrs(d, cu, &b, ab, dwarf_pc_attr, &id)) {
+		dwarf_pc_die_ranges(&id);
+		for (i = 0; i < rs.nr; i++) {
+			wanted = want(opaque, rs.r[i].lo, rs.r[i].hi);
+			if (wanted)
+				break;
+		}
+	}
+	free(abbrevs.tab);
+	free(rs.r);
+	return wanted;
+}
+
+struct dwarf_file {
+	const char *name;
+	uint64_t dir;
+	/* Full sanitized path, made on first use.  */
+	const char *path;
+};
+
+struct dwarf_lines {
+	const struct dwarf_cu *cu;
+	unsigned int unit;
+	unsigned int version;
+	unsigned int offsize;
+	unsigned int addr_size;
+	unsigned int min_insn_len;
+	unsigned int max_ops;
+	bool default_is_stmt;
+	int line_base;
+	unsigned int line_range;
+	unsigned int opcode_base;
+	const uint8_t *opcode_lens;
+
+	const char **dirs;
+	size_t nr_dirs;
+	struct dwarf_file *files;
+	size_t nr_files, nr_files_alloc;
+};
+
+static void dwarf_lines_add_file(struct dwarf_lines *lh, const char *name,
+				 uint64_t dir)
+{
+	struct dwarf_file *f;
+
+	if (lh->nr_files == lh->nr_files_alloc) {
+		lh->nr_files_alloc = lh->nr_files_alloc
+					? lh->nr_files_alloc * 2 : 32;
+		lh->files = safe_realloc(lh->files,
+				sizeof lh->files[0] * lh->nr_files_alloc);
+	}
+	f = &lh->files[lh->nr_files++];
+	f->name = name;
+	f->dir = dir;
+	f->path = NULL;
+}
+
+static const char *dwarf_lines_path(struct dwarf_lines *lh, uint64_t file)
+{
+	const char *comp_dir = lh->cu->comp_dir;
+	const char *dir = NULL;
+	struct dwarf_file *f;
+	char *path, *tmp;
+
+	if (file >= lh->nr_files || !lh->files[file].name)
+		return NULL;
+	f = &lh->files[file];
+	if (f->path)
+		return f->path;
+
+	if (f->name[0] != '/') {
+		if (f->dir < lh->nr_dirs)
+			dir = lh->dirs[f->dir];
+		else if (f->dir == 0)
+			dir = comp_dir;
+	}
+
+	if (!dir || !dir[0])
+		path = filename_sanitize(f->name);
+	else {
+		/* Relative dirs are relative to the compilation dir.  */
+		if (dir[0] == '/' || !comp_dir || dir == comp_dir)
+			comp_dir = "";
+		tmp = safe_malloc(strlen(comp_dir) + strlen(dir)
+				  + strlen(f->name) + 3);
+		sprintf(tmp, "%s%s%s/%s", comp_dir, comp_dir[0] ? "/" : "",
+			dir, f->name);
+		path = filename_sanitize(tmp);
+		free(tmp);
+	}
+	f->path = str_intern(path);
+	free(path);
+	return f->path;
+}
+
+/* DWARF 5 directory and file name tables.  */
+static bool dwarf_lines_v5_entries(const struct dwarf *d,
+				   struct dwarf_lines *lh, struct dwarf_buf *b,
+				   bool files)
+{
+	uint64_t fmt[32][2];
+	unsigned int nr_fmt, i;
+	uint64_t nr, n;
+
+	nr_fmt = buf_u8(b);
+	if (nr_fmt > sizeof fmt / sizeof fmt[0])
+		return false;
+	for (i = 0; i < nr_fmt; i++) {
+		fmt[i][0] = buf_uleb(b);
+		fmt[i][1] = buf_uleb(b);
+	}
+
+	nr = buf_uleb(b);
+	if (b->err || nr > b->end - b->p)
+		return false;
+	if (!files)
+		lh->dirs = safe_mallocz(sizeof lh->dirs[0] * (nr ? nr : 1));
+
+	for (n = 0; n < nr && !b->err; n++) {
+		const char *name = NULL;
+		uint64_t dir = 0;
+
+		for (i = 0; i < nr_fmt; i++) {
+			struct dwarf_val v;
+
+			if (!dwarf_read_form(d, lh->cu, b, fmt[i][1], 0, &v))
+				return false;
+			if (fmt[i][0] == DW_LNCT_path)
+				name = dwarf_val_str(d, lh->cu, &v);
+			else if (fmt[i][0] == DW_LNCT_directory_index)
+				dir = v.u;
+		}
+		if (files)
+			dwarf_lines_add_file(lh, name, dir);
+		else
+			lh->dirs[lh->nr_dirs++] = name;
+	}
+	return !b->err;
+}
+
+/* DWARF 2 - 4 include_directories and file_names.  */
+static bool dwarf_lines_v4_entries(struct dwarf_lines *lh,
+				   struct dwarf_buf *b)
+{
+	size_t nr_alloc = 16;
+	const char *s;
+
+	/* Directory 0 is the compilation directory, file 0 is unused.  */
+	lh->dirs = safe_malloc(sizeof lh->dirs[0] * nr_alloc);
+	lh->dirs[lh->nr_dirs++] = lh->cu->comp_dir;
+	while ((s = buf_str(b)) && *s) {
+		if (lh->nr_dirs == nr_alloc) {
+			nr_alloc *= 2;
+			lh->dirs = safe_realloc(lh->dirs,
+					sizeof lh->dirs[0] * nr_alloc);
+		}
+		lh->dirs[lh->nr_dirs++] = s;
+	}
+
+	dwarf_lines_add_file(lh, NULL, 0);
+	while ((s = buf_str(b)) && *s) {
+		uint64_t dir = buf_uleb(b);
+
+		buf_uleb(b);	/* mtime */
+		buf_uleb(b);	/* length */
+		dwarf_lines_add_file(lh, s, dir);
+	}
+	return !b->err;
+}
+
+struct dwarf_lines_state {
+	uint64_t addr;
+	unsigned int op_index;
+	uint64_t file;
+	int64_t line;
+	bool is_stmt;
+};
+
+static void dwarf_lines_reset(const struct dwarf_lines *lh,
+			      struct dwarf_lines_state *st)
+{
+	st->addr = 0;
+	st->op_index = 0;
+	st->file = 1;
+	st->line = 1;
+	st->is_stmt = lh->default_is_stmt;
+}
+
+static void dwarf_lines_advance(const struct dwarf_lines *lh,
+				struct dwarf_lines_state *st, uint64_t adv)
+{
+	if (lh->max_ops == 1) {
+		st->addr += lh->min_insn_len * adv;
+		return;
+	}
+	st->addr += lh->min_insn_len * ((st->op_index + adv) / lh->max_ops);
+	st->op_index = (st->op_index + adv) % lh->max_ops;
+}
+
+struct dwarf_worker {
+	struct dwarf *d;
+	unsigned int nr;
+	dwarf_line_fn fn;
+	void *opaque;
+	pthread_t tid;
+};
+
+static void dwarf_lines_emit(struct dwarf_worker *w, struct dwarf_lines *lh,
+			     const struct dwarf_ranges *inlined,
+			     const struct dwarf_lines_state *st)
+{
+	struct dwarf_line l;
+
+	/* Line 0 means the code has no source line.  */
+	if (st->line <= 0)
+		return;
+
+	l.filename = dwarf_lines_path(lh, st->file);
+	if (!l.filename)
+		return;
+	l.addr = st->addr;
+	l.linenr = st->line;
+	l.is_stmt = st->is_stmt;
+	l.inlined = dwarf_ranges_find(inlined, st->addr);
+	l.unit = lh->unit;
+	w->fn(w->opaque, w->nr, &l);
+}
+
+/* Run the line program of cu and pass each row to the worker's fn.  */
+static void dwarf_cu_lines(struct dwarf_worker *w, const struct dwarf_cu *cu)
+{
+	const struct dwarf *d = w->d;
+	struct dwarf_ranges inlined = { };
+	struct dwarf_lines lh = { .cu = cu, .unit = cu - d->units };
+	struct dwarf_lines_state st;
+	const uint8_t *prog;
+	struct dwarf_cu hcu;
+	struct dwarf_buf b;
+	uint64_t len;
+	bool ok;
+
+	buf_init(&b, d, &d->sect[SECT_LINE], cu->line_off,
+		 d->sect[SECT_LINE].size);
+	len = buf_unit_length(&b, &lh.offsize);
+	if (b.err || len > b.end - b.p)
+		return;
+	b.end = b.p + len;
+
+	lh.version = buf_u16(&b);
+	if (lh.version < 2 || lh.version > 5)
+		return;
+	lh.addr_size = cu->addr_size;
+	if (lh.version >= 5) {
+		lh.addr_size = buf_u8(&b);
+		buf_u8(&b);	/* segment_selector_size */
+	}
+	len = buf_uN(&b, lh.offsize);
+	if (b.err || len > b.end - b.p)
+		return;
+	prog = b.p + len;
+
+	lh.min_insn_len = buf_u8(&b);
+	lh.max_ops = lh.version >= 4 ? buf_u8(&b) : 1;
+	lh.default_is_stmt = buf_u8(&b);
+	lh.line_base = (int8_t) buf_u8(&b);
+	lh.line_range = buf_u8(&b);
+	lh.opcode_base = buf_u8(&b);
+	lh.opcode_lens = b.p;
+	buf_skip(&b, lh.opcode_base ? lh.opcode_base - 1 : 0);
+	if (b.err || !lh.line_range || !lh.max_ops || !lh.opcode_base)
+		return;
+
+	/* Forms in the v5 entry tables are read with the unit's sizes.  */
+	hcu = *cu;
+	hcu.offsize = lh.offsize;
+	hcu.version = lh.version;
+	if (!hcu.addr_size)
+		hcu.addr_size = lh.addr_size;
+	lh.cu = &hcu;
+	if (lh.version >= 5)
+		ok = dwarf_lines_v5_entries(d, &lh, &b, false)
+			&& dwarf_lines_v5_entries(d, &lh, &b, true);
+	else
+		ok = dwarf_lines_v4_entries(&lh, &b);
+	if (!ok)
+		goto done;
+
+	dwarf_cu_inlined(d, cu, &inlined);
+
+	b.p = prog;
+	dwarf_lines_reset(&lh, &st);
+	while (!b.err && b.p < b.end) {
+		uint8_t op = buf_u8(&b);
+		uint64_t elen;
+		const uint8_t *next;
+		unsigned int i;
+
+		if (op >= lh.opcode_base) {
+			op -= lh.opcode_base;
+			dwarf_lines_advance(&lh, &st, op / lh.line_range);
+			st.line += lh.line_base + op % lh.line_range;
+			dwarf_lines_emit(w, &lh, &inlined, &st);
+			continue;
+		}
+
+		switch (op) {
+		case 0:
+			elen = buf_uleb(&b);
+			if (!elen || elen > b.end - b.p) {
+				b.err = true;
+				break;
+			}
+			next = b.p + elen;
+			switch (buf_u8(&b)) {
+			case DW_LNE_end_sequence:
+				dwarf_lines_reset(&lh, &st);
+				break;
+			case DW_LNE_set_address:
+				st.addr = buf_uN(&b, elen - 1);
+				st.op_index = 0;
+				break;
+			case DW_LNE_define_file: {
+				const char *name = buf_str(&b);
+				uint64_t dir = buf_uleb(&b);
+
+				dwarf_lines_add_file(&lh, name, dir);
+				break;
+			}
+			}
+			b.p = next;
+			break;
+		case DW_LNS_copy:
+			dwarf_lines_emit(w, &lh, &inlined, &st);
+			break;
+		case DW_LNS_advance_pc:
+			dwarf_lines_advance(&lh, &st, buf_uleb(&b));
+			break;
+		case DW_LNS_advance_line:
+			st.line += buf_sleb(&b);
+			break;
+		case DW_LNS_set_file:
+			st.file = buf_uleb(&b);
+			break;
+		case DW_LNS_negate_stmt:
+			st.is_stmt = !st.is_stmt;
+			break;
+		case DW_LNS_set_basic_block:
+			break;
+		case DW_LNS_const_add_pc:
+			dwarf_lines_advance(&lh, &st,
+				(255 - lh.opcode_base) / lh.line_range);
+			break;
+		case DW_LNS_fixed_advance_pc:
+			st.addr += buf_u16(&b);
+			st.op_index = 0;
+			break;
+		default:
+			/* Includes set_column, prologue_end and friends.  */
+			for (i = 0; i < lh.opcode_lens[op - 1]; i++)
+				buf_uleb(&b);
+			break;
+		}
+	}
+done:
+	free(inlined.r);
+	free(lh.dirs);
+	free(lh.files);
+}
+
+static void *dwarf_worker_thread(void *arg)
+{
+	struct dwarf_worker *w = arg;
+	struct dwarf *d = w->d;
+	unsigned int i;
+
+	while ((i = __atomic_fetch_add(&d->next_unit, 1, __ATOMIC_RELAXED))
+	       < d->nr_todo)
+		dwarf_cu_lines(w, &d->units[d->todo[i]]);
+	return NULL;
+}
+
+/*
+ * Decode the line tables, handing out compilation units to nr_workers
+ * threads as they become idle. The calling thread is worker 0.
+ *
+ * With want, only the units with code in a range want takes are
+ * decoded. Units marked in done, indexed like the units of d, are
+ * skipped and those decoded get marked. Either may be NULL.
+ */
+void dwarf_foreach_line(struct dwarf *d, unsigned int nr_workers,
+			dwarf_want_fn want, bool *done,
+			dwarf_line_fn fn, void *opaque)
+{
+	struct dwarf_worker *w;
+	unsigned int i;
+	int err;
+
+	d->nr_todo = 0;
+	for (i = 0; i < d->nr_units; i++) {
+		if (done && done[i])
+			continue;
+		if (want && !dwarf_cu_wanted(d, &d->units[i], want, opaque))
+			continue;
+		if (done)
+			done[i] = true;
+		d->todo[d->nr_todo++] = i;
+	}
+
+	if (nr_workers > d->nr_todo)
+		nr_workers = d->nr_todo;
+	if (!nr_workers)
+		return;
+
+	d->next_unit = 0;
+	w = safe_mallocz(sizeof *w * nr_workers);
+	for (i = 0; i < nr_workers; i++) {
+		w[i].d = d;
+		w[i].nr = i;
+		w[i].fn = fn;
+		w[i].opaque = opaque;
+		if (!i)
+			continue;
+
+		err = pthread_create(&w[i].tid, NULL, dwarf_worker_thread,
+				     &w[i]);
+		if (err) {
+			fprintf(stderr, "pthread_create: %s\n", strerror(err));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	dwarf_worker_thread(&w[0]);
+	for (i = 1; i < nr_workers; i++)
+		pthread_join(w[i].tid, NULL);
+	free(w);
+}
+
+unsigned int dwarf_nr_units(const struct dwarf *d)
+{
+	return d->nr_units;
+}
+
+/*
+ * Load the debug sections of elf. Returns NULL if it has no line
+ * tables.
+ */
+struct dwarf *dwarf_open(const char *elf)
+{
+	struct dwarf *d;
+	unsigned int i;
+	bfd *abfd;
+
+	abfd = bfd_openr(elf, NULL);
+	if (!abfd) {
+		fprintf(stderr, "%s: %s\n", elf, bfd_errmsg(bfd_get_error()));
+		return NULL;
+	}
+	/* Have bfd inflate compressed debug sections for us.  */
+	abfd->flags |= BFD_DECOMPRESS;
+	if (!bfd_check_format(abfd, bfd_object)) {
+		fprintf(stderr, "%s: %s\n", elf, bfd_errmsg(bfd_get_error()));
+		bfd_close(abfd);
+		return NULL;
+	}
+
+	d = safe_mallocz(sizeof *d);
+	d->big_endian = bfd_big_endian(abfd);
+	for (i = 0; i < NR_SECTS; i++) {
+		asection *sec = bfd_get_section_by_name(abfd,
+							dwarf_sect_names[i]);
+		bfd_byte *data;
+
+		if (!sec || !sec->size)
+			continue;
+		if (!bfd_malloc_and_get_section(abfd, sec, &data)) {
+			fprintf(stderr, "%s: %s: %s\n", elf,
+				dwarf_sect_names[i],
+				bfd_errmsg(bfd_get_error()));
+			continue;
+		}
+		d->sect[i].data = data;
+		d->sect[i].size = sec->size;
+	}
+	bfd_close(abfd);
+
+	if (!d->sect[SECT_LINE].data) {
+		dwarf_close(d);
+		return NULL;
+	}
+	dwarf_find_units(d);
+	d->todo = safe_malloc(sizeof d->todo[0] * (d->nr_units + 1));
+	return d;
+}
+
+void dwarf_close(struct dwarf *d)
+{
+	unsigned int i;
+
+	for (i = 0; i < NR_SECTS; i++)
+		free(d->sect[i].data);
+	free(d->units);
+	free(d->todo);
+	free(d);
+}
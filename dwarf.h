@@ -0,0 +1,63 @@
+/*
+ * DWARF line table decoder.
+ *
+ * Copyright: 2026 Xilinx Inc
+ * Written by Edgar E. Iglesias <edgar.iglesias@xilinx.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+#ifndef _DWARF_H
+#define _DWARF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * A row of a .debug_line program. filename is sanitized and interned
+ * with str_intern, so all rows of the same file share the pointer.
+ */
+struct dwarf_line {
+	uint64_t addr;
+	const char *filename;
+	unsigned int linenr;
+	bool is_stmt;
+	/* The row lies within a DW_TAG_inlined_subroutine.  */
+	bool inlined;
+	/* Index of the unit of the row, by line table offset.  */
+	unsigned int unit;
+};
+
+/*
+ * Called for every row, from nr_workers threads at once. worker
+ * identifies the calling thread, 0 .. nr_workers - 1.
+ */
+typedef void (*dwarf_line_fn)(void *opaque, unsigned int worker,
+			      const struct dwarf_line *l);
+
+/*
+ * Picks the compilation units to decode by their code. Called with
+ * each range [lo, hi) of a unit until it returns true.
+ */
+typedef bool (*dwarf_want_fn)(void *opaque, uint64_t lo, uint64_t hi);
+
+struct dwarf;
+
+struct dwarf *dwarf_open(const char *elf);
+unsigned int dwarf_nr_units(const struct dwarf *d);
+void dwarf_foreach_line(struct dwarf *d, unsigned int nr_workers,
+			dwarf_want_fn want, bool *done,
+			dwarf_line_fn fn, void *opaque);
+void dwarf_close(struct dwarf *d);
+#endif
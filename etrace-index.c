@@ -0,0 +1,322 @@
+/*
+ * ETrace pkg index.
+ *
+ * Copyright: 2026 Xilinx Inc
+ * Written by Edgar E. Iglesias <edgar.iglesias@xilinx.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "util.h"
+#include "safeio.h"
+#include "coverage.h"
+#include "trace.h"
+#include "etrace.h"
+#include "etrace-index.h"
+
+bool etrace_pkg_time(const struct etrace_pkg *pkg, uint64_t *time)
+{
+	switch (pkg->hdr.type) {
+	case TYPE_EXEC:
+		*time = pkg->ex.start_time;
+		return true;
+	case TYPE_NOTE:
+		*time = pkg->note.time;
+		return true;
+	case TYPE_MEM:
+		*time = pkg->mem.time;
+		return true;
+	case TYPE_OLD_EVENT_U64:
+		/* The old layout starts with the time.  */
+		*time = pkg->u64[0];
+		return true;
+	case TYPE_EVENT_U64:
+		*time = pkg->event_u64.time;
+		return true;
+	default:
+		return false;
+	}
+}
+
+static uint64_t stat_mtime(const struct stat *st)
+{
+	return st->st_mtim.tv_sec * 1000000000ULL + st->st_mtim.tv_nsec;
+}
+
+/*
+ * Returns the name of the index for trace_filename or NULL if fd isn't
+ * a plain open of that file, e.g stdin or a socket.
+ */
+char *etrace_index_filename(const char *trace_filename, int fd)
+{
+	struct stat st, fst;
+	char *name;
+
+	if (!trace_filename)
+		return NULL;
+	if (stat(trace_filename, &st) < 0 || fstat(fd, &fst) < 0)
+		return NULL;
+	if (!S_ISREG(fst.st_mode)
+	    || st.st_dev != fst.st_dev || st.st_ino != fst.st_ino)
+		return NULL;
+
+	name = safe_malloc(strlen(trace_filename)
+			   + sizeof ETRACE_INDEX_SUFFIX);
+	strcpy(name, trace_filename);
+	strcat(name, ETRACE_INDEX_SUFFIX);
+	return name;
+}
+
+/* Load the index for the trace open on trace_fd, if it's up to date.  */
+bool etrace_index_load(struct etrace_index *idx, const char *filename,
+		       int trace_fd)
+{
+	struct etrace_index_hdr *hdr;
+	struct stat st, tst;
+	size_t len;
+	void *p;
+	int fd;
+
+	memset(idx, 0, sizeof *idx);
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	if (fstat(fd, &st) < 0 || fstat(trace_fd, &tst) < 0
+	    || st.st_size < sizeof *hdr)
+		goto fail;
+
+	len = st.st_size;
+	p = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED)
+		goto fail;
+	close(fd);
+
+	hdr = p;
+	if (hdr->magic != ETRACE_INDEX_MAGIC
+	    || hdr->version != ETRACE_INDEX_VERSION
+	    || hdr->ent_size != sizeof idx->ents[0]
+	    || hdr->nr_ents > (len - sizeof *hdr) / sizeof idx->ents[0]) {
+		fprintf(stderr, "%s: invalid index, ignoring it\n", filename);
+		munmap(p, len);
+		return false;
+	}
+
+	/* A stale index is worse than none.  */
+	if (hdr->trace_size != tst.st_size
+	    || hdr->trace_mtime != stat_mtime(&tst)) {
+		munmap(p, len);
+		return false;
+	}
+
+	idx->hdr = *hdr;
+	idx->ents = (void *) (hdr + 1);
+	idx->map = p;
+	idx->map_len = len;
+	return true;
+
+fail:
+	close(fd);
+	return false;
+}
+
+/*
+ * Write the index for the trace open on trace_fd. It goes through a
+ * temporary file so that concurrent readers never see a partial index.
+ */
+bool etrace_index_save(struct etrace_index *idx, const char *filename,
+		       int trace_fd)
+{
+	struct stat tst;
+	char *tmpname;
+	size_t len;
+	ssize_t r;
+	int fd;
+
+	if (fstat(trace_fd, &tst) < 0)
+		return false;
+
+	idx->hdr.magic = ETRACE_INDEX_MAGIC;
+	idx->hdr.version = ETRACE_INDEX_VERSION;
+	idx->hdr.stride = ETRACE_INDEX_STRIDE;
+	idx->hdr.ent_size = sizeof idx->ents[0];
+	idx->hdr.trace_size = tst.st_size;
+	idx->hdr.trace_mtime = stat_mtime(&tst);
+
+	if (asprintf(&tmpname, "%s.%d", filename, getpid()) < 0)
+		return false;
+
+	/* Traces in read-only places simply don't get an index.  */
+	fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		free(tmpname);
+		return false;
+	}
+
+	r = safe_write(fd, &idx->hdr, sizeof idx->hdr);
+	if (r != sizeof idx->hdr)
+		goto fail_close;
+
+	len = sizeof idx->ents[0] * idx->hdr.nr_ents;
+	r = safe_write(fd, idx->ents, len);
+	if (r != len)
+		goto fail_close;
+
+	close(fd);
+	if (rename(tmpname, filename) < 0)
+		goto fail_unlink;
+	free(tmpname);
+	return true;
+
+fail_close:
+	close(fd);
+fail_unlink:
+	unlink(tmpname);
+	perror(filename);
+	free(tmpname);
+	return false;
+}
+
+void etrace_index_free(struct etrace_index *idx)
+{
+	if (idx->map)
+		munmap(idx->map, idx->map_len);
+	else
+		free(idx->ents);
+	memset(idx, 0, sizeof *idx);
+}
+
+void etrace_index_begin(struct etrace_index *idx)
+{
+	memset(idx, 0, sizeof *idx);
+	idx->arch_pos = ETRACE_INDEX_NONE;
+	idx->info_pos = ETRACE_INDEX_NONE;
+}
+
+void etrace_index_add(struct etrace_index *idx, uint64_t pos,
+		      const struct etrace_pkg *pkg)
+{
+	uint64_t time;
+
+	if (idx->countdown == 0) {
+		struct etrace_index_ent *e;
+
+		if (idx->hdr.nr_ents == idx->nr_alloc) {
+			idx->nr_alloc = idx->nr_alloc ? idx->nr_alloc * 2 : 1024;
+			idx->ents = safe_realloc(idx->ents,
+					sizeof idx->ents[0] * idx->nr_alloc);
+		}
+
+		e = &idx->ents[idx->hdr.nr_ents++];
+		e->pos = pos;
+		e->pkg_nr = idx->hdr.nr_pkgs;
+		e->start_time = idx->time;
+		e->arch_pos = idx->arch_pos;
+		e->info_pos = idx->info_pos;
+		e->unit_id = pkg->hdr.unit_id;
+		e->type = pkg->hdr.type;
+		e->reserved = 0;
+		idx->countdown = ETRACE_INDEX_STRIDE;
+	}
+	idx->countdown--;
+	idx->hdr.nr_pkgs++;
+
+	switch (pkg->hdr.type) {
+	case TYPE_ARCH:
+		idx->arch_pos = pos;
+		break;
+	case TYPE_INFO:
+		idx->info_pos = pos;
+		break;
+	default:
+		if (etrace_pkg_time(pkg, &time) && time > idx->time)
+			idx->time = time;
+		break;
+	}
+}
+
+/*
+ * Binary search for the last entry for which below() holds. below()
+ * must be monotonic over the entries. Falls back to the first entry.
+ */
+static const struct etrace_index_ent *
+etrace_index_find(const struct etrace_index *idx, uint64_t key,
+		  bool (*below)(const struct etrace_index_ent *, uint64_t))
+{
+	uint64_t lo = 0, hi = idx->hdr.nr_ents;
+
+	if (!idx->ents || !idx->hdr.nr_ents)
+		return NULL;
+
+	while (hi - lo > 1) {
+		uint64_t mid = lo + (hi - lo) / 2;
+
+		if (below(&idx->ents[mid], key))
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return &idx->ents[lo];
+}
+
+static bool ent_pkg_below(const struct etrace_index_ent *e, uint64_t nr)
+{
+	return e->pkg_nr <= nr;
+}
+
+static bool ent_time_below(const struct etrace_index_ent *e, uint64_t time)
+{
+	return e->start_time < time;
+}
+
+static bool ent_pos_below(const struct etrace_index_ent *e, uint64_t pos)
+{
+	return e->pos <= pos;
+}
+
+/* Entry for the closest pkg at or before pkg_nr.  */
+const struct etrace_index_ent *
+etrace_index_find_pkg(const struct etrace_index *idx, uint64_t pkg_nr)
+{
+	return etrace_index_find(idx, pkg_nr, ent_pkg_below);
+}
+
+/* Entry for the closest pkg with no earlier pkg at or after time.  */
+const struct etrace_index_ent *
+etrace_index_find_time(const struct etrace_index *idx, uint64_t time)
+{
+	return etrace_index_find(idx, time, ent_time_below);
+}
+
+/* Entry for the closest pkg at or before file offset pos.  */
+const struct etrace_index_ent *
+etrace_index_find_pos(const struct etrace_index *idx, uint64_t pos)
+{
+	return etrace_index_find(idx, pos, ent_pos_below);
+}
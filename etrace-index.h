@@ -0,0 +1,105 @@
+/*
+ * ETrace pkg index.
+ *
+ * Copyright: 2026 Xilinx Inc
+ * Written by Edgar E. Iglesias <edgar.iglesias@xilinx.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+#ifndef _ETRACE_INDEX_H
+#define _ETRACE_INDEX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * A trace-file foo.etr gets its index in foo.etr.eidx. The index holds
+ * an entry for every ETRACE_INDEX_STRIDE pkg, sorted by file offset.
+ * Pkg numbers and times are monotonic across entries, so both can be
+ * binary searched. The layout is shared with etrace.py.
+ */
+#define ETRACE_INDEX_MAGIC	0x58444945	/* "EIDX" */
+#define ETRACE_INDEX_VERSION	1
+#define ETRACE_INDEX_STRIDE	1024
+#define ETRACE_INDEX_SUFFIX	".eidx"
+
+/* No ARCH or INFO pkg preceeds the entry.  */
+#define ETRACE_INDEX_NONE	UINT64_MAX
+
+struct etrace_index_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t stride;
+	uint32_t ent_size;
+	/* Size and mtime (ns) of the trace-file when indexed.  */
+	uint64_t trace_size;
+	uint64_t trace_mtime;
+	uint64_t nr_pkgs;
+	uint64_t nr_ents;
+} __attribute__ ((packed));
+
+struct etrace_index_ent {
+	/* File offset and number of the pkg.  */
+	uint64_t pos;
+	uint64_t pkg_nr;
+	/* Highest time stamp of any pkg before this one.  */
+	uint64_t start_time;
+	/* File offsets of the ARCH and INFO pkgs in effect.  */
+	uint64_t arch_pos;
+	uint64_t info_pos;
+	uint16_t unit_id;
+	uint16_t type;
+	uint32_t reserved;
+} __attribute__ ((packed));
+
+struct etrace_index {
+	struct etrace_index_hdr hdr;
+	struct etrace_index_ent *ents;
+	size_t nr_alloc;
+	/* ents points into a mapping of the index file.  */
+	void *map;
+	size_t map_len;
+
+	/* Builder state.  */
+	uint64_t time;
+	uint64_t arch_pos;
+	uint64_t info_pos;
+	unsigned int countdown;
+};
+
+struct etrace_pkg;
+
+bool etrace_pkg_time(const struct etrace_pkg *pkg, uint64_t *time);
+
+char *etrace_index_filename(const char *trace_filename, int fd);
+bool etrace_index_load(struct etrace_index *idx, const char *filename,
+		       int trace_fd);
+bool etrace_index_save(struct etrace_index *idx, const char *filename,
+		       int trace_fd);
+void etrace_index_free(struct etrace_index *idx);
+
+void etrace_index_begin(struct etrace_index *idx);
+/* Account for the pkg at pos. Called for every pkg, in file order.  */
+void etrace_index_add(struct etrace_index *idx, uint64_t pos,
+		      const struct etrace_pkg *pkg);
+
+const struct etrace_index_ent *
+etrace_index_find_pkg(const struct etrace_index *idx, uint64_t pkg_nr);
+const struct etrace_index_ent *
+etrace_index_find_time(const struct etrace_index *idx, uint64_t time);
+const struct etrace_index_ent *
+etrace_index_find_pos(const struct etrace_index *idx, uint64_t pos);
+#endif
@@ -0,0 +1,336 @@
+/*
+ * Stand-alone producer for shm: traces, and a socket vs shm benchmark.
+ *
+ * Copyright: 2026 Xilinx Inc
+ * Written by Edgar E. Iglesias <edgar.iglesias@xilinx.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+
+#include "util.h"
+#include "safeio.h"
+#include "ring.h"
+
+#define SHM_PREFIX "shm:"
+
+/* Chunk size for the throughput runs and message size for latency.  */
+#define BENCH_CHUNK (64 * 1024)
+#define BENCH_MSG 64
+#define BENCH_NR_MSGS 20000
+/* Pause between latency messages so the consumer goes to sleep.  */
+#define BENCH_MSG_GAP_NS (20 * 1000)
+#define BENCH_RING_SIZE (32 * 1024 * 1024)
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: etrace-shm-producer shm:name [trace-file]\n"
+		"       etrace-shm-producer --bench [MB]\n"
+		"\n"
+		"Feeds trace-file (default stdin) to qemu-etrace --trace shm:name.\n"
+		"--bench compares unix socket and shm ring throughput and\n"
+		"consumer latency.\n");
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static char *shm_name(const char *descr)
+{
+	const char *name = descr + strlen(SHM_PREFIX);
+	char *path;
+
+	path = safe_malloc(strlen(name) + 2);
+	sprintf(path, "%s%s", name[0] == '/' ? "" : "/", name);
+	return path;
+}
+
+/* Attach to a ring created by the consumer, waiting for it a while.  */
+static bool shm_attach(struct ring *r, const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < 100; i++) {
+		int fd = shm_open(name, O_RDWR | O_CLOEXEC, 0);
+
+		if (fd >= 0) {
+			bool ok = ring_attach(r, fd, true);
+
+			close(fd);
+			if (ok) {
+				/* One producer per ring.  */
+				shm_unlink(name);
+				return true;
+			}
+		}
+		usleep(50 * 1000);
+	}
+	return false;
+}
+
+static int feed(const char *descr, const char *filename)
+{
+	struct ring r;
+	char *name;
+	int in = STDIN_FILENO;
+
+	if (filename) {
+		in = open(filename, O_RDONLY);
+		if (in < 0) {
+			perror(filename);
+			return EXIT_FAILURE;
+		}
+	}
+
+	name = shm_name(descr);
+	if (!shm_attach(&r, name)) {
+		fprintf(stderr, "%s: no ring, is qemu-etrace running?\n",
+			name);
+		return EXIT_FAILURE;
+	}
+	free(name);
+
+	while (1) {
+		size_t len;
+		ssize_t n;
+		void *p;
+
+		p = ring_reserve(&r, &len);
+		if (!p) {
+			fprintf(stderr, "consumer went away\n");
+			break;
+		}
+		n = safe_read(in, p, len);
+		if (n <= 0)
+			break;
+		ring_commit(&r, n);
+	}
+	ring_close(&r);
+	ring_destroy(&r);
+	return EXIT_SUCCESS;
+}
+
+/*
+ * The consumer side of a benchmark run. Sums up the data so both
+ * transports do the same work per byte, and returns the number of
+ * bytes seen. With lat set, every BENCH_MSG message carries its send
+ * time and the delivery latency is stored in lat.
+ */
+static uint64_t bench_consume(int sk, struct ring *r, uint64_t *lat)
+{
+	static uint64_t buf[BENCH_CHUNK / 8];
+	size_t len = lat ? BENCH_MSG : BENCH_CHUNK;
+	uint64_t total = 0, sum = 0;
+	unsigned int nr = 0;
+
+	while (1) {
+		const uint64_t *p;
+		unsigned int i;
+
+		if (r) {
+			p = ring_peek(r, len);
+			if (!p)
+				break;
+		} else {
+			if (safe_read(sk, buf, len) != len)
+				break;
+			p = buf;
+		}
+		if (lat)
+			lat[nr++] = now_ns() - p[0];
+		for (i = 0; i < len / 8; i++)
+			sum += p[i];
+		if (r)
+			ring_consume(r, len);
+		total += len;
+	}
+	/* Keep the sum alive.  */
+	if (sum == 1)
+		fprintf(stderr, "\n");
+	return total;
+}
+
+static void bench_produce(int sk, struct ring *r, uint64_t bytes, bool lat)
+{
+	static uint64_t buf[BENCH_CHUNK / 8];
+	size_t len = lat ? BENCH_MSG : BENCH_CHUNK;
+	struct timespec gap = { 0, BENCH_MSG_GAP_NS };
+	uint64_t done;
+	unsigned int i;
+
+	for (i = 0; i < sizeof buf / sizeof buf[0]; i++)
+		buf[i] = i;
+
+	for (done = 0; done < bytes; done += len) {
+		if (lat) {
+			nanosleep(&gap, NULL);
+			buf[0] = now_ns();
+		}
+		if (r) {
+			size_t space;
+			void *p = ring_reserve(r, &space);
+
+			if (!p)
+				break;
+			memcpy(p, buf, len);
+			ring_commit(r, len);
+		} else {
+			if (safe_write(sk, buf, len) != len)
+				break;
+		}
+	}
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	const uint64_t *x = a, *y = b;
+
+	return *x < *y ? -1 : *x > *y;
+}
+
+/*
+ * Run the producer in this process and the consumer in a child, over a
+ * socketpair or a shm ring. Returns the time taken in ns.
+ */
+static uint64_t bench_run(bool shm, uint64_t bytes, bool lat)
+{
+	uint64_t *lats = NULL;
+	struct ring r;
+	char name[64];
+	int sk[2] = { -1, -1 };
+	uint64_t start;
+	pid_t pid;
+	int fd = -1;
+
+	if (lat)
+		lats = mmap(NULL, sizeof lats[0] * BENCH_NR_MSGS,
+			    PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if (shm) {
+		snprintf(name, sizeof name, "/etrace-bench-%d", getpid());
+		fd = ring_shm_create(name, BENCH_RING_SIZE);
+		shm_unlink(name);
+		if (fd < 0) {
+			perror(name);
+			exit(EXIT_FAILURE);
+		}
+	} else if (socketpair(AF_UNIX, SOCK_STREAM, 0, sk) < 0) {
+		perror("socketpair");
+		exit(EXIT_FAILURE);
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
+	if (pid == 0) {
+		if (shm) {
+			if (!ring_attach(&r, fd, false))
+				_exit(EXIT_FAILURE);
+			bench_consume(-1, &r, lats);
+			ring_destroy(&r);
+		} else {
+			close(sk[0]);
+			bench_consume(sk[1], NULL, lats);
+		}
+		_exit(EXIT_SUCCESS);
+	}
+
+	start = now_ns();
+	if (shm) {
+		if (!ring_attach(&r, fd, true))
+			exit(EXIT_FAILURE);
+		bench_produce(-1, &r, bytes, lat);
+		ring_close(&r);
+		ring_destroy(&r);
+		close(fd);
+	} else {
+		close(sk[1]);
+		bench_produce(sk[0], NULL, bytes, lat);
+		close(sk[0]);
+	}
+	waitpid(pid, NULL, 0);
+
+	if (lat) {
+		uint64_t sum = 0;
+		unsigned int i;
+
+		qsort(lats, BENCH_NR_MSGS, sizeof lats[0], cmp_u64);
+		for (i = 0; i < BENCH_NR_MSGS; i++)
+			sum += lats[i];
+		printf("%-8s latency avg %6.2f us  p50 %6.2f us  p99 %7.2f us\n",
+			shm ? "shm" : "socket",
+			sum / 1000.0 / BENCH_NR_MSGS,
+			lats[BENCH_NR_MSGS / 2] / 1000.0,
+			lats[BENCH_NR_MSGS * 99 / 100] / 1000.0);
+		munmap(lats, sizeof lats[0] * BENCH_NR_MSGS);
+	}
+	return now_ns() - start;
+}
+
+static int bench(uint64_t mb)
+{
+	uint64_t bytes = mb * 1024 * 1024;
+	unsigned int i;
+
+	bytes -= bytes % BENCH_CHUNK;
+	for (i = 0; i < 2; i++) {
+		bool shm = i;
+		uint64_t t = bench_run(shm, bytes, false);
+
+		printf("%-8s %" PRIu64 " MB in %.3f s, %.1f MB/s\n",
+			shm ? "shm" : "socket", mb, t / 1e9,
+			mb / (t / 1e9));
+	}
+	for (i = 0; i < 2; i++)
+		bench_run(i, (uint64_t) BENCH_NR_MSGS * BENCH_MSG, true);
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc >= 2 && !strcmp(argv[1], "--bench"))
+		return bench(argc > 2 ? strtoull(argv[2], NULL, 0) : 2048);
+
+	if (argc < 2 || argc > 3 || strncmp(argv[1], SHM_PREFIX,
+					    strlen(SHM_PREFIX))) {
+		usage();
+		return EXIT_FAILURE;
+	}
+	return feed(argv[1], argc > 2 ? argv[2] : NULL);
+}
@@ -340,6 +340,9 @@ class traceview(object):
 				self.e.reset()
 				r = self.step_new_exec(count = 1)
 			elif c == ord('G'):
+				# Skip ahead through the index if we have one.
+				self.e.seek_last()
+				self.record = None
 				r = True
 				while r:
 					r = self.step_trace_record(count = 1)
@@ -30,24 +30,119 @@
 #include <assert.h>
 #include <errno.h>
 #include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 
 #include "util.h"
 #include "safeio.h"
+#include "ring.h"
 #include "syms.h"
 #include "disas.h"
 #include "coverage.h"
 #include "trace.h"
 #include "etrace.h"
+#include "etrace-index.h"
+#include "follow.h"
+#include "trace-open.h"
 
 #define ETRACE_MIN_VERSION_MAJOR 0
 
 #define MAX_PKG (2 * 1024 * 1024)
 
+/*
+ * Regular trace-files are mmap:ed through a sliding window so that we
+ * can handle files larger than the address-space. The window must be
+ * able to hold at least one max sized pkg.
+ */
+#define MAP_WINDOW (256 * 1024 * 1024)
+
+/*
+ * Sockets and pipes are read by a separate thread into a ring so that
+ * I/O overlaps with decoding. The ring must hold a max sized pkg.
+ */
+#define RING_SIZE (32 * 1024 * 1024)
+
+enum etrace_src {
+	SRC_READ,
+	SRC_MAP,
+	SRC_RING,
+};
+
+struct etrace_map {
+	int fd;
+	uint8_t *base;
+	off_t base_off;
+	size_t len;
+
+	/* File offset of the next pkg.  */
+	off_t pos;
+	off_t size;
+	long pagesize;
+};
+
 struct etracer {
 	struct tracer tr;
 	struct etrace_info_data info;
 	struct etrace_arch arch;
+	/* Current pkg. Points into buf, the mmap window or the ring.  */
 	struct etrace_pkg *pkg;
+	enum etrace_src src;
+	struct etrace_pkg *buf;
+	struct etrace_map map;
+	struct ring ring;
+	/* Size of the current pkg, released from the ring on the next read.  */
+	size_t ring_pending;
+	bool unknown_pkg_warn;
+
+	/* Pkg index of mapped trace-files.  */
+	struct etrace_index idx;
+	char *idx_name;
+	bool has_idx;
+
+	/* Nr of the current pkg and window state, see etrace_in_window.  */
+	uint64_t pkg_nr;
+	bool in_window;
+
+	/* --follow of a trace-file that is still growing.  */
+	struct follow follow;
+	bool following;
+};
+
+/*
+ * Passthrough of sockets and pipes is done in the kernel. A thread
+ * splices the input into a pipe, tee(2)s that into the pipe the decoder
+ * reads and splices the original on to the trace output.
+ */
+#define TEE_CHUNK (1024 * 1024)
+
+struct etrace_tee {
+	int in;
+	int out;
+	enum cov_format cov_fmt;
+	/* Staging pipe and decoder pipe.  */
+	int stage[2];
+	int dec[2];
+	bool out_failed;
+	bool out_copy;
+	pthread_t tid;
+	/* For outputs that can't be spliced to, see out_copy.  */
+	uint8_t buf[64 * 1024];
+};
+
+/*
+ * A slice of a mmap:ed trace-file decoded by its own thread into a
+ * private clone of the sym store.
+ */
+struct etrace_shard {
+	struct etracer t;
+	enum cov_format cov_fmt;
+	void *store;
+	pthread_t tid;
 };
 
 static bool etrace_read_hdr(int fd, struct etrace_hdr *hdr)
@@ -60,6 +155,126 @@ static bool etrace_read_hdr(int fd, struct etrace_hdr *hdr)
 	return true;
 }
 
+static bool etrace_map_init(struct etracer *t)
+{
+	struct etrace_map *m = &t->map;
+	struct stat st;
+
+	memset(m, 0, sizeof *m);
+	m->fd = -1;
+	if (fstat(t->tr.fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return false;
+
+	m->size = st.st_size;
+	m->pos = lseek(t->tr.fd, 0, SEEK_CUR);
+	if (m->pos < 0)
+		return false;
+	m->pagesize = sysconf(_SC_PAGE_SIZE);
+	m->fd = t->tr.fd;
+	return true;
+}
+
+static void etrace_map_unmap(struct etrace_map *m)
+{
+	if (m->base)
+		munmap(m->base, m->len);
+	m->base = NULL;
+	m->len = 0;
+}
+
+/* Make sure [pos, pos + len) is covered by the window.  */
+static bool etrace_map_window(struct etrace_map *m, off_t pos, size_t len)
+{
+	if (m->base && pos >= m->base_off
+	    && pos + len <= m->base_off + m->len)
+		return true;
+
+	etrace_map_unmap(m);
+
+	m->base_off = pos & ~((off_t) m->pagesize - 1);
+	m->len = MAP_WINDOW;
+	if (m->base_off + m->len > m->size)
+		m->len = align_pow2(m->size - m->base_off, m->pagesize);
+	assert(pos + len <= m->base_off + m->len);
+
+	m->base = mmap(NULL, m->len, PROT_READ, MAP_SHARED,
+			m->fd, m->base_off);
+	if (m->base == MAP_FAILED) {
+		perror("mmap");
+		m->base = NULL;
+		return false;
+	}
+	madvise(m->base, m->len, MADV_SEQUENTIAL);
+	return true;
+}
+
+static bool etrace_map_pkg(struct etracer *t)
+{
+	struct etrace_map *m = &t->map;
+	struct etrace_hdr *hdr;
+	size_t len;
+
+	if (m->pos + sizeof *hdr > m->size)
+		return false;
+
+	if (!etrace_map_window(m, m->pos, sizeof *hdr))
+		return false;
+	hdr = (void *) (m->base + (m->pos - m->base_off));
+
+	if (hdr->len > MAX_PKG) {
+		printf("Too large Etrace pkg! %d\n", hdr->len);
+		return false;
+	}
+
+	len = sizeof *hdr + hdr->len;
+	if (m->pos + len > m->size)
+		return false;
+
+	if (!etrace_map_window(m, m->pos, len))
+		return false;
+
+	t->pkg = (void *) (m->base + (m->pos - m->base_off));
+	m->pos += len;
+	return true;
+}
+
+/* Show what we have before waiting for the followed file to grow.  */
+static inline void etrace_follow_flush(struct etracer *t, size_t len)
+{
+	if (t->following && t->tr.fp_out && ring_avail(&t->ring) < len)
+		fflush(t->tr.fp_out);
+}
+
+static bool etrace_ring_pkg(struct etracer *t)
+{
+	struct etrace_hdr *hdr;
+	size_t len;
+
+	if (t->ring_pending) {
+		ring_consume(&t->ring, t->ring_pending);
+		t->ring_pending = 0;
+	}
+
+	etrace_follow_flush(t, sizeof *hdr);
+	hdr = ring_peek(&t->ring, sizeof *hdr);
+	if (!hdr)
+		return false;
+
+	if (hdr->len > MAX_PKG) {
+		printf("Too large Etrace pkg! %d\n", hdr->len);
+		return false;
+	}
+
+	len = sizeof *hdr + hdr->len;
+	etrace_follow_flush(t, len);
+	t->pkg = ring_peek(&t->ring, len);
+	if (!t->pkg)
+		return false;
+
+	t->ring_pending = len;
+	return true;
+}
+
 static bool etrace_read_pkg(struct etracer *t, struct etrace_pkg *pkg)
 {
 	ssize_t r;
@@ -79,6 +294,199 @@ static bool etrace_read_pkg(struct etracer *t, struct etrace_pkg *pkg)
 	return true;
 }
 
+static bool etrace_next_pkg(struct etracer *t)
+{
+	switch (t->src) {
+	case SRC_MAP:
+		return etrace_map_pkg(t);
+	case SRC_RING:
+		return etrace_ring_pkg(t);
+	default:
+		t->pkg = t->buf;
+		return etrace_read_pkg(t, t->buf);
+	}
+}
+
+static void etrace_src_open(struct etracer *t, const struct etrace_opts *opts)
+{
+	t->buf = NULL;
+	t->ring_pending = 0;
+	t->following = false;
+
+	/* A shm: ring is consumed in place.  */
+	if (trace_is_shm(opts->trace_filename)) {
+		if (!ring_attach(&t->ring, t->tr.fd, false)) {
+			fprintf(stderr, "%s: can't map the shm ring\n",
+				opts->trace_filename);
+			exit(EXIT_FAILURE);
+		}
+		t->src = SRC_RING;
+		return;
+	}
+
+	/*
+	 * A followed file is read like a stream, the reader thread waits
+	 * at EOF and partial pkgs at the tail stay in the ring until the
+	 * rest shows up.
+	 */
+	if (opts->follow)
+		t->following = follow_init(&t->follow, t->tr.fd, opts->stop);
+
+	if (!t->following && etrace_map_init(t)) {
+		t->src = SRC_MAP;
+		return;
+	}
+
+	if (ring_init(&t->ring, RING_SIZE)) {
+		if (t->following) {
+			t->ring.wait_more = follow_wait;
+			t->ring.wait_opaque = &t->follow;
+		}
+		if (ring_start_reader(&t->ring, t->tr.fd)) {
+			t->src = SRC_RING;
+			return;
+		}
+		ring_destroy(&t->ring);
+	}
+
+	t->src = SRC_READ;
+	t->buf = safe_malloc(sizeof t->buf->hdr + MAX_PKG);
+}
+
+static void etrace_src_close(struct etracer *t)
+{
+	switch (t->src) {
+	case SRC_MAP:
+		etrace_map_unmap(&t->map);
+		break;
+	case SRC_RING:
+		ring_stop_reader(&t->ring);
+		ring_destroy(&t->ring);
+		break;
+	default:
+		free(t->buf);
+		break;
+	}
+	if (t->following)
+		follow_destroy(&t->follow);
+}
+
+/*
+ * Position t at the pkg of index entry e, with the INFO and ARCH state
+ * that was in effect there.
+ */
+static bool etrace_seek(struct etracer *t, const struct etrace_index_ent *e)
+{
+	if (e->info_pos != ETRACE_INDEX_NONE) {
+		t->map.pos = e->info_pos;
+		if (!etrace_map_pkg(t) || t->pkg->hdr.type != TYPE_INFO)
+			return false;
+		t->info = t->pkg->info;
+	}
+
+	if (e->arch_pos != ETRACE_INDEX_NONE) {
+		t->map.pos = e->arch_pos;
+		if (!etrace_map_pkg(t) || t->pkg->hdr.type != TYPE_ARCH)
+			return false;
+		t->arch = t->pkg->arch;
+	}
+
+	t->map.pos = e->pos;
+	return true;
+}
+
+/* Index a mapped trace by hopping over the pkg headers.  */
+static void etrace_index_scan(struct etracer *t, struct etrace_index *idx)
+{
+	struct etracer s;
+
+	memset(&s, 0, sizeof s);
+	s.map = t->map;
+	s.map.base = NULL;
+	s.map.len = 0;
+
+	etrace_index_begin(idx);
+	while (1) {
+		off_t pos = s.map.pos;
+
+		if (!etrace_map_pkg(&s))
+			break;
+		etrace_index_add(idx, pos, s.pkg);
+	}
+	etrace_map_unmap(&s.map);
+}
+
+/* Make sure t has an index, building and saving it if needed.  */
+static bool etrace_index_get(struct etracer *t)
+{
+	if (t->has_idx)
+		return true;
+	if (t->src != SRC_MAP || t->map.pos != 0)
+		return false;
+
+	etrace_index_scan(t, &t->idx);
+	if (t->idx_name)
+		etrace_index_save(&t->idx, t->idx_name, t->tr.fd);
+	t->has_idx = true;
+	return true;
+}
+
+static void etrace_index_open(struct etracer *t, const char *trace_filename)
+{
+	t->has_idx = false;
+	t->idx_name = NULL;
+	memset(&t->idx, 0, sizeof t->idx);
+
+	if (t->src != SRC_MAP)
+		return;
+
+	t->idx_name = etrace_index_filename(trace_filename, t->tr.fd);
+	if (t->idx_name)
+		t->has_idx = etrace_index_load(&t->idx, t->idx_name,
+					       t->tr.fd);
+}
+
+static void etrace_index_close(struct etracer *t)
+{
+	etrace_index_free(&t->idx);
+	free(t->idx_name);
+	t->idx_name = NULL;
+	t->has_idx = false;
+}
+
+bool etrace_build_index(int fd, const char *trace_filename)
+{
+	struct etracer t;
+
+	memset(&t, 0, sizeof t);
+	t.tr.fd = fd;
+	if (!etrace_map_init(&t)) {
+		fprintf(stderr, "%s: can only index regular files\n",
+			trace_filename);
+		return false;
+	}
+	t.src = SRC_MAP;
+
+	t.idx_name = etrace_index_filename(trace_filename, fd);
+	if (!t.idx_name) {
+		fprintf(stderr, "%s: cannot index this trace\n",
+			trace_filename);
+		return false;
+	}
+
+	etrace_index_scan(&t, &t.idx);
+	if (!etrace_index_save(&t.idx, t.idx_name, fd)) {
+		fprintf(stderr, "%s: failed to write the index\n",
+			t.idx_name);
+		etrace_index_close(&t);
+		return false;
+	}
+	fprintf(stderr, "Indexed %" PRIu64 " pkgs into %s\n",
+		t.idx.hdr.nr_pkgs, t.idx_name);
+	etrace_index_close(&t);
+	return true;
+}
+
 static void bad_version(struct etracer *t)
 {
 	fprintf(stderr,
@@ -232,9 +640,6 @@ void etrace_process_exec(struct etracer *t, enum cov_format cov_fmt)
 			break;
 		}
 
-		if (t && t->tr.sym_tree && *t->tr.sym_tree)
-			sym = sym_lookup_by_addr(t->tr.sym_tree, start);
-
 		if (t->tr.fp_out) {
 #if 0
 			printf("Trace %"PRIx64  " %" PRIx64 " - %" PRIx64 " ",
@@ -243,6 +648,9 @@ void etrace_process_exec(struct etracer *t, enum cov_format cov_fmt)
 			char out[80] = "E";
 			unsigned int pos = 1;
 
+			if (t->tr.sym_tree && *t->tr.sym_tree)
+				sym = sym_lookup_by_addr(t->tr.sym_tree, start);
+
 			pos += u64tohex(out + pos, t->pkg->hdr.unit_id);
 			out[pos++] = ' ';
 
@@ -276,23 +684,7 @@ void etrace_process_exec(struct etracer *t, enum cov_format cov_fmt)
 					"Rerun QEMU with -no-tb-chain.\n");
 				exit(EXIT_FAILURE);
                         }
-			if (!sym)
-				sym = sym_get_unknown(t->tr.sym_tree);
-
-			if (sym) {
-				uint64_t addr = start;
-				while (sym && addr < end) {
-					uint64_t tend = end;
-
-					if (tend > (sym->addr + sym->size)) {
-						tend = sym->addr + sym->size;
-						printf("WARNING: fixup sym %s has spans over to another symbol\n", sym->name);
-					}
-					sym_update_cov(sym, addr, tend, duration);
-					addr = tend;
-					sym = sym_lookup_by_addr(t->tr.sym_tree, addr);
-				}
-			}
+			sym_update_cov_tb(t->tr.sym_tree, start, end, duration);
 		}
 		now += duration;
 	}
@@ -303,9 +695,14 @@ void etrace_process_note(struct etracer *t)
 	struct etrace_note *nt = &t->pkg->note;
 	if (!t->tr.fp_out)
 		return;
+	/* A truncated note has no text, not even its time.  */
+	if (t->pkg->hdr.len < sizeof nt->time)
+		return;
 
-	t->pkg->u8[t->pkg->hdr.len] = 0;
-	fprintf(t->tr.fp_out, "%s", &nt->data8[0]);
+	/* The pkg may live in a read-only mapping, so don't terminate
+	   the string in place.  */
+	fprintf(t->tr.fp_out, "%.*s",
+		(int) (t->pkg->hdr.len - sizeof nt->time), &nt->data8[0]);
 }
 
 void etrace_process_mem(struct etracer *t)
@@ -342,17 +739,425 @@ void etrace_process_event_u64(struct etracer *t)
 		event->names, event->names + event->dev_name_len, event->val);
 }
 
+static void etrace_process_pkg(struct etracer *t, enum cov_format cov_fmt)
+{
+	switch (t->pkg->hdr.type) {
+	case TYPE_EXEC:
+		etrace_process_exec(t, cov_fmt);
+		break;
+	case TYPE_TB:
+		etrace_process_tb(t);
+		break;
+	case TYPE_NOTE:
+		etrace_process_note(t);
+		break;
+	case TYPE_MEM:
+		etrace_process_mem(t);
+		break;
+	case TYPE_ARCH:
+		etrace_process_arch(t);
+		break;
+	case TYPE_BARRIER:
+		/* We dont yet support queueing and sorting of
+		   pkgs. Ignore.  */
+		break;
+	case TYPE_INFO:
+		etrace_process_info(t);
+		break;
+	case TYPE_OLD_EVENT_U64:
+		etrace_process_old_event_u64(t);
+		break;
+	case TYPE_EVENT_U64:
+		etrace_process_event_u64(t);
+		break;
+	default:
+		/* Show a warning once. We trust the version handling
+		   to abort when the format is truly incompatible.  */
+		if (!t->unknown_pkg_warn) {
+			fprintf(stderr,
+				"Non-fatal warning: "
+				"Unknown etrace package type %u\n"
+				"Maybe you need to update "
+				"qemu-etrace?\n",
+				t->pkg->hdr.type);
+			t->unknown_pkg_warn = true;
+		}
+		break;
+	}
+}
+
+/*
+ * Split the remainder of a mmap:ed trace into up to jobs slices at pkg
+ * boundaries taken from the index. Each slice starts with the INFO and
+ * ARCH state in effect at its first pkg.
+ */
+static unsigned int etrace_shard_split(struct etracer *t,
+				       struct etrace_shard *sh,
+				       unsigned int jobs)
+{
+	off_t chunk = (t->map.size - t->map.pos) / jobs;
+	unsigned int i, n = 1;
+
+	sh[0].t = *t;
+	for (i = 1; i < jobs; i++) {
+		const struct etrace_index_ent *e;
+
+		e = etrace_index_find_pos(&t->idx, t->map.pos + i * chunk);
+		if (!e || e->pos <= sh[n - 1].t.map.pos)
+			continue;
+
+		sh[n].t = *t;
+		if (!etrace_seek(&sh[n].t, e))
+			break;
+		etrace_map_unmap(&sh[n].t.map);
+		n++;
+	}
+
+	for (i = 0; i < n; i++) {
+		sh[i].t.map.size = i + 1 < n ? sh[i + 1].t.map.pos
+					     : t->map.size;
+	}
+	return n;
+}
+
+static void *etrace_shard_thread(void *opaque)
+{
+	struct etrace_shard *sh = opaque;
+	sigset_t set;
+
+	/* Leave signal handling to the main thread.  */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	while (etrace_next_pkg(&sh->t))
+		etrace_process_pkg(&sh->t, sh->cov_fmt);
+	etrace_map_unmap(&sh->t.map);
+	return NULL;
+}
+
+/*
+ * Decode a regular trace-file with several threads. Every shard accounts
+ * coverage into its own counters, they are all added into the main store
+ * before we return so coverage_emit sees the same totals as a serial run.
+ */
+static void etrace_show_sharded(struct etracer *t, enum cov_format cov_fmt,
+				unsigned int jobs)
+{
+	struct etrace_shard *sh;
+	unsigned int i, n;
+	int err;
+
+	sh = safe_mallocz(sizeof *sh * jobs);
+	n = etrace_shard_split(t, sh, jobs);
+
+	for (i = 0; i < n; i++) {
+		sh[i].cov_fmt = cov_fmt;
+		sh[i].store = sym_store_clone(t->tr.sym_tree);
+		sh[i].t.tr.sym_tree = &sh[i].store;
+
+		err = pthread_create(&sh[i].tid, NULL, etrace_shard_thread,
+				     &sh[i]);
+		if (err) {
+			fprintf(stderr, "pthread_create: %s\n", strerror(err));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		pthread_join(sh[i].tid, NULL);
+		sym_store_merge(t->tr.sym_tree, sh[i].store);
+	}
+	free(sh);
+}
+
+static const struct etrace_opts etrace_default_opts = {
+	.jobs = 1,
+	.end_time = UINT64_MAX,
+	.count = UINT64_MAX,
+};
+
+static unsigned int etrace_jobs(const struct etrace_opts *opts)
+{
+	long n;
+
+	if (opts->jobs)
+		return opts->jobs;
+
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? n : 1;
+}
+
+static bool etrace_windowed(const struct etrace_opts *opts)
+{
+	return opts->start_time || opts->end_time != UINT64_MAX
+		|| opts->start_pkg || opts->count != UINT64_MAX;
+}
+
+/*
+ * Decide if the current pkg falls into the --start-time/--end-time and
+ * --start-pkg/--count window. Pkgs without a time stamp follow the last
+ * pkg that had one, except INFO and ARCH which are always kept. Sets
+ * *stop once the rest of the trace is known to be outside the window;
+ * for the time limit this relies on the trace being in time order, as
+ * QEMU writes it.
+ */
+static bool etrace_in_window(struct etracer *t,
+			     const struct etrace_opts *opts, bool *stop)
+{
+	uint64_t time;
+
+	if (t->pkg_nr >= opts->start_pkg
+	    && t->pkg_nr - opts->start_pkg >= opts->count) {
+		*stop = true;
+		return false;
+	}
+
+	switch (t->pkg->hdr.type) {
+	case TYPE_INFO:
+	case TYPE_ARCH:
+		return true;
+	}
+
+	if (t->pkg_nr < opts->start_pkg)
+		return false;
+
+	if (etrace_pkg_time(t->pkg, &time)) {
+		if (time >= opts->end_time) {
+			*stop = true;
+			return false;
+		}
+		t->in_window = time >= opts->start_time;
+	}
+	return t->in_window;
+}
+
+static void etrace_write_pkg(struct etracer *t, int fd_out,
+			     enum cov_format cov_fmt)
+{
+	int r;
+
+	r = safe_write(fd_out, t->pkg, sizeof t->pkg->hdr + t->pkg->hdr.len);
+	if (r <= 0) {
+		/* Don't bail out as coverage may still work.  */
+		static bool once = false;
+		if (!once) {
+			fprintf(stderr, "trace-out: %s pid=%d\n",
+				strerror(errno), getpid());
+			once = true;
+			sleep(1000);
+		}
+		if (cov_fmt != NONE) {
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+static void etrace_tee_out_error(struct etrace_tee *te)
+{
+	fprintf(stderr, "trace-out: %s pid=%d\n", strerror(errno), getpid());
+	te->out_failed = true;
+	/* Same as the non-tee path.  */
+	if (te->cov_fmt != NONE)
+		exit(EXIT_FAILURE);
+}
+
+/* Move len bytes out of the staging pipe and on to the trace output.  */
+static bool etrace_tee_drain(struct etrace_tee *te, size_t len)
+{
+	while (len && !te->out_failed && !te->out_copy) {
+		ssize_t r = safe_splice(te->stage[0], te->out, len);
+
+		if (r > 0) {
+			len -= r;
+			continue;
+		}
+		/* E.g O_APPEND files can't be spliced to.  */
+		if (errno == EINVAL || errno == ENOSYS)
+			te->out_copy = true;
+		else
+			etrace_tee_out_error(te);
+	}
+
+	while (len) {
+		ssize_t r = safe_read(te->stage[0], te->buf,
+				      len < sizeof te->buf ? len
+							   : sizeof te->buf);
+		if (r <= 0)
+			return false;
+		if (!te->out_failed && safe_write(te->out, te->buf, r) != r)
+			etrace_tee_out_error(te);
+		len -= r;
+	}
+	return true;
+}
+
+static void *etrace_tee_thread(void *opaque)
+{
+	struct etrace_tee *te = opaque;
+	sigset_t set;
+
+	/* Leave signal handling to the decoder thread.  */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	while (1) {
+		ssize_t n;
+
+		n = splice(te->in, NULL, te->stage[1], NULL, TEE_CHUNK,
+			   SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			if (n < 0)
+				perror("splice");
+			break;
+		}
+
+		while (n) {
+			ssize_t k = n;
+
+			if (te->dec[1] != -1) {
+				k = tee(te->stage[0], te->dec[1], n, 0);
+				if (k < 0 && errno == EINTR)
+					continue;
+				if (k <= 0) {
+					/* The decoder is gone, keep archiving.  */
+					close(te->dec[1]);
+					te->dec[1] = -1;
+					k = n;
+				}
+			}
+			if (!etrace_tee_drain(te, k))
+				goto done;
+			n -= k;
+		}
+	}
+done:
+	if (te->dec[1] != -1)
+		close(te->dec[1]);
+	te->dec[1] = -1;
+	return NULL;
+}
+
+/*
+ * Start teeing fd to fd_out. Returns the fd the decoder should read
+ * or -1 if the kernel path can't be used.
+ */
+static int etrace_tee_start(struct etrace_tee *te, int fd, int fd_out,
+			    enum cov_format cov_fmt)
+{
+	struct stat st;
+	int err;
+
+	/* Regular files are mapped instead.  */
+	if (fstat(fd, &st) < 0 || S_ISREG(st.st_mode))
+		return -1;
+
+	memset(te, 0, sizeof *te);
+	te->in = fd;
+	te->out = fd_out;
+	te->cov_fmt = cov_fmt;
+
+	if (pipe2(te->stage, O_CLOEXEC) < 0)
+		return -1;
+	if (pipe2(te->dec, O_CLOEXEC) < 0)
+		goto fail_stage;
+
+	/* Larger pipes mean fewer syscalls. Failure is harmless.  */
+	fcntl(te->stage[1], F_SETPIPE_SZ, TEE_CHUNK);
+	fcntl(te->dec[1], F_SETPIPE_SZ, TEE_CHUNK);
+
+	err = pthread_create(&te->tid, NULL, etrace_tee_thread, te);
+	if (err) {
+		fprintf(stderr, "pthread_create: %s\n", strerror(err));
+		goto fail_dec;
+	}
+	return te->dec[0];
+
+fail_dec:
+	close(te->dec[0]);
+	close(te->dec[1]);
+fail_stage:
+	close(te->stage[0]);
+	close(te->stage[1]);
+	return -1;
+}
+
+static void etrace_tee_stop(struct etrace_tee *te)
+{
+	/* Unblocks the thread if the decoder stopped early.  */
+	close(te->dec[0]);
+	pthread_join(te->tid, NULL);
+	close(te->stage[0]);
+	close(te->stage[1]);
+}
+
+/*
+ * Jump to the start of the window through the index. The INFO and ARCH
+ * pkgs in effect there are replayed so that both decoding and etrace
+ * output start in the right state.
+ */
+static void etrace_window_seek(struct etracer *t,
+			       const struct etrace_opts *opts,
+			       enum cov_format cov_fmt, int fd_out)
+{
+	const struct etrace_index_ent *e = NULL, *et;
+	uint64_t replay[2];
+	unsigned int i;
+
+	if (!t->has_idx)
+		return;
+
+	if (opts->start_pkg)
+		e = etrace_index_find_pkg(&t->idx, opts->start_pkg);
+	if (opts->start_time) {
+		et = etrace_index_find_time(&t->idx, opts->start_time);
+		if (et && (!e || et->pos > e->pos))
+			e = et;
+	}
+	if (!e || e->pos <= t->map.pos)
+		return;
+
+	replay[0] = e->info_pos;
+	replay[1] = e->arch_pos;
+	for (i = 0; i < 2; i++) {
+		if (replay[i] == ETRACE_INDEX_NONE)
+			continue;
+
+		t->map.pos = replay[i];
+		if (!etrace_next_pkg(t))
+			continue;
+		etrace_process_pkg(t, cov_fmt);
+		if (fd_out != -1)
+			etrace_write_pkg(t, fd_out, cov_fmt);
+	}
+
+	t->map.pos = e->pos;
+	t->pkg_nr = e->pkg_nr;
+}
+
 void etrace_show(int fd, FILE *fp_out,
 		 const char *objdump, const char *machine,
 		 const char *guest_objdump, const char *guest_machine,
 		 void **sym_tree, enum cov_format cov_fmt,
 		 enum trace_format trace_in_fmt,
-		 enum trace_format trace_out_fmt)
+		 enum trace_format trace_out_fmt,
+		 const struct etrace_opts *opts)
 {
 	struct etracer t;
-	bool unknown_pkg_warn = false;
+	struct etrace_tee te;
+	bool teeing = false;
+	unsigned int jobs;
+	bool windowed;
+	bool build_idx;
+	bool stop = false;
 	int fd_out = -1;
 
+	if (!opts)
+		opts = &etrace_default_opts;
+	jobs = etrace_jobs(opts);
+	windowed = etrace_windowed(opts);
+
 	fprintf(stderr, "Processing trace\n");
 
 	t.tr.fd = fd;
@@ -363,8 +1168,9 @@ void etrace_show(int fd, FILE *fp_out,
 	t.tr.host.machine = machine;
 	t.tr.guest.objdump = guest_objdump;
 	t.tr.guest.machine = guest_machine;
-
-	t.pkg = safe_malloc(sizeof t.pkg->hdr + MAX_PKG);
+	t.unknown_pkg_warn = false;
+	t.pkg_nr = 0;
+	t.in_window = false;
 
 	/* Short path for passthrough.  */
 	if (trace_out_fmt == trace_in_fmt) {
@@ -374,71 +1180,65 @@ void etrace_show(int fd, FILE *fp_out,
 		}
 	}
 
-	while (etrace_read_pkg(&t, t.pkg)) {
-		int r;
+	/* Streams are passed through by the kernel, in full.  */
+	if (fd_out != -1 && !windowed) {
+		int dec_fd = etrace_tee_start(&te, fd, fd_out, cov_fmt);
 
-		switch (t.pkg->hdr.type) {
-		case TYPE_EXEC:
-			etrace_process_exec(&t, cov_fmt);
-			break;
-		case TYPE_TB:
-			etrace_process_tb(&t);
-			break;
-		case TYPE_NOTE:
-			etrace_process_note(&t);
-			break;
-		case TYPE_MEM:
-			etrace_process_mem(&t);
-			break;
-		case TYPE_ARCH:
-			etrace_process_arch(&t);
-			break;
-		case TYPE_BARRIER:
-			/* We dont yet support queueing and sorting of
-			   pkgs. Ignore.  */
-			break;
-		case TYPE_INFO:
-			etrace_process_info(&t);
-			break;
-		case TYPE_OLD_EVENT_U64:
-			etrace_process_old_event_u64(&t);
-			break;
-		case TYPE_EVENT_U64:
-			etrace_process_event_u64(&t);
-			break;
-		default:
-			/* Show a warning once. We trust the version handling
-			   to abort when the format is truly incompatible.  */
-			if (!unknown_pkg_warn) {
-				fprintf(stderr,
-					"Non-fatal warning: "
-					"Unknown etrace package type %u\n"
-					"Maybe you need to update "
-					"qemu-etrace?\n",
-					t.pkg->hdr.type);
-				unknown_pkg_warn = true;
-			}
-			break;
+		if (dec_fd != -1) {
+			t.tr.fd = dec_fd;
+			fd_out = -1;
+			teeing = true;
 		}
+	}
 
-		if (fd_out != -1) {
-			r = safe_write(fd_out, t.pkg,
-					sizeof t.pkg->hdr + t.pkg->hdr.len);
-			if (r <= 0) {
-				/* Don't bail out as coverage may still work.  */
-				static bool once = false;
-				if (!once) {
-					fprintf(stderr, "trace-out: %s pid=%d\n",
-						strerror(errno), getpid());
-					once = true;
-					sleep(1000);
-				}
-				if (cov_fmt != NONE) {
-					exit(EXIT_FAILURE);
-				}
-			}
+	etrace_src_open(&t, opts);
+	etrace_index_open(&t, opts->trace_filename);
+
+	if (jobs > 1) {
+		/* Shards run out of order, so they can only feed coverage.  */
+		if (t.src == SRC_MAP && !t.tr.fp_out && fd_out == -1
+		    && cov_fmt != NONE && sym_tree && *sym_tree
+		    && !windowed && etrace_index_get(&t)) {
+			etrace_show_sharded(&t, cov_fmt, jobs);
+			goto done;
+		}
+		fprintf(stderr, "Note: --jobs needs a trace-file, coverage "
+			"and --trace-output none, without a window. "
+			"Decoding serially.\n");
+	}
+
+	/* Index the trace on the first full pass.  */
+	build_idx = t.src == SRC_MAP && !t.has_idx && t.idx_name
+		    && t.map.pos == 0 && !windowed;
+	if (build_idx)
+		etrace_index_begin(&t.idx);
+
+	if (windowed && t.src == SRC_MAP)
+		etrace_window_seek(&t, opts, cov_fmt, fd_out);
+
+	while (!stop) {
+		off_t pos = t.map.pos;
+
+		if (!etrace_next_pkg(&t))
+			break;
+
+		if (build_idx)
+			etrace_index_add(&t.idx, pos, t.pkg);
+
+		if (!windowed || etrace_in_window(&t, opts, &stop)) {
+			etrace_process_pkg(&t, cov_fmt);
+			if (fd_out != -1)
+				etrace_write_pkg(&t, fd_out, cov_fmt);
 		}
+		t.pkg_nr++;
 	}
-	free(t.pkg);
+	/* Small traces don't need an index.  */
+	if (build_idx && t.idx.hdr.nr_ents > 1)
+		etrace_index_save(&t.idx, t.idx_name, t.tr.fd);
+done:
+	etrace_index_close(&t);
+	etrace_src_close(&t);
+	if (teeing)
+		etrace_tee_stop(&te);
 	fprintf(stderr, "done.\n");
 }
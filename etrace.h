@@ -17,6 +17,8 @@
  *
  */
 
+#include <signal.h>
+
 enum {
     TYPE_EXEC = 1,
     TYPE_TB = 2,
@@ -142,9 +144,30 @@ struct etrace_pkg {
 	};
 };
 
+struct etrace_opts {
+	/* Used to find the pkg index of the trace.  */
+	const char *trace_filename;
+	/* Nr of threads decoding regular trace-files for coverage.  */
+	unsigned int jobs;
+
+	/* Only decode pkgs in [start_time, end_time) and
+	   [start_pkg, start_pkg + count).  */
+	uint64_t start_time;
+	uint64_t end_time;
+	uint64_t start_pkg;
+	uint64_t count;
+
+	/* Wait for regular trace-files to grow at EOF, until *stop.  */
+	bool follow;
+	volatile sig_atomic_t *stop;
+};
+
+bool etrace_build_index(int fd, const char *trace_filename);
+
 void etrace_show(int fd, FILE *fp_out,
                  const char *objdump, const char *machine,
                  const char *guest_objdump, const char *guest_machine,
                  void **sym_tree, enum cov_format cov_fmt,
 		 enum trace_format trace_in_fmt,
-		 enum trace_format trace_out_fmt);
+		 enum trace_format trace_out_fmt,
+		 const struct etrace_opts *opts);
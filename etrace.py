@@ -18,6 +18,7 @@
 #
 
 import sys
+import os
 from ctypes import *
 
 class etrace_hdr(Structure):
@@ -108,6 +109,106 @@ class etrace_pkg(Structure):
 		("all", etrace_all_subtypes)
 	]
 
+# Pkg index, see etrace-index.h.
+class etrace_index_hdr(Structure):
+	_pack_ = 1
+	_fields_ = [
+		("magic", c_uint32),
+		("version", c_uint32),
+		("stride", c_uint32),
+		("ent_size", c_uint32),
+		("trace_size", c_uint64),
+		("trace_mtime", c_uint64),
+		("nr_pkgs", c_uint64),
+		("nr_ents", c_uint64),
+	]
+
+class etrace_index_ent(Structure):
+	_pack_ = 1
+	_fields_ = [
+		("pos", c_uint64),
+		("pkg_nr", c_uint64),
+		("start_time", c_uint64),
+		("arch_pos", c_uint64),
+		("info_pos", c_uint64),
+		("unit_id", c_uint16),
+		("type", c_uint16),
+		("reserved", c_uint32),
+	]
+
+class etrace_index(object):
+	MAGIC = 0x58444945
+	VERSION = 1
+	STRIDE = 1024
+	SUFFIX = ".eidx"
+	NONE = (1 << 64) - 1
+
+	def __init__(self, f):
+		self.ents = []
+		self.loaded = False
+		try:
+			self.load(f)
+		except (IOError, OSError, ValueError, AttributeError):
+			pass
+
+	def load(self, f):
+		st = os.fstat(f.fileno())
+		data = open(f.name + self.SUFFIX, 'rb').read()
+		hdr = etrace_index_hdr.from_buffer_copy(data)
+		if hdr.magic != self.MAGIC or hdr.version != self.VERSION \
+			or hdr.ent_size != sizeof(etrace_index_ent):
+			return
+
+		# Ignore stale indexes.
+		if hdr.trace_size != st.st_size:
+			return
+		mtime_ns = getattr(st, "st_mtime_ns", None)
+		if mtime_ns != None:
+			if mtime_ns != hdr.trace_mtime:
+				return
+		elif abs(hdr.trace_mtime / 1e9 - st.st_mtime) > 1e-3:
+			return
+
+		ents = (etrace_index_ent * hdr.nr_ents).from_buffer_copy(data,
+							sizeof(hdr))
+		self.ents = list(ents)
+		self.loaded = True
+
+	def learn(self, pkg_nr, pos, arch_pos):
+		# Without an index file, remember the pkgs we pass instead.
+		if self.loaded or pkg_nr % self.STRIDE:
+			return
+		if pkg_nr / self.STRIDE != len(self.ents):
+			return
+		e = etrace_index_ent()
+		e.pos = pos
+		e.pkg_nr = pkg_nr
+		e.arch_pos = arch_pos
+		e.info_pos = self.NONE
+		self.ents.append(e)
+
+	def find(self, below):
+		# Last entry for which below() holds, or the first one.
+		if len(self.ents) == 0:
+			return None
+		lo = 0
+		hi = len(self.ents)
+		while hi - lo > 1:
+			mid = (lo + hi) / 2
+			if below(self.ents[mid]):
+				lo = mid
+			else:
+				hi = mid
+		return self.ents[lo]
+
+	def find_pkg(self, nr):
+		return self.find(lambda e: e.pkg_nr <= nr)
+
+	def find_time(self, time):
+		if not self.loaded:
+			return None
+		return self.find(lambda e: e.start_time < time)
+
 class etrace(object):
 	TYPE_NONE = 0
 	TYPE_EXEC = 1
@@ -130,6 +231,7 @@ class etrace(object):
 	def __init__(self, f):
 		self.debugf = None
 		self.f = f
+		self.index = etrace_index(f)
 
 		self.reset()
 
@@ -160,8 +262,64 @@ class etrace(object):
 		self.r_idx = 0
 		self.r_max_idx = 0
 		self.r_pos_cache = []
+		self.arch_pos = etrace_index.NONE
 		self.f.seek(0, 0)
 
+	def restore(self, e):
+		# Jump to an index entry, with the ARCH pkg in effect there.
+		if e.arch_pos != etrace_index.NONE:
+			self.f.seek(e.arch_pos, 0)
+			self.decode_record()
+		self.arch_pos = e.arch_pos
+		self.f.seek(e.pos, 0)
+		self.r_idx = e.pkg_nr
+		self.r_max_idx = e.pkg_nr
+		self.r_pos_cache = []
+
+	def skip_record(self):
+		pos = self.f.tell()
+		hdr = etrace_hdr()
+		if self.f.readinto(hdr) < sizeof(hdr) \
+			or hdr.type == self.TYPE_NONE:
+			return False
+
+		if hdr.type == self.TYPE_ARCH:
+			self.f.seek(pos, 0)
+			self.decode_record()
+		else:
+			self.f.seek(hdr.len, 1)
+		return True
+
+	# Position so that the next stepf() returns pkg nr (0 based).
+	def seek_pkg(self, nr):
+		e = self.index.find_pkg(nr)
+		if e == None:
+			self.reset()
+		else:
+			self.restore(e)
+
+		while self.r_idx < nr:
+			self.push_pos()
+			self.index.learn(self.r_idx, self.f.tell(), self.arch_pos)
+			self.r_idx += 1
+			if not self.skip_record():
+				break
+
+	# Position at or before the first pkg at or after time.
+	# Needs an index file, see qemu-etrace --build-index.
+	def seek_time(self, time):
+		e = self.index.find_time(time)
+		if e == None:
+			self.reset()
+		else:
+			self.restore(e)
+
+	# Position at the last indexed pkg, near the end of the trace.
+	def seek_last(self):
+		if len(self.index.ents) == 0:
+			return
+		self.restore(self.index.ents[-1])
+
 	def stepb(self):
 		if self.r_idx <= 1:
 			return None
@@ -170,6 +328,9 @@ class etrace(object):
 		cache_idx = self.r_max_idx - self.r_idx + 1
 		if cache_idx >= 0 and cache_idx < len(self.r_pos_cache):
 			pos = self.r_pos_cache[cache_idx]
+		elif self.index.find_pkg(self.r_idx - 1):
+			self.seek_pkg(self.r_idx - 1)
+			return self.stepf()
 		else:
 			self.r_max_idx = 0
 			self.r_pos_cache = []
@@ -188,11 +349,13 @@ class etrace(object):
 
 	def stepf(self):
 		self.push_pos()
+		self.index.learn(self.r_idx, self.f.tell(), self.arch_pos)
 		self.r_idx += 1
 		return self.decode_record()
 
 	def decode_record(self):
 		pkg = etrace_pkg()
+		hdr_pos = self.f.tell()
 		self.f.readinto(pkg.hdr)
 		pos = self.f.tell()
 
@@ -202,8 +365,8 @@ class etrace(object):
 		end_pos = pos + pkg.hdr.len
 		if pkg.hdr.type == self.TYPE_ARCH:
 			self.f.readinto(pkg.all.arch)
-			print sizeof(pkg.all.arch)
 			self.arch = pkg.all.arch
+			self.arch_pos = hdr_pos
 			if self.arch.guest.arch_bits == 32:
 				self.etype = etrace_exec_entry32
 			else:
@@ -0,0 +1,130 @@
+/*
+ * Follow growing trace-files.
+ *
+ * Copyright: 2026 Xilinx Inc
+ * Written by Edgar E. Iglesias <edgar.iglesias@xilinx.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "follow.h"
+
+/* How often *stop is checked while nothing happens.  */
+#define FOLLOW_POLL_MS 200
+
+#define FOLLOW_EVENTS (IN_MODIFY | IN_CLOSE_WRITE \
+		       | IN_DELETE_SELF | IN_MOVE_SELF)
+
+/*
+ * Watch the file open on fd, whatever name it was opened by. Streams
+ * wait for data anyway, so only regular files are followed.
+ */
+bool follow_init(struct follow *f, int fd, volatile sig_atomic_t *stop)
+{
+	struct stat st;
+	char path[64];
+
+	memset(f, 0, sizeof *f);
+	f->ifd = -1;
+	f->stop = stop;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return false;
+
+	f->ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (f->ifd < 0) {
+		perror("inotify_init1");
+		return false;
+	}
+
+	snprintf(path, sizeof path, "/proc/self/fd/%d", fd);
+	if (inotify_add_watch(f->ifd, path, FOLLOW_EVENTS) < 0) {
+		perror("inotify_add_watch");
+		close(f->ifd);
+		f->ifd = -1;
+		return false;
+	}
+	return true;
+}
+
+void follow_destroy(struct follow *f)
+{
+	if (f->ifd >= 0)
+		close(f->ifd);
+	f->ifd = -1;
+}
+
+/* Returns true if anything happened to the file.  */
+static bool follow_drain(struct follow *f)
+{
+	char buf[4096]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+	bool seen = false;
+	ssize_t len;
+
+	while ((len = read(f->ifd, buf, sizeof buf)) > 0) {
+		char *p;
+
+		for (p = buf; p < buf + len;) {
+			struct inotify_event *ev = (void *) p;
+
+			if (ev->mask & (IN_CLOSE_WRITE | IN_DELETE_SELF
+					| IN_MOVE_SELF | IN_IGNORED))
+				f->writer_gone = true;
+			seen = true;
+			p += sizeof *ev + ev->len;
+		}
+	}
+	return seen;
+}
+
+/*
+ * Called at EOF. Waits until there may be more to read and returns
+ * true, or returns false if following has ended. Events are queued
+ * from follow_init on, so a write that races with the EOF is not lost.
+ */
+bool follow_wait(void *opaque)
+{
+	struct follow *f = opaque;
+	struct pollfd pfd = { .fd = f->ifd, .events = POLLIN };
+
+	/* The data written before the writer went is read by now.  */
+	if (f->writer_gone)
+		return false;
+
+	while (!(f->stop && *f->stop)) {
+		int r = poll(&pfd, 1, FOLLOW_POLL_MS);
+
+		if (r < 0 && errno != EINTR)
+			return false;
+		/* Read once more after the last close, for the tail.  */
+		if (r > 0 && follow_drain(f))
+			return true;
+	}
+	return false;
+}
@@ -0,0 +1,41 @@
+/*
+ * Follow growing trace-files.
+ *
+ * Copyright: 2026 Xilinx Inc
+ * Written by Edgar E. Iglesias <edgar.iglesias@xilinx.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+#ifndef _FOLLOW_H
+#define _FOLLOW_H
+
+#include <stdbool.h>
+#include <signal.h>
+
+/*
+ * Waits for a trace-file that is still being written to grow, like
+ * tail -f. Following ends once the writer has closed the file, the
+ * file is removed or renamed, or *stop gets set.
+ */
+struct follow {
+	int ifd;
+	bool writer_gone;
+	volatile sig_atomic_t *stop;
+};
+
+bool follow_init(struct follow *f, int fd, volatile sig_atomic_t *stop);
+void follow_destroy(struct follow *f);
+bool follow_wait(void *opaque);
+#endif
@@ -0,0 +1,158 @@
+/*
+ * Interned strings.
+ *
+ * Copyright: 2026 Xilinx Inc
+ * Written by Edgar E. Iglesias <edgar.iglesias@xilinx.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "util.h"
+#include "intern.h"
+
+/* Strings go after their id in arena chunks of this size, or larger.  */
+#define STR_CHUNK_SIZE	(64 * 1024)
+
+/*
+ * The strings by id, in chunks that never move so that str_by_id needs
+ * no lock.
+ */
+#define STR_IDS_SHIFT	14
+#define STR_IDS_CHUNK	(1U << STR_IDS_SHIFT)
+#define STR_IDS_DIR	(1U << 16)
+
+static struct {
+	pthread_mutex_t lock;
+	char *chunk;
+	size_t chunk_left;
+
+	const char **ids[STR_IDS_DIR];
+	uint32_t nr;
+
+	/* Open addressed, id + 1 of the string or 0.  */
+	uint32_t *hash;
+	unsigned int hash_size;
+} strs = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static inline unsigned int str_hash(const char *s, size_t len)
+{
+	unsigned int h = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		h = (h ^ (unsigned char) s[i]) * 16777619U;
+	return h;
+}
+
+static void str_rehash(void)
+{
+	unsigned int i, h;
+
+	free(strs.hash);
+	strs.hash_size = strs.hash_size ? strs.hash_size * 2 : 4096;
+	strs.hash = safe_mallocz(sizeof strs.hash[0] * strs.hash_size);
+	for (i = 0; i < strs.nr; i++) {
+		const char *s = str_by_id(i);
+
+		h = str_hash(s, strlen(s)) & (strs.hash_size - 1);
+		while (strs.hash[h])
+			h = (h + 1) & (strs.hash_size - 1);
+		strs.hash[h] = i + 1;
+	}
+}
+
+static char *str_alloc(size_t len)
+{
+	size_t size = align_pow2(sizeof(uint32_t) + len + 1,
+				 sizeof(uint32_t));
+	char *p;
+
+	if (size > strs.chunk_left) {
+		size_t chunk_size = size > STR_CHUNK_SIZE ? size
+							   : STR_CHUNK_SIZE;
+
+		/* The rest of the old chunk is lost, it's little.  */
+		strs.chunk = safe_malloc(chunk_size);
+		strs.chunk_left = chunk_size;
+	}
+	p = strs.chunk + sizeof(uint32_t);
+	strs.chunk += size;
+	strs.chunk_left -= size;
+	return p;
+}
+
+const char *str_intern_len(const char *s, size_t len)
+{
+	const char *r;
+	unsigned int h;
+	uint32_t id;
+	char *p;
+
+	pthread_mutex_lock(&strs.lock);
+	if (strs.nr >= strs.hash_size / 2)
+		str_rehash();
+
+	h = str_hash(s, len) & (strs.hash_size - 1);
+	while (strs.hash[h]) {
+		r = str_by_id(strs.hash[h] - 1);
+		if (!strncmp(r, s, len) && !r[len])
+			goto done;
+		h = (h + 1) & (strs.hash_size - 1);
+	}
+
+	id = strs.nr;
+	if (id == STR_IDS_DIR * STR_IDS_CHUNK) {
+		fprintf(stderr, "Too many strings to intern\n");
+		exit(EXIT_FAILURE);
+	}
+	if (!strs.ids[id >> STR_IDS_SHIFT])
+		strs.ids[id >> STR_IDS_SHIFT] = safe_malloc(
+				sizeof strs.ids[0][0] * STR_IDS_CHUNK);
+
+	p = str_alloc(len);
+	((uint32_t *) p)[-1] = id;
+	memcpy(p, s, len);
+	p[len] = 0;
+	strs.ids[id >> STR_IDS_SHIFT][id & (STR_IDS_CHUNK - 1)] = p;
+	strs.hash[h] = id + 1;
+	strs.nr++;
+	r = p;
+done:
+	pthread_mutex_unlock(&strs.lock);
+	return r;
+}
+
+const char *str_intern(const char *s)
+{
+	return str_intern_len(s, strlen(s));
+}
+
+const char *str_by_id(uint32_t id)
+{
+	return strs.ids[id >> STR_IDS_SHIFT][id & (STR_IDS_CHUNK - 1)];
+}
+
+uint32_t str_nr_ids(void)
+{
+	return __atomic_load_n(&strs.nr, __ATOMIC_RELAXED);
+}
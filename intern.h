@@ -0,0 +1,49 @@
+/*
+ * Interned strings.
+ *
+ * Copyright: 2026 Xilinx Inc
+ * Written by Edgar E. Iglesias <edgar.iglesias@xilinx.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+#ifndef _INTERN_H
+#define _INTERN_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+
+/*
+ * Strings interned here are stored once, in an arena, for the life of
+ * the process. Equal strings intern to the same pointer and to the
+ * same id, ids count up from 0. Safe to call from several threads.
+ */
+const char *str_intern(const char *s);
+const char *str_intern_len(const char *s, size_t len);
+const char *str_by_id(uint32_t id);
+uint32_t str_nr_ids(void);
+
+/*
+ * The id of a string returned by str_intern. The id is stored in front
+ * of the string, any other string has no business here.
+ */
+static inline uint32_t str_id(const char *interned)
+{
+	uint32_t id = ((const uint32_t *) interned)[-1];
+
+	assert(id < str_nr_ids() && str_by_id(id) == interned);
+	return id;
+}
+#endif
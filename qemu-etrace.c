@@ -18,13 +18,16 @@
  *
  */
 
+#define _GNU_SOURCE
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <ctype.h>
 #include <unistd.h>
+#include <errno.h>
 #include <signal.h>
 #include <getopt.h>
 
@@ -37,6 +40,8 @@
 #include "config.h"
 #include "trace-open.h"
 #include "coverage.h"
+#include "cov-db.h"
+#include "cov-merge.h"
 #include "syms.h"
 #include "trace.h"
 #include "etrace.h"
@@ -45,6 +50,7 @@
 #include "run.h"
 #include <bfd.h>
 #include "trace-qemu-simple.h"
+#include "trace-server.h"
 
 struct format_map {
 	const char *str;
@@ -81,11 +87,10 @@ struct
 {
 	char *trace_filename;
 	char *trace_output;
-	char *elf;
+	struct sym_elf *elfs;
+	unsigned int nr_elfs;
 	char *exclude;
 	char *addr2line;
-	char *dwarfdump;
-	char *nm;
 	char *objdump;
 	char *guest_objdump;
 	char *machine;
@@ -94,19 +99,34 @@ struct
 	enum trace_format trace_out_format;
 	enum cov_format coverage_format;
 	bool server;
+	bool build_index;
+	unsigned int jobs;
+	unsigned int workers;
+	bool per_client_coverage;
+	bool follow;
+	uint64_t start_time;
+	uint64_t end_time;
+	uint64_t start_pkg;
+	uint64_t count;
 	char *coverage_output;
 	char *gcov_strip;
 	char *gcov_prefix;
+	char *sym_cache;
+	bool full_linemap;
+	bool coverage_hits;
+	char *coverage_db;
+	bool merge;
+	char **merge_files;
+	unsigned int nr_merge_files;
 } args = {
 	.trace_filename = NULL,
 	.trace_output = "-",
 	.trace_in_format = TRACE_ETRACE,
 	.trace_out_format = TRACE_HUMAN,
-	.elf = NULL,
+	.elfs = NULL,
+	.nr_elfs = 0,
 	.exclude = NULL,
 	.addr2line = "/usr/bin/addr2line",
-	.dwarfdump = "/usr/bin/dwarfdump",
-	.nm = "/usr/bin/nm",
 	.objdump = "/usr/bin/objdump",
 	.guest_objdump = "objdump",
 	.machine = NULL,
@@ -115,7 +135,20 @@ struct
 	.coverage_output = NULL,
 	.gcov_strip = NULL,
 	.gcov_prefix = NULL,
+	.sym_cache = NULL,
+	.full_linemap = false,
+	.coverage_hits = false,
+	.coverage_db = NULL,
+	.merge = false,
 	.server = true,
+	.jobs = 1,
+	.workers = 0,
+	.per_client_coverage = false,
+	.follow = false,
+	.start_time = 0,
+	.end_time = UINT64_MAX,
+	.start_pkg = 0,
+	.count = UINT64_MAX,
 };
 
 static const char etrace_usagestr[] = \
@@ -125,11 +158,18 @@ static const char etrace_usagestr[] = \
 "--trace-in-format      Trace input format .\n"
 "--trace-out-format     Trace output format .\n"
 "--trace-output         Decoded trace output filename.\n"
-"--elf                  Elf file of traced app.\n"
+"--elf                  Elf file of traced app. Repeat it for more ELFs,\n"
+"                       path@offset loads an ELF offset bytes up.\n"
 "--exclude              Excludes description file.\n"
 "--addr2line            Path to addr2line binary.\n"
-"--dwarfdump            Path to dwarfdump binary.\n"
-"--nm                   Path to nm binary.\n"
+"--dwarfdump            Deprecated and ignored.\n"
+"--nm                   Deprecated and ignored.\n"
+"--sym-cache            Directory to cache syms and linemaps in, by the\n"
+"                       build-id of the elf. Default ~/.cache/qemu-etrace,\n"
+"                       none disables the cache.\n"
+"--full-linemap         Build the linemaps of all compilation units of an\n"
+"                       elf that ran code, not just of those that did.\n"
+"                       Only these are cached.\n"
 "--objdump              Path to objdump. \n"
 "--machine              Host machine name. See objdump --help.\n"
 "--guest-objdump        Path to guest objdump.\n"
@@ -138,6 +178,28 @@ static const char etrace_usagestr[] = \
 "--gcov-prefix          Prefix with the specified prefix.\n"
 "--coverage-format      Kind of coverage.\n"
 "--coverage-output      Coverage filename (if applicable).\n"
+"--coverage-hits        Only record which code ran, not how often. Takes\n"
+"                       a bit per word, for the gcov formats.\n"
+"--coverage-db          Binary coverage database to add the coverage of\n"
+"                       this run to, the coverage output then covers all\n"
+"                       runs in it. It is created if it doesn't exist.\n"
+"--merge                Merge the coverage databases and lcov info files\n"
+"                       given after the options, instead of a trace. The\n"
+"                       sum goes to the coverage output and --coverage-db.\n"
+"--start-time           Skip etrace pkgs before this time.\n"
+"--end-time             Stop at the first etrace pkg at this time.\n"
+"--start-pkg            Skip this many etrace pkgs.\n"
+"--count                Stop after this many etrace pkgs.\n"
+"--build-index          Write the pkg index of an etrace file and exit.\n"
+"--jobs                 Nr of threads decoding trace-files for coverage,\n"
+"                       or merging with --merge. all uses all online CPUs.\n"
+"                       Needs --trace-output none.\n"
+"--workers              Serve a unix: socket to many clients at once with\n"
+"                       this many decoder threads. Needs --trace-output none.\n"
+"--per-client-coverage  With --workers, also write the coverage of every\n"
+"                       client to <coverage-output>.<client-nr>.\n"
+"--follow               Keep reading a trace-file as it grows, until the\n"
+"                       writer closes it or SIGINT.\n"
 "\n";
 
 void usage(void)
@@ -191,6 +253,84 @@ static inline enum trace_format map_traceformat(const char *s)
 	return map_format(trace_fmt_map, s);
 }
 
+/* Upper bound of --jobs, to catch typos rather than spawn them.  */
+#define JOBS_MAX	4096
+
+/* A nr of threads, or all for one per online CPU which gives 0.  */
+static unsigned int parse_jobs(const char *s)
+{
+	unsigned long n;
+	char *end;
+
+	if (!strcmp(s, "all"))
+		return 0;
+
+	errno = 0;
+	n = strtoul(s, &end, 0);
+	if (errno || end == s || *end || !isdigit((unsigned char) *s)
+	    || !n || n > JOBS_MAX) {
+		fprintf(stderr, "Invalid --jobs %s, give a nr of threads "
+			"from 1 to %u or all\n", s, JOBS_MAX);
+		usage();
+		exit(EXIT_FAILURE);
+	}
+	return n;
+}
+
+/* The number in s, for option opt. Exits if it is no number.  */
+static uint64_t parse_u64(const char *opt, const char *s)
+{
+	unsigned long long n;
+	char *end;
+
+	errno = 0;
+	n = strtoull(s, &end, 0);
+	if (errno || end == s || *end || !isdigit((unsigned char) *s)) {
+		fprintf(stderr, "Invalid --%s %s, give a number\n", opt, s);
+		usage();
+		exit(EXIT_FAILURE);
+	}
+	return n;
+}
+
+/* A nr of clients to serve at once.  */
+static unsigned int parse_workers(const char *s)
+{
+	uint64_t n = parse_u64("workers", s);
+
+	if (!n || n > JOBS_MAX) {
+		fprintf(stderr, "Invalid --workers %s, give a nr of clients "
+			"from 1 to %u\n", s, JOBS_MAX);
+		usage();
+		exit(EXIT_FAILURE);
+	}
+	return n;
+}
+
+/* Add the ELF in arg, path[@offset].  */
+static void add_elf(char *arg)
+{
+	struct sym_elf *elf;
+	char *at, *end;
+
+	args.elfs = safe_realloc(args.elfs,
+				 sizeof args.elfs[0] * (args.nr_elfs + 1));
+	elf = &args.elfs[args.nr_elfs++];
+	elf->path = arg;
+	elf->bias = 0;
+
+	/* Paths may have an @ of their own.  */
+	at = strrchr(arg, '@');
+	if (at && at[1]) {
+		uint64_t bias = strtoull(at + 1, &end, 0);
+
+		if (!*end) {
+			*at = 0;
+			elf->bias = bias;
+		}
+	}
+}
+
 static void parse_arguments(int argc, char **argv)
 {
         int c;
@@ -216,11 +356,25 @@ static void parse_arguments(int argc, char **argv)
 			{"coverage-output", required_argument, 0, 'c' },
 			{"gcov-strip", required_argument, 0, 'z' },
 			{"gcov-prefix", required_argument, 0, 'p' },
+			{"jobs",          required_argument, 0, 'j' },
+			{"build-index",   no_argument,       0, 'i' },
+			{"start-time",    required_argument, 0, 'S' },
+			{"end-time",      required_argument, 0, 'E' },
+			{"start-pkg",     required_argument, 0, 'P' },
+			{"count",         required_argument, 0, 'C' },
+			{"follow",        no_argument,       0, 'F' },
+			{"workers",       required_argument, 0, 'W' },
+			{"per-client-coverage", no_argument, 0, 'K' },
+			{"sym-cache",     required_argument, 0, 'Y' },
+			{"full-linemap",  no_argument,       0, 'L' },
+			{"coverage-hits", no_argument,       0, 'H' },
+			{"coverage-db",   required_argument, 0, 'D' },
+			{"merge",         no_argument,       0, 'M' },
 			{0,         0,                 0,  0 }
 		};
 		int option_index = 0;
 
-		c = getopt_long(argc, argv, "bc:t:e:m:g:n:o:x:s:l:w:",
+		c = getopt_long(argc, argv, "bc:t:e:m:g:n:o:x:s:l:w:j:",
 				long_options, &option_index);
 		if (c == -1)
 			break;
@@ -243,7 +397,7 @@ static void parse_arguments(int argc, char **argv)
 			args.trace_output = optarg;
 			break;
 		case 'e':
-			args.elf = optarg;
+			add_elf(optarg);
 			break;
 		case 'l':
 			args.exclude = optarg;
@@ -252,10 +406,12 @@ static void parse_arguments(int argc, char **argv)
 			args.addr2line = optarg;
 			break;
 		case 'w':
-			args.dwarfdump = optarg;
+			fprintf(stderr, "Warning: --dwarfdump is deprecated and "
+				"ignored, line tables are decoded natively.\n");
 			break;
 		case 'n':
-			args.nm = optarg;
+			fprintf(stderr, "Warning: --nm is deprecated and "
+				"ignored, symbols are read with libbfd.\n");
 			break;
 		case 'd':
 			args.objdump = optarg;
@@ -284,12 +440,59 @@ static void parse_arguments(int argc, char **argv)
 		case 'q':
 			args.trace_out_format = map_traceformat(optarg);
 			break;
+		case 'j':
+			args.jobs = parse_jobs(optarg);
+			break;
+		case 'i':
+			args.build_index = true;
+			break;
+		case 'S':
+			args.start_time = parse_u64("start-time", optarg);
+			break;
+		case 'E':
+			args.end_time = parse_u64("end-time", optarg);
+			break;
+		case 'P':
+			args.start_pkg = parse_u64("start-pkg", optarg);
+			break;
+		case 'C':
+			args.count = parse_u64("count", optarg);
+			break;
+		case 'W':
+			args.workers = parse_workers(optarg);
+			break;
+		case 'F':
+			args.follow = true;
+			break;
+		case 'K':
+			args.per_client_coverage = true;
+			break;
+		case 'Y':
+			args.sym_cache = optarg;
+			break;
+		case 'L':
+			args.full_linemap = true;
+			break;
+		case 'H':
+			args.coverage_hits = true;
+			break;
+		case 'D':
+			args.coverage_db = optarg;
+			break;
+		case 'M':
+			args.merge = true;
+			break;
 		default:
 			usage();
 			exit(EXIT_FAILURE);
 			break;
 		}
 	}
+
+	if (args.merge) {
+		args.merge_files = argv + optind;
+		args.nr_merge_files = argc - optind;
+	}
 }
 
 FILE *open_trace_output(const char *outname)
@@ -325,7 +528,23 @@ FILE *open_trace_output(const char *outname)
 
 void validate_arguments(void)
 {
-	if (!args.trace_filename) {
+	if (args.merge) {
+		if (!args.nr_merge_files) {
+			fprintf(stderr, "--merge needs the coverage databases "
+				"or lcov info files to merge\n");
+			exit(EXIT_FAILURE);
+		}
+		if (args.coverage_format == NONE && !args.coverage_db) {
+			fprintf(stderr, "--merge needs --coverage-format or "
+				"--coverage-db\n");
+			exit(EXIT_FAILURE);
+		}
+		if (args.coverage_format == LCOV && !args.coverage_output) {
+			fprintf(stderr, "--merge into lcov needs "
+				"--coverage-output\n");
+			exit(EXIT_FAILURE);
+		}
+	} else if (!args.trace_filename) {
 		fprintf(stderr, "No tracefile selected (--trace)\n");
 		exit(EXIT_FAILURE);
 	}
@@ -339,6 +558,44 @@ void validate_arguments(void)
 		usage();
 		exit(EXIT_FAILURE);
 	}
+	if (args.end_time < args.start_time) {
+		fprintf(stderr, "--end-time is before --start-time\n");
+		exit(EXIT_FAILURE);
+	}
+	if (!args.count) {
+		fprintf(stderr, "--count 0 leaves no pkgs to decode\n");
+		exit(EXIT_FAILURE);
+	}
+	if (args.workers && strcmp(args.trace_output, "none")) {
+		fprintf(stderr, "--workers needs --trace-output none\n");
+		exit(EXIT_FAILURE);
+	}
+	if (args.workers && args.trace_in_format != TRACE_ETRACE) {
+		fprintf(stderr, "--workers only serves etrace streams\n");
+		exit(EXIT_FAILURE);
+	}
+	if (args.coverage_hits
+	    && (args.coverage_format != NONE || !args.merge)
+	    && args.coverage_format != GCOV
+	    && args.coverage_format != QCOV
+	    && args.coverage_format != LCOV) {
+		fprintf(stderr, "--coverage-hits only applies to the gcov, "
+			"qcov and lcov formats\n");
+		exit(EXIT_FAILURE);
+	}
+	if (args.coverage_db
+	    && (!args.nr_elfs
+		|| (args.coverage_format == NONE && !args.merge))) {
+		fprintf(stderr, "--coverage-db needs --elf and "
+			"--coverage-format\n");
+		exit(EXIT_FAILURE);
+	}
+	if (args.per_client_coverage
+	    && (!args.workers || !args.coverage_output)) {
+		fprintf(stderr, "--per-client-coverage needs --workers and "
+			"--coverage-output\n");
+		exit(EXIT_FAILURE);
+	}
 }
 
 sig_atomic_t got_sigint = false;
@@ -357,7 +614,8 @@ void trace_show(int fd, FILE *fp_out,
                  const char *guest_objdump, const char *guest_machine,
                  void **sym_tree, enum cov_format cov_fmt,
                  enum trace_format trace_in_fmt,
-                 enum trace_format trace_out_fmt)
+                 enum trace_format trace_out_fmt,
+                 const struct etrace_opts *etrace_opts)
 {
 	switch (trace_in_fmt) {
 	case TRACE_ETRACE:
@@ -365,7 +623,8 @@ void trace_show(int fd, FILE *fp_out,
 			    objdump, machine,
 			    guest_objdump, guest_machine,
 			    sym_tree, cov_fmt,
-			    trace_in_fmt, trace_out_fmt);
+			    trace_in_fmt, trace_out_fmt,
+			    etrace_opts);
 		break;
 	case TRACE_ASCII_HEX:
 	case TRACE_ASCII_HEX_LE16:
@@ -395,10 +654,44 @@ void trace_show(int fd, FILE *fp_out,
 	}
 }
 
+static void server_serve(int fd, void **store, void *opaque)
+{
+	trace_show(fd, NULL,
+		   args.objdump, args.machine,
+		   args.guest_objdump, args.guest_machine,
+		   store, args.coverage_format,
+		   args.trace_in_format,
+		   args.trace_out_format,
+		   opaque);
+}
+
+static void server_client_done(unsigned int client, void **store,
+			       void *clone, void *opaque)
+{
+	char *name;
+
+	if (!args.per_client_coverage || !clone)
+		return;
+
+	if (asprintf(&name, "%s.%u", args.coverage_output, client) < 0)
+		return;
+
+	sym_store_swap_counters(store, clone);
+	coverage_emit(store, name,
+			args.coverage_format,
+			args.gcov_strip, args.gcov_prefix,
+			args.exclude);
+	sym_store_swap_counters(store, clone);
+	free(name);
+}
+
 int main(int argc, char **argv)
 {
 	FILE *trace_out;
 	void *sym_tree = NULL;
+	struct cov_db cov_db = { 0 };
+	struct etrace_opts etrace_opts;
+	bool session;
 	int fd;
 
 	bfd_init();
@@ -406,14 +699,71 @@ int main(int argc, char **argv)
 	parse_arguments(argc, argv);
 	validate_arguments();
 
-	if (args.elf) {
-		sym_read_from_elf(&sym_tree, args.nm, args.elf);
-		if (args.coverage_format != NONE)
-			sym_build_linemap(&sym_tree, args.dwarfdump, args.elf);
+	if (args.build_index) {
+		bool ok;
+
+		fd = trace_open(args.trace_filename, false);
+		if (fd < 0) {
+			perror(args.trace_filename);
+			exit(EXIT_FAILURE);
+		}
+		ok = etrace_build_index(fd, args.trace_filename);
+		exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
 	}
 
+	etrace_opts.trace_filename = args.trace_filename;
+	etrace_opts.jobs = args.jobs;
+	etrace_opts.start_time = args.start_time;
+	etrace_opts.end_time = args.end_time;
+	etrace_opts.start_pkg = args.start_pkg;
+	etrace_opts.count = args.count;
+	etrace_opts.follow = args.follow;
+	etrace_opts.stop = &got_sigint;
+
+	if (args.nr_elfs)
+		sym_read_from_elfs(&sym_tree, args.elfs, args.nr_elfs,
+				   args.sym_cache,
+				   args.full_linemap
+				   && args.coverage_format != NONE);
+
 	coverage_init(&sym_tree, args.coverage_output, args.coverage_format,
-		args.gcov_strip, args.gcov_prefix);
+		args.gcov_strip, args.gcov_prefix, args.coverage_hits);
+
+	if (args.coverage_db || args.merge) {
+		/* Later runs may emit any format from the database.  */
+		sym_store_set_counters(&sym_tree, args.coverage_hits
+				       ? SYM_CNT_HITS
+				       : SYM_CNT_TIME | SYM_CNT_COV
+					 | SYM_CNT_ENT);
+	}
+	if (args.coverage_db)
+		cov_db_check(&sym_tree, args.coverage_db);
+
+	if (args.merge) {
+		struct cov_merge_opts merge_opts = {
+			.fmt = args.coverage_format,
+			.output = args.coverage_output,
+			.gcov_strip = args.gcov_strip,
+			.gcov_prefix = args.gcov_prefix,
+			.exclude = args.exclude,
+			.hits = args.coverage_hits,
+			.jobs = args.jobs,
+		};
+
+		/* Other runs wait until the merge is saved.  */
+		if (args.coverage_db) {
+			cov_db_lock(&cov_db, args.coverage_db);
+			cov_db_load(&cov_db, &sym_tree, args.coverage_db);
+		}
+		if (!cov_merge(&sym_tree, args.coverage_db ? &cov_db : NULL,
+			       args.merge_files, args.nr_merge_files,
+			       &merge_opts))
+			exit(EXIT_FAILURE);
+		if (args.coverage_db
+		    && !cov_db_save(&cov_db, &sym_tree, args.coverage_db))
+			exit(EXIT_FAILURE);
+		return EXIT_SUCCESS;
+	}
 
 	trace_out = open_trace_output(args.trace_output);
 
@@ -428,6 +778,24 @@ int main(int argc, char **argv)
 		sigaction(SIGINT, &shandler, NULL);
 	}
 
+	/* SIGINT ends --follow, coverage is still written.  */
+	if (args.follow)
+		block_sigint_exit = true;
+
+	if (args.workers) {
+		struct trace_server_ops ops = {
+			.serve = server_serve,
+			.done = server_client_done,
+			.opaque = &etrace_opts,
+		};
+
+		block_sigint_exit = true;
+		if (!trace_server_run(args.trace_filename, args.workers,
+				      &sym_tree, &ops, &got_sigint))
+			exit(EXIT_FAILURE);
+		goto done;
+	}
+
 	do {
 		fd = trace_open(args.trace_filename, false);
 		if (fd < 0) {
@@ -437,11 +805,12 @@ int main(int argc, char **argv)
 			}
 			exit(EXIT_FAILURE);
 		}
-		/* If we are dealing with sockets, we want to handle
-		 * SIGINT synchronously with a post process of the
+		/* If we are dealing with sockets or shm rings, we want to
+		 * handle SIGINT synchronously with a post process of the
 		 * stats prior to exit().
 		 */
-		if (fd >=0 && fd_is_socket(fd)) {
+		session = fd_is_socket(fd) || trace_is_shm(args.trace_filename);
+		if (session) {
 			block_sigint_exit = true;
 		}
 
@@ -450,11 +819,27 @@ int main(int argc, char **argv)
 			   args.guest_objdump, args.guest_machine,
 			   &sym_tree, args.coverage_format,
 			   args.trace_in_format,
-			   args.trace_out_format);
-	} while (fd_is_socket(fd) && !got_sigint && args.server);
+			   args.trace_out_format,
+			   &etrace_opts);
+		close(fd);
+	} while (session && !got_sigint && args.server);
 
+done:
 	sym_show_stats(&sym_tree);
 
+	if (args.coverage_db) {
+		/*
+		 * Loaded only now and under the lock, so that runs sharing
+		 * the database add up rather than overwrite each other.
+		 */
+		cov_db_lock(&cov_db, args.coverage_db);
+		cov_db_load(&cov_db, &sym_tree, args.coverage_db);
+		/* This run.  */
+		cov_db.nr_runs++;
+		if (!cov_db_save(&cov_db, &sym_tree, args.coverage_db))
+			exit(EXIT_FAILURE);
+	}
+
 	if (args.coverage_format != NONE)
 		coverage_emit(&sym_tree, args.coverage_output,
 				args.coverage_format,
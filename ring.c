@@ -0,0 +1,484 @@
+/*
+ * Single producer / single consumer byte ring.
+ *
+ * Copyright: 2026 Xilinx Inc
+ * Written by Edgar E. Iglesias <edgar.iglesias@xilinx.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+
+#include "ring.h"
+
+#define RING_MAGIC 0x52494e47
+#define RING_VERSION 3
+
+/* Max size of each read() done by the reader thread.  */
+#define RING_READ_CHUNK (1024 * 1024)
+
+/* How often a shared ring checks that the other side is still alive.  */
+#define RING_PEER_POLL_NS (100 * 1000 * 1000)
+
+/*
+ * Polls of head before a consumer sleeps, a few us. With the producer
+ * on another CPU the data usually shows up by then, which saves the
+ * futex wait and wake.
+ */
+#define RING_SPIN 4096
+
+static inline void ring_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#else
+	__asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+/* Spinning only helps if the other side can run meanwhile.  */
+static unsigned int ring_spin_count(void)
+{
+	return sysconf(_SC_NPROCESSORS_ONLN) > 1 ? RING_SPIN : 0;
+}
+
+/* Returns false if interrupted by a signal.  */
+static bool ring_futex_wait(struct ring *r, uint32_t *addr, uint32_t val)
+{
+	struct timespec ts = { 0, RING_PEER_POLL_NS };
+	long ret;
+
+	ret = syscall(SYS_futex, addr, FUTEX_WAIT | r->futex_flags, val,
+		      r->shared ? &ts : NULL, NULL, 0);
+	return ret == 0 || errno != EINTR;
+}
+
+/* Has the process on the other side of a shared ring died?  */
+static bool ring_peer_gone(struct ring *r, uint32_t *pidp)
+{
+	pid_t pid;
+
+	if (!r->shared)
+		return false;
+	pid = __atomic_load_n(pidp, __ATOMIC_RELAXED);
+	return pid && kill(pid, 0) < 0 && errno == ESRCH;
+}
+
+static void ring_futex_wake(struct ring *r, uint32_t *addr)
+{
+	__atomic_add_fetch(addr, 1, __ATOMIC_SEQ_CST);
+	syscall(SYS_futex, addr, FUTEX_WAKE | r->futex_flags, INT_MAX,
+		NULL, NULL, 0);
+}
+
+/* Map size bytes at offset off of fd twice, back to back.  */
+static uint8_t *ring_map_data(int fd, off_t off, size_t size)
+{
+	uint8_t *p;
+	void *a, *b;
+
+	p = mmap(NULL, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+		 -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+
+	a = mmap(p, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+		 fd, off);
+	b = mmap(p + size, size, PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_FIXED, fd, off);
+	if (a == MAP_FAILED || b == MAP_FAILED) {
+		munmap(p, size * 2);
+		return NULL;
+	}
+	return p;
+}
+
+bool ring_init(struct ring *r, size_t size)
+{
+	int fd;
+
+	/* Offsets are masked, so we need a power of 2.  */
+	assert((size & (size - 1)) == 0);
+
+	memset(r, 0, sizeof *r);
+	r->size = size;
+	r->min_space = size / 8;
+	r->futex_flags = FUTEX_PRIVATE_FLAG;
+	r->fd = -1;
+	r->spin = ring_spin_count();
+
+	r->ctrl = mmap(NULL, sizeof *r->ctrl, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (r->ctrl == MAP_FAILED) {
+		r->ctrl = NULL;
+		return false;
+	}
+	r->ctrl->magic = RING_MAGIC;
+	r->ctrl->version = RING_VERSION;
+	r->ctrl->size = size;
+
+	fd = memfd_create("etrace-ring", MFD_CLOEXEC);
+	if (fd < 0)
+		goto fail;
+	if (ftruncate(fd, size) < 0) {
+		close(fd);
+		goto fail;
+	}
+	r->buf = ring_map_data(fd, 0, size);
+	/* The mappings keep the memory alive.  */
+	close(fd);
+	if (!r->buf)
+		goto fail;
+	return true;
+
+fail:
+	munmap(r->ctrl, sizeof *r->ctrl);
+	r->ctrl = NULL;
+	return false;
+}
+
+/*
+ * Create the POSIX shm object name holding an empty shared ring with
+ * size bytes of data. Returns an fd for ring_attach or -1.
+ */
+int ring_shm_create(const char *name, size_t size)
+{
+	struct ring_ctrl ctrl;
+	int fd;
+
+	assert((size & (size - 1)) == 0);
+
+	shm_unlink(name);
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return -1;
+	if (ftruncate(fd, RING_SHM_DATA_OFF + size) < 0)
+		goto fail;
+
+	memset(&ctrl, 0, sizeof ctrl);
+	ctrl.magic = RING_MAGIC;
+	ctrl.version = RING_VERSION;
+	ctrl.size = size;
+	ctrl.data_off = RING_SHM_DATA_OFF;
+	if (pwrite(fd, &ctrl, sizeof ctrl, 0) != sizeof ctrl)
+		goto fail;
+	return fd;
+
+fail:
+	close(fd);
+	shm_unlink(name);
+	return -1;
+}
+
+/*
+ * Map the shared ring in fd, as its producer or consumer. Returns false,
+ * without touching fd, if fd doesn't hold a ring.
+ */
+bool ring_attach(struct ring *r, int fd, bool producer)
+{
+	struct ring_ctrl hdr;
+	struct stat st;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)
+	    || st.st_size < sizeof hdr)
+		return false;
+	if (pread(fd, &hdr, sizeof hdr, 0) != sizeof hdr)
+		return false;
+	if (hdr.magic != RING_MAGIC || hdr.version != RING_VERSION
+	    || !hdr.size || (hdr.size & (hdr.size - 1))
+	    || hdr.data_off < sizeof hdr
+	    || st.st_size != hdr.data_off + hdr.size)
+		return false;
+
+	memset(r, 0, sizeof *r);
+	r->size = hdr.size;
+	r->min_space = r->size / 8;
+	r->fd = -1;
+	r->shared = true;
+	r->producer = producer;
+	r->spin = ring_spin_count();
+
+	r->ctrl = mmap(NULL, sizeof *r->ctrl, PROT_READ | PROT_WRITE,
+		       MAP_SHARED, fd, 0);
+	if (r->ctrl == MAP_FAILED) {
+		r->ctrl = NULL;
+		return false;
+	}
+	r->buf = ring_map_data(fd, hdr.data_off, r->size);
+	if (!r->buf) {
+		munmap(r->ctrl, sizeof *r->ctrl);
+		r->ctrl = NULL;
+		return false;
+	}
+
+	if (producer)
+		__atomic_store_n(&r->ctrl->prod_pid, getpid(), __ATOMIC_SEQ_CST);
+	else
+		__atomic_store_n(&r->ctrl->cons_pid, getpid(), __ATOMIC_SEQ_CST);
+	r->cached_head = __atomic_load_n(&r->ctrl->head, __ATOMIC_ACQUIRE);
+	r->cached_tail = __atomic_load_n(&r->ctrl->tail, __ATOMIC_ACQUIRE);
+	return true;
+}
+
+void ring_destroy(struct ring *r)
+{
+	/* Don't leave the other process waiting for us.  */
+	if (r->shared && r->ctrl) {
+		if (r->producer)
+			ring_close(r);
+		else
+			ring_shutdown(r);
+	}
+	if (r->buf)
+		munmap(r->buf, r->size * 2);
+	if (r->ctrl)
+		munmap(r->ctrl, sizeof *r->ctrl);
+	r->buf = NULL;
+	r->ctrl = NULL;
+}
+
+/*
+ * Wait until at least len bytes are available and return a pointer
+ * to them. Returns NULL if the producer closed the ring before that.
+ */
+void *ring_peek(struct ring *r, size_t len)
+{
+	struct ring_ctrl *c = r->ctrl;
+	uint64_t tail = c->tail;
+
+	assert(len <= r->size);
+	while (r->cached_head - tail < len) {
+		unsigned int spin;
+		uint32_t seq;
+		bool eof;
+
+		for (spin = 0; spin <= r->spin; spin++) {
+			r->cached_head = __atomic_load_n(&c->head,
+							 __ATOMIC_ACQUIRE);
+			if (r->cached_head - tail >= len
+			    || __atomic_load_n(&c->eof, __ATOMIC_RELAXED))
+				break;
+			ring_cpu_relax();
+		}
+		if (r->cached_head - tail >= len)
+			break;
+
+		seq = __atomic_load_n(&c->head_seq, __ATOMIC_ACQUIRE);
+		/* The producer only wakes us once len bytes are there.  */
+		__atomic_store_n(&c->cons_wait, len, __ATOMIC_SEQ_CST);
+		eof = __atomic_load_n(&c->eof, __ATOMIC_SEQ_CST)
+		      || ring_peer_gone(r, &c->prod_pid);
+		r->cached_head = __atomic_load_n(&c->head, __ATOMIC_SEQ_CST);
+		if (r->cached_head - tail < len) {
+			if (eof) {
+				__atomic_store_n(&c->cons_wait, 0,
+						 __ATOMIC_RELAXED);
+				return NULL;
+			}
+			/*
+			 * Like a blocking accept(), a signal stops the
+			 * wait for a producer that never showed up.
+			 */
+			if (!ring_futex_wait(r, &c->head_seq, seq)
+			    && r->shared && !c->prod_pid) {
+				__atomic_store_n(&c->cons_wait, 0,
+						 __ATOMIC_RELAXED);
+				return NULL;
+			}
+		}
+		__atomic_store_n(&c->cons_wait, 0, __ATOMIC_RELAXED);
+	}
+	return r->buf + (tail & (r->size - 1));
+}
+
+/* Nr of bytes that ring_peek can return without waiting.  */
+size_t ring_avail(struct ring *r)
+{
+	struct ring_ctrl *c = r->ctrl;
+
+	r->cached_head = __atomic_load_n(&c->head, __ATOMIC_ACQUIRE);
+	return r->cached_head - c->tail;
+}
+
+void ring_consume(struct ring *r, size_t len)
+{
+	struct ring_ctrl *c = r->ctrl;
+	uint64_t tail = c->tail + len;
+	uint64_t head;
+
+	__atomic_store_n(&c->tail, tail, __ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(&c->prod_wait, __ATOMIC_SEQ_CST))
+		return;
+
+	/* Avoid ping-ponging with the producer for every pkg.  */
+	head = __atomic_load_n(&c->head, __ATOMIC_ACQUIRE);
+	if (r->size - (head - tail) >= r->min_space)
+		ring_futex_wake(r, &c->tail_seq);
+}
+
+/* Tell the producer that we won't consume anything more.  */
+void ring_shutdown(struct ring *r)
+{
+	struct ring_ctrl *c = r->ctrl;
+
+	__atomic_store_n(&c->shutdown, 1, __ATOMIC_SEQ_CST);
+	ring_futex_wake(r, &c->tail_seq);
+}
+
+/*
+ * Wait for free space and return a pointer to it. *len is set to the
+ * number of contiguous bytes that may be written. Returns NULL if the
+ * consumer has shut the ring down.
+ */
+void *ring_reserve(struct ring *r, size_t *len)
+{
+	struct ring_ctrl *c = r->ctrl;
+	uint64_t head = c->head;
+
+	r->cached_tail = __atomic_load_n(&c->tail, __ATOMIC_ACQUIRE);
+	while (r->size - (head - r->cached_tail) < r->min_space) {
+		uint32_t seq;
+		bool shutdown;
+
+		seq = __atomic_load_n(&c->tail_seq, __ATOMIC_ACQUIRE);
+		__atomic_store_n(&c->prod_wait, 1, __ATOMIC_SEQ_CST);
+		shutdown = __atomic_load_n(&c->shutdown, __ATOMIC_SEQ_CST)
+			   || ring_peer_gone(r, &c->cons_pid);
+		r->cached_tail = __atomic_load_n(&c->tail, __ATOMIC_SEQ_CST);
+		if (r->size - (head - r->cached_tail) < r->min_space) {
+			if (shutdown) {
+				__atomic_store_n(&c->prod_wait, 0,
+						 __ATOMIC_RELAXED);
+				return NULL;
+			}
+			ring_futex_wait(r, &c->tail_seq, seq);
+		}
+		__atomic_store_n(&c->prod_wait, 0, __ATOMIC_RELAXED);
+	}
+
+	if (__atomic_load_n(&c->shutdown, __ATOMIC_RELAXED))
+		return NULL;
+
+	*len = r->size - (head - r->cached_tail);
+	return r->buf + (head & (r->size - 1));
+}
+
+void ring_commit(struct ring *r, size_t len)
+{
+	struct ring_ctrl *c = r->ctrl;
+	uint64_t head = c->head + len;
+	uint32_t want;
+
+	__atomic_store_n(&c->head, head, __ATOMIC_SEQ_CST);
+	want = __atomic_load_n(&c->cons_wait, __ATOMIC_SEQ_CST);
+	/*
+	 * cached_tail may be behind, which only makes us wake the
+	 * consumer early, never miss it.
+	 */
+	if (want && head - r->cached_tail >= want)
+		ring_futex_wake(r, &c->head_seq);
+}
+
+/* No more data will be produced.  */
+void ring_close(struct ring *r)
+{
+	struct ring_ctrl *c = r->ctrl;
+
+	__atomic_store_n(&c->eof, 1, __ATOMIC_SEQ_CST);
+	ring_futex_wake(r, &c->head_seq);
+}
+
+static void *ring_reader_thread(void *opaque)
+{
+	struct ring *r = opaque;
+	sigset_t set;
+
+	/* Leave signal handling to the decoder thread.  */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	while (1) {
+		size_t len;
+		ssize_t n;
+		void *p;
+
+		p = ring_reserve(r, &len);
+		if (!p)
+			break;
+
+		if (len > RING_READ_CHUNK)
+			len = RING_READ_CHUNK;
+
+		n = read(r->fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n == 0 && r->wait_more && r->wait_more(r->wait_opaque))
+			continue;
+		if (n <= 0) {
+			if (n < 0)
+				perror("read");
+			break;
+		}
+		ring_commit(r, n);
+	}
+	ring_close(r);
+	return NULL;
+}
+
+/* Start a thread that fills the ring from fd until EOF.  */
+bool ring_start_reader(struct ring *r, int fd)
+{
+	int err;
+
+	r->fd = fd;
+	err = pthread_create(&r->reader, NULL, ring_reader_thread, r);
+	if (err) {
+		fprintf(stderr, "pthread_create: %s\n", strerror(err));
+		return false;
+	}
+	r->has_reader = true;
+	return true;
+}
+
+void ring_stop_reader(struct ring *r)
+{
+	if (!r->has_reader)
+		return;
+
+	if (!__atomic_load_n(&r->ctrl->eof, __ATOMIC_ACQUIRE)) {
+		/* The reader may be blocked in read().  */
+		ring_shutdown(r);
+		pthread_cancel(r->reader);
+	}
+	pthread_join(r->reader, NULL);
+	r->has_reader = false;
+}
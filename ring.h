@@ -0,0 +1,114 @@
+/*
+ * Single producer / single consumer byte ring.
+ *
+ * Copyright: 2026 Xilinx Inc
+ * Written by Edgar E. Iglesias <edgar.iglesias@xilinx.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+#ifndef _RING_H
+#define _RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/*
+ * The data area is mapped twice back to back so that any range of up
+ * to size bytes starting anywhere in the ring is virtually contiguous.
+ * The consumer can then hand out pointers to whole pkgs even when they
+ * wrap around the end of the ring.
+ *
+ * head and tail are free running byte counters. Only the producer
+ * writes head and only the consumer writes tail. The side that runs
+ * out of data or space sleeps on a futex and the other side wakes it.
+ */
+struct ring_ctrl {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t size;
+	/* File offset of the data area of a shared ring.  */
+	uint64_t data_off;
+
+	/* Written by the producer.  */
+	uint64_t head __attribute__ ((aligned(64)));
+	uint32_t head_seq;
+	uint32_t prod_wait;
+	uint32_t eof;
+	uint32_t prod_pid;
+
+	/* Written by the consumer.  */
+	uint64_t tail __attribute__ ((aligned(64)));
+	uint32_t tail_seq;
+	/* Nr of bytes a sleeping consumer waits for.  */
+	uint32_t cons_wait;
+	uint32_t shutdown;
+	uint32_t cons_pid;
+};
+
+/*
+ * A shared ring lives in a POSIX shm object or memfd: the ring_ctrl at
+ * offset 0 followed by the data area at RING_SHM_DATA_OFF. Producer and
+ * consumer may be different processes, so futexes are not private and
+ * each side checks that the other is still alive before it sleeps.
+ */
+#define RING_SHM_DATA_OFF (64 * 1024)
+
+struct ring {
+	struct ring_ctrl *ctrl;
+	uint8_t *buf;
+	size_t size;
+	int futex_flags;
+	/* A waiting producer is not woken until this much space is free.  */
+	size_t min_space;
+	/* Polls before a consumer sleeps.  */
+	unsigned int spin;
+
+	/* Local copies of the other sides counter.  */
+	uint64_t cached_head;
+	uint64_t cached_tail;
+
+	/* Optional thread filling the ring from an fd.  */
+	pthread_t reader;
+	bool has_reader;
+	int fd;
+	/* Called by the reader at EOF. Returning true retries the read.  */
+	bool (*wait_more)(void *opaque);
+	void *wait_opaque;
+
+	/* Mapped from a shared ring, and on which side.  */
+	bool shared;
+	bool producer;
+};
+
+bool ring_init(struct ring *r, size_t size);
+void ring_destroy(struct ring *r);
+
+int ring_shm_create(const char *name, size_t size);
+bool ring_attach(struct ring *r, int fd, bool producer);
+
+void *ring_peek(struct ring *r, size_t len);
+size_t ring_avail(struct ring *r);
+void ring_consume(struct ring *r, size_t len);
+void ring_shutdown(struct ring *r);
+
+void *ring_reserve(struct ring *r, size_t *len);
+void ring_commit(struct ring *r, size_t len);
+void ring_close(struct ring *r);
+
+bool ring_start_reader(struct ring *r, int fd);
+void ring_stop_reader(struct ring *r);
+#endif
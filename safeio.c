@@ -23,6 +23,7 @@
  * THE SOFTWARE.
  */
 
+#define _GNU_SOURCE
 #include "safeio.h"
 
 #include <stdio.h>
@@ -88,6 +89,29 @@ safe_write(int fd, const void *wbuf, size_t count)
 	return wlen;
 }
 
+/*
+ * Move up to count bytes from in to out without copying through
+ * user-space. One of them must be a pipe. Stops early at EOF.
+ */
+ssize_t
+safe_splice(int in, int out, size_t count)
+{
+	ssize_t r;
+	size_t slen = 0;
+
+	do {
+		r = splice(in, NULL, out, NULL, count - slen, SPLICE_F_MOVE);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return slen ? slen : -1;
+		}
+		slen += r;
+	} while (slen < count && r);
+
+	return slen;
+}
+
 /* Try to splice if possible.  */
 ssize_t safe_copyfd(int s, off_t off, size_t olen, int d)
 {
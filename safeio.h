@@ -30,6 +30,7 @@
 
 ssize_t safe_read(int fd, void *buf, size_t count);
 ssize_t safe_write(int fd, const void *buf, size_t count);
+ssize_t safe_splice(int in, int out, size_t count);
 ssize_t safe_copyfd(int s, off_t off, size_t len, int d);
 
 #endif
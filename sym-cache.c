@@ -0,0 +1,492 @@
+/*
+ * Cache of the syms and linemaps of ELF files.
+ *
+ * Copyright: 2026 Xilinx Inc
+ * Written by Edgar E. Iglesias <edgar.iglesias@xilinx.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include <bfd.h>
+
+#include "util.h"
+#include "safeio.h"
+#include "syms.h"
+#include "sym-cache.h"
+#include "intern.h"
+
+#define NT_GNU_BUILD_ID	3
+
+static uint32_t note_get32(bfd *abfd, const bfd_byte *p)
+{
+	if (bfd_big_endian(abfd))
+		return (uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+	return (uint32_t) p[3] << 24 | p[2] << 16 | p[1] << 8 | p[0];
+}
+
+/* Returns the build-id of elf in hex or NULL if it has none.  */
+char *sym_cache_build_id(const char *elf)
+{
+	bfd_byte *buf = NULL;
+	char *id = NULL;
+	asection *sec;
+	bfd *abfd;
+
+	abfd = bfd_openr(elf, NULL);
+	if (!abfd)
+		return NULL;
+	if (!bfd_check_format(abfd, bfd_object))
+		goto done;
+
+	sec = bfd_get_section_by_name(abfd, ".note.gnu.build-id");
+	if (!sec || sec->size < 12 || !bfd_malloc_and_get_section(abfd, sec, &buf))
+		goto done;
+
+	{
+		uint32_t namesz = note_get32(abfd, buf);
+		uint32_t descsz = note_get32(abfd, buf + 4);
+		uint32_t type = note_get32(abfd, buf + 8);
+		uint64_t desc = 12 + align_pow2(namesz, 4);
+		uint32_t i;
+
+		if (type != NT_GNU_BUILD_ID || !descsz
+		    || desc + descsz > sec->size)
+			goto done;
+
+		id = safe_malloc(descsz * 2 + 1);
+		for (i = 0; i < descsz; i++)
+			sprintf(id + i * 2, "%02x", buf[desc + i]);
+	}
+done:
+	free(buf);
+	bfd_close(abfd);
+	return id;
+}
+
+/*
+ * Returns the name of the cache file for elf in dir, NULL if elf has
+ * no build-id or dir is none. A NULL dir means the default.
+ */
+char *sym_cache_filename(const char *dir, const char *elf)
+{
+	char *defdir = NULL, *name = NULL, *id;
+	const char *env;
+
+	if (dir && !strcmp(dir, "none"))
+		return NULL;
+
+	id = sym_cache_build_id(elf);
+	if (!id)
+		return NULL;
+
+	if (!dir) {
+		env = getenv("XDG_CACHE_HOME");
+		if (env && *env) {
+			if (asprintf(&defdir, "%s/qemu-etrace", env) < 0)
+				defdir = NULL;
+		} else if ((env = getenv("HOME")) && *env) {
+			/* ~/.cache may not be there yet.  */
+			if (asprintf(&defdir, "%s/.cache", env) >= 0) {
+				mkdir(defdir, 0755);
+				free(defdir);
+			}
+			if (asprintf(&defdir, "%s/.cache/qemu-etrace", env) < 0)
+				defdir = NULL;
+		}
+		dir = defdir;
+	}
+
+	if (dir) {
+		/* It is fine if this fails, saving will tell.  */
+		mkdir(dir, 0755);
+		if (asprintf(&name, "%s/%s", dir, id) < 0)
+			name = NULL;
+	}
+	free(defdir);
+	free(id);
+	return name;
+}
+
+/* The size and mtime of elf, to tell it from others with its build-id.  */
+static bool sym_cache_elf_stat(const char *elf, uint64_t *size,
+			       int64_t *mtime)
+{
+	struct stat st;
+
+	if (stat(elf, &st) < 0)
+		return false;
+	*size = st.st_size;
+	*mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+	return true;
+}
+
+static inline bool sym_cache_str_ok(const struct sym_cache_hdr *hdr,
+				    uint32_t off)
+{
+	return off < hdr->strtab_size;
+}
+
+/*
+ * Load the syms of elf from the cache filename, sorted by address. With
+ * linemap, also their linemaps if the cache has them, *has_linemap
+ * tells. Returns NULL if there is no usable cache.
+ */
+struct sym *sym_cache_load(const char *filename, const char *elf,
+			   bool linemap, unsigned int *nr, bool *has_linemap)
+{
+	const struct sym_cache_hdr *hdr;
+	const struct sym_cache_sym *csyms;
+	const struct sym_cache_loc *clocs;
+	const char *strtab;
+	struct sym *syms;
+	struct stat st;
+	uint64_t len, i, k, elf_size;
+	int64_t elf_mtime;
+	uint32_t last_off = SYM_CACHE_NONE, last_file = 0;
+	void *p;
+	int fd;
+
+	if (!filename || !sym_cache_elf_stat(elf, &elf_size, &elf_mtime))
+		return NULL;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0 || st.st_size < sizeof *hdr) {
+		close(fd);
+		return NULL;
+	}
+
+	len = st.st_size;
+	p = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return NULL;
+
+	hdr = p;
+	if (hdr->magic != SYM_CACHE_MAGIC || hdr->version != SYM_CACHE_VERSION)
+		goto invalid;
+	/* E.g a stripped copy of elf.  */
+	if (hdr->elf_size != elf_size || hdr->elf_mtime != elf_mtime)
+		goto invalid;
+	linemap &= !!(hdr->flags & SYM_CACHE_F_LINEMAP);
+	if (hdr->nr_locs > len
+	    || hdr->nr_syms > len || hdr->strtab_size > len
+	    || len != sizeof *hdr + sizeof csyms[0] * hdr->nr_syms
+			+ sizeof clocs[0] * hdr->nr_locs + hdr->strtab_size
+	    || !hdr->strtab_size)
+		goto invalid;
+
+	csyms = (const void *) (hdr + 1);
+	clocs = (const void *) (csyms + hdr->nr_syms);
+	strtab = (const void *) (clocs + hdr->nr_locs);
+	if (strtab[hdr->strtab_size - 1])
+		goto invalid;
+
+	/* The store relies on sorted syms and the iterators on sorted rows.  */
+	for (i = 0; i < hdr->nr_syms; i++) {
+		const struct sym_cache_sym *cs = &csyms[i];
+		uint64_t nr_words = cs->size / 4 + 1;
+		uint32_t word = 0;
+
+		if (!sym_cache_str_ok(hdr, cs->name) || !strtab[cs->name]
+		    || !cs->size || (i && cs->addr < csyms[i - 1].addr))
+			goto invalid;
+		if (!linemap)
+			continue;
+
+		if ((cs->src_filename != SYM_CACHE_NONE
+		     && !sym_cache_str_ok(hdr, cs->src_filename))
+		    || (uint64_t) cs->locs + cs->nr_locs > hdr->nr_locs)
+			goto invalid;
+		for (k = 0; k < cs->nr_locs; k++) {
+			const struct sym_cache_loc *cl = &clocs[cs->locs + k];
+
+			if (!sym_cache_str_ok(hdr, cl->filename)
+			    || cl->linenr > cs->maxline
+			    || cl->word >= nr_words || cl->word < word)
+				goto invalid;
+			word = cl->word;
+		}
+	}
+
+	fprintf(stderr, "Load symtab from %s\n", filename);
+	syms = safe_mallocz(sizeof syms[0] * (hdr->nr_syms ? hdr->nr_syms : 1));
+	for (i = 0; i < hdr->nr_syms; i++) {
+		const struct sym_cache_sym *cs = &csyms[i];
+		struct sym *sym = &syms[i];
+		struct sym_lines lines = { };
+
+		sym->addr = cs->addr;
+		sym->size = cs->size;
+		sym->name = str_intern(strtab + cs->name);
+		sym->namelen = strlen(sym->name);
+		if (!linemap)
+			continue;
+
+		sym->maxline = cs->maxline;
+		if (cs->src_filename != SYM_CACHE_NONE)
+			sym->src_filename = str_intern(strtab + cs->src_filename);
+
+		for (k = 0; k < cs->nr_locs; k++) {
+			const struct sym_cache_loc *cl = &clocs[cs->locs + k];
+
+			/* Locs of a sym mostly share the filename.  */
+			if (cl->filename != last_off) {
+				last_off = cl->filename;
+				last_file = str_id(str_intern(strtab + last_off));
+			}
+			sym_lines_add(&lines, cl->word, last_file,
+				      cl->linenr, cl->flags, 0);
+		}
+		sym_linemap_set(sym, &lines);
+	}
+
+	fprintf(stderr, "done.\n");
+	*nr = hdr->nr_syms;
+	*has_linemap = linemap;
+	munmap(p, len);
+	return syms;
+
+invalid:
+	fprintf(stderr, "%s: invalid sym cache, ignoring it\n", filename);
+	munmap(p, len);
+	return NULL;
+}
+
+/*
+ * Strings are interned so that each is stored once. Most locs in a row
+ * share the same filename pointer, so that is checked first.
+ */
+struct sym_cache_strtab {
+	char *data;
+	uint64_t size;
+	uint64_t nr_alloc;
+
+	uint32_t *hash;
+	unsigned int hash_size;
+	unsigned int nr;
+
+	const char *last;
+	uint32_t last_off;
+	/* Offsets ran out of bits.  */
+	bool full;
+};
+
+static inline unsigned int sym_cache_str_hash(const char *s)
+{
+	unsigned int h = 2166136261U;
+
+	while (*s)
+		h = (h ^ (unsigned char) *s++) * 16777619U;
+	return h;
+}
+
+static void sym_cache_strtab_rehash(struct sym_cache_strtab *st)
+{
+	unsigned int old_size = st->hash_size, i;
+	uint32_t *old = st->hash;
+
+	st->hash_size = old_size ? old_size * 2 : 1024;
+	st->hash = safe_malloc(sizeof st->hash[0] * st->hash_size);
+	memset(st->hash, 0xff, sizeof st->hash[0] * st->hash_size);
+	for (i = 0; i < old_size; i++) {
+		unsigned int h;
+
+		if (old[i] == SYM_CACHE_NONE)
+			continue;
+		h = sym_cache_str_hash(st->data + old[i]);
+		h &= st->hash_size - 1;
+		while (st->hash[h] != SYM_CACHE_NONE)
+			h = (h + 1) & (st->hash_size - 1);
+		st->hash[h] = old[i];
+	}
+	free(old);
+}
+
+static uint32_t sym_cache_strtab_add(struct sym_cache_strtab *st,
+				     const char *s)
+{
+	unsigned int h;
+	size_t len;
+
+	if (!s)
+		return SYM_CACHE_NONE;
+	if (s == st->last)
+		return st->last_off;
+
+	if (st->nr >= st->hash_size / 2)
+		sym_cache_strtab_rehash(st);
+
+	h = sym_cache_str_hash(s) & (st->hash_size - 1);
+	while (st->hash[h] != SYM_CACHE_NONE) {
+		if (!strcmp(st->data + st->hash[h], s))
+			goto done;
+		h = (h + 1) & (st->hash_size - 1);
+	}
+
+	len = strlen(s) + 1;
+	if (st->size + len >= SYM_CACHE_NONE) {
+		st->full = true;
+		return SYM_CACHE_NONE;
+	}
+	if (st->size + len > st->nr_alloc) {
+		st->nr_alloc = (st->size + len) * 2;
+		st->data = safe_realloc(st->data, st->nr_alloc);
+	}
+	memcpy(st->data + st->size, s, len);
+	st->hash[h] = st->size;
+	st->size += len;
+	st->nr++;
+done:
+	st->last = s;
+	st->last_off = st->hash[h];
+	return st->last_off;
+}
+
+/*
+ * Write the syms of obj, read from elf, with their linemaps if linemap,
+ * to the cache filename. Their addresses are stored without bias. It
+ * goes through a temporary file so that concurrent runs never see a
+ * partial cache.
+ */
+bool sym_cache_save(const char *filename, const char *elf,
+		    struct sym *syms, size_t nr,
+		    unsigned int obj, uint64_t bias, bool linemap)
+{
+	struct sym_cache_strtab st = { 0 };
+	struct sym_cache_hdr hdr = { 0 };
+	struct sym_cache_sym *csyms;
+	struct sym_cache_loc *clocs = NULL;
+	uint64_t nr_locs = 0, elf_size;
+	int64_t elf_mtime;
+	size_t nr_syms = 0, i;
+	char *tmpname;
+	bool ok = false;
+	int fd;
+
+	if (!filename || !sym_cache_elf_stat(elf, &elf_size, &elf_mtime))
+		return false;
+
+	for (i = 0; i < nr; i++) {
+		if (syms[i].obj != obj)
+			continue;
+		nr_syms++;
+		if (linemap && syms[i].linemap)
+			nr_locs += syms[i].linemap->nr;
+	}
+	if (nr_locs >= SYM_CACHE_NONE)
+		return false;
+
+	csyms = safe_mallocz(sizeof csyms[0] * (nr_syms ? nr_syms : 1));
+	clocs = safe_malloc(sizeof clocs[0] * (nr_locs ? nr_locs : 1));
+
+	for (i = 0, nr_syms = 0, nr_locs = 0; i < nr; i++) {
+		struct sym *sym = &syms[i];
+		struct sym_cache_sym *cs = &csyms[nr_syms];
+		struct sym_linemap_iter it;
+		struct sym_src_loc loc;
+
+		if (sym->obj != obj)
+			continue;
+		nr_syms++;
+
+		cs->addr = sym->addr - bias;
+		cs->size = sym->size;
+		cs->name = sym_cache_strtab_add(&st, sym->name);
+		cs->src_filename = sym_cache_strtab_add(&st, sym->src_filename);
+		cs->maxline = sym->maxline;
+		cs->locs = nr_locs;
+		cs->nr_locs = 0;
+		if (!linemap)
+			continue;
+
+		sym_linemap_iter(&it, sym);
+		while (sym_linemap_next(&it, &loc)) {
+			struct sym_cache_loc *cl = &clocs[nr_locs++];
+
+			cl->word = loc.word;
+			cl->filename = sym_cache_strtab_add(&st, loc.filename);
+			cl->linenr = loc.linenr;
+			cl->flags = loc.flags;
+			cs->nr_locs++;
+		}
+	}
+
+	if (st.full)
+		goto out;
+	if (!st.size)
+		sym_cache_strtab_add(&st, "");
+
+	hdr.magic = SYM_CACHE_MAGIC;
+	hdr.version = SYM_CACHE_VERSION;
+	hdr.flags = linemap ? SYM_CACHE_F_LINEMAP : 0;
+	hdr.nr_syms = nr_syms;
+	hdr.nr_locs = nr_locs;
+	hdr.strtab_size = st.size;
+	hdr.elf_size = elf_size;
+	hdr.elf_mtime = elf_mtime;
+
+	if (asprintf(&tmpname, "%s.%d", filename, getpid()) < 0)
+		goto out;
+
+	fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror(tmpname);
+		free(tmpname);
+		goto out;
+	}
+
+	if (safe_write(fd, &hdr, sizeof hdr) != sizeof hdr
+	    || safe_write(fd, csyms, sizeof csyms[0] * nr_syms)
+			!= sizeof csyms[0] * nr_syms
+	    || safe_write(fd, clocs, sizeof clocs[0] * nr_locs)
+			!= sizeof clocs[0] * nr_locs
+	    || safe_write(fd, st.data, st.size) != st.size) {
+		close(fd);
+		goto fail_unlink;
+	}
+	close(fd);
+	if (rename(tmpname, filename) < 0)
+		goto fail_unlink;
+	free(tmpname);
+	ok = true;
+	goto out;
+
+fail_unlink:
+	perror(filename);
+	unlink(tmpname);
+	free(tmpname);
+out:
+	free(st.data);
+	free(st.hash);
+	free(clocs);
+	free(csyms);
+	return ok;
+}
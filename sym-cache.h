@@ -0,0 +1,88 @@
+/*
+ * Cache of the syms and linemaps of ELF files.
+ *
+ * Copyright: 2026 Xilinx Inc
+ * Written by Edgar E. Iglesias <edgar.iglesias@xilinx.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+#ifndef _SYM_CACHE_H
+#define _SYM_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+struct sym;
+
+/*
+ * The syms and linemap of an ELF are cached in <dir>/<build-id>, by
+ * default with dir ~/.cache/qemu-etrace. The file holds the header,
+ * the syms, the locs and a string table. It only holds offsets, so it
+ * can be used straight from a read-only mapping.
+ *
+ * The locs are the rows of the linemaps of all syms, those of a sym
+ * follow each other sorted by word.
+ *
+ * strip keeps the build-id, so the header also records the size and
+ * mtime of the ELF the cache was made from. A cache of another ELF with
+ * the same build-id isn't used.
+ */
+#define SYM_CACHE_MAGIC		0x43535145	/* "EQSC" */
+#define SYM_CACHE_VERSION	3
+#define SYM_CACHE_NONE		UINT32_MAX
+
+/* The linemaps were built.  */
+#define SYM_CACHE_F_LINEMAP	(1 << 0)
+
+struct sym_cache_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t flags;
+	uint32_t nr_syms;
+	uint64_t nr_locs;
+	uint64_t strtab_size;
+	uint64_t elf_size;
+	/* In ns.  */
+	int64_t elf_mtime;
+} __attribute__ ((packed));
+
+struct sym_cache_sym {
+	uint64_t addr;
+	uint64_t size;
+	/* First loc of the linemap and the nr of them.  */
+	uint32_t locs;
+	uint32_t nr_locs;
+	/* Offsets into the string table.  */
+	uint32_t name;
+	uint32_t src_filename;
+	uint32_t maxline;
+} __attribute__ ((packed));
+
+struct sym_cache_loc {
+	uint32_t word;
+	uint32_t filename;
+	uint32_t linenr;
+	uint32_t flags;
+} __attribute__ ((packed));
+
+char *sym_cache_build_id(const char *elf);
+char *sym_cache_filename(const char *dir, const char *elf);
+struct sym *sym_cache_load(const char *filename, const char *elf,
+			   bool linemap, unsigned int *nr, bool *has_linemap);
+bool sym_cache_save(const char *filename, const char *elf,
+		    struct sym *syms, size_t nr,
+		    unsigned int obj, uint64_t bias, bool linemap);
+#endif
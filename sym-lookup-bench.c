@@ -0,0 +1,270 @@
+/*
+ * Micro-benchmark of sym address lookups.
+ *
+ * Copyright: 2026 Xilinx Inc
+ * Written by Edgar E. Iglesias <edgar.iglesias@xilinx.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "util.h"
+#include "syms.h"
+#include "intern.h"
+
+typedef struct sym *(*lookup_fn)(void **store, uint64_t addr);
+
+/*
+ * The last[4] MRU cache that sym_lookup_by_addr used to check before the
+ * index, here in front of the page table, to see what it costs.
+ */
+static struct {
+	uint64_t start, end;
+	struct sym *sym;
+} mru[4];
+
+static struct sym *lookup_mru_pt(void **store, uint64_t addr)
+{
+	struct sym *sym;
+	unsigned int i;
+
+	/* Empty entries have start == end and never match.  */
+	for (i = 0; i < sizeof mru / sizeof mru[0]; i++) {
+		if (addr - mru[i].start < mru[i].end - mru[i].start)
+			return mru[i].sym;
+	}
+
+	sym = sym_lookup_by_addr(store, addr);
+	if (sym) {
+		for (i = sizeof mru / sizeof mru[0] - 1; i > 0; i--)
+			mru[i] = mru[i - 1];
+		mru[0].start = sym->addr;
+		mru[0].end = sym->addr + sym->size;
+		mru[0].sym = sym;
+	}
+	return sym;
+}
+
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bench_run(const char *name, void **store, lookup_fn fn,
+		      const uint64_t *addrs, unsigned int nr_lookups)
+{
+	unsigned int found = 0, i;
+	uint64_t t, ns;
+
+	memset(mru, 0, sizeof mru);
+	t = bench_now();
+	for (i = 0; i < nr_lookups; i++)
+		found += !!fn(store, addrs[i]);
+	ns = bench_now() - t;
+	printf("%-10s %8.2f Mlookups/s (%u found)\n", name,
+	       nr_lookups * 1000.0 / (ns ? ns : 1), found);
+}
+
+/* Where the ELFs of a synthetic store start, and where their syms end.  */
+static const uint64_t bases[] = {
+	0x80000000, 0x555555554000, 0xffffffff81000000,
+};
+#define MAX_ELFS (sizeof bases / sizeof bases[0] - 1)
+
+/*
+ * A synthetic store of nr_syms syms, in nr_elfs ELFs far apart like a
+ * user-space program and a kernel.
+ */
+static struct sym *bench_store(void **store, unsigned int nr_syms,
+			       unsigned int nr_elfs, uint64_t *min,
+			       uint64_t *max, unsigned int *seed)
+{
+	unsigned int i, e = 0;
+	uint64_t addr = 0;
+	struct sym *syms;
+	char name[32];
+
+	syms = safe_mallocz(sizeof syms[0] * nr_syms);
+	for (i = 0; i < nr_syms; i++) {
+		struct sym *sym = &syms[i];
+
+		if (i == (uint64_t) nr_syms * e / nr_elfs) {
+			if (e)
+				max[e - 1] = addr;
+			addr = bases[nr_elfs == 1 ? 0 : e + 1];
+			min[e++] = addr;
+		}
+
+		/* Gaps here and there, like padding and data in .text.  */
+		addr += (rand_r(seed) % 4) * 16;
+		sym->addr = addr;
+		sym->size = 16 + (rand_r(seed) % 1024) * 4;
+		snprintf(name, sizeof name, "sym%u", i);
+		sym->name = str_intern(name);
+		sym->namelen = strlen(name);
+		addr += sym->size;
+	}
+	max[e - 1] = addr;
+	sym_store_create(store, syms, nr_syms);
+	return syms;
+}
+
+static void bench_addrs(uint64_t *addrs, unsigned int nr_lookups,
+			unsigned int nr_elfs, const uint64_t *min,
+			const uint64_t *max, unsigned int *seed)
+{
+	unsigned int i, e;
+
+	for (i = 0; i < nr_lookups; i++) {
+		e = rand_r(seed) % nr_elfs;
+		addrs[i] = min[e] + ((uint64_t) rand_r(seed) << 16
+				     ^ rand_r(seed)) % (max[e] - min[e]);
+	}
+}
+
+/*
+ * Micro-benchmark of address lookups on a synthetic store. Compares a
+ * plain bsearch over the syms with the index, the page table and the
+ * page table behind an MRU cache.
+ */
+static void bench(unsigned int nr_syms, unsigned int nr_elfs,
+		  unsigned int nr_lookups)
+{
+	uint64_t min[MAX_ELFS], max[MAX_ELFS];
+	unsigned int seed = 1, i;
+	uint64_t *addrs;
+	void *store;
+
+	bench_store(&store, nr_syms, nr_elfs, min, max, &seed);
+	addrs = safe_malloc(sizeof addrs[0] * nr_lookups);
+	bench_addrs(addrs, nr_lookups, nr_elfs, min, max, &seed);
+
+	printf("%u syms in %u ELF%s, %u random lookups\n", nr_syms, nr_elfs,
+	       nr_elfs > 1 ? "s" : "", nr_lookups);
+	bench_run("bsearch", &store, sym_lookup_bsearch, addrs, nr_lookups);
+	bench_run("index", &store, sym_lookup_index, addrs, nr_lookups);
+	bench_run("pagetable", &store, sym_lookup_by_addr, addrs, nr_lookups);
+	bench_run("mru+pt", &store, lookup_mru_pt, addrs, nr_lookups);
+
+	/* Traces mostly hop between a few nearby syms.  */
+	for (i = 0; i < nr_lookups; i++) {
+		if (i % 16)
+			addrs[i] = addrs[i - i % 16] + rand_r(&seed) % 256;
+	}
+	printf("%u lookups, 16 at a time within 256 bytes\n", nr_lookups);
+	bench_run("index", &store, sym_lookup_index, addrs, nr_lookups);
+	bench_run("pagetable", &store, sym_lookup_by_addr, addrs, nr_lookups);
+	bench_run("mru+pt", &store, lookup_mru_pt, addrs, nr_lookups);
+
+	free(addrs);
+}
+
+/* The lookups --check holds to the results of the bsearch.  */
+static const struct {
+	const char *name;
+	lookup_fn fn;
+} check_fns[] = {
+	{ "index", sym_lookup_index },
+	{ "pagetable", sym_lookup_by_addr },
+	{ "mru+pt", lookup_mru_pt },
+};
+
+/*
+ * Look up random addresses and the edges of every sym with each of
+ * check_fns and with the bsearch. Returns the nr of lookups that
+ * found another sym.
+ */
+static unsigned int check(unsigned int nr_syms, unsigned int nr_elfs,
+			  unsigned int nr_lookups)
+{
+	uint64_t min[MAX_ELFS], max[MAX_ELFS];
+	unsigned int seed = 1, nr, bad = 0, i, j;
+	struct sym *syms;
+	uint64_t *addrs;
+	void *store;
+
+	syms = bench_store(&store, nr_syms, nr_elfs, min, max, &seed);
+	nr = nr_lookups + nr_syms * 4;
+	addrs = safe_malloc(sizeof addrs[0] * nr);
+	bench_addrs(addrs, nr_lookups, nr_elfs, min, max, &seed);
+	for (i = 0; i < nr_syms; i++) {
+		uint64_t *a = &addrs[nr_lookups + i * 4];
+
+		a[0] = syms[i].addr - 1;
+		a[1] = syms[i].addr;
+		a[2] = syms[i].addr + syms[i].size - 1;
+		a[3] = syms[i].addr + syms[i].size;
+	}
+
+	for (j = 0; j < sizeof check_fns / sizeof check_fns[0]; j++) {
+		unsigned int differ = 0;
+
+		memset(mru, 0, sizeof mru);
+		for (i = 0; i < nr; i++) {
+			differ += check_fns[j].fn(&store, addrs[i])
+				  != sym_lookup_bsearch(&store, addrs[i]);
+		}
+		printf("%u ELF%s: %-10s %u of %u lookups differ\n", nr_elfs,
+		       nr_elfs > 1 ? "s" : "", check_fns[j].name, differ, nr);
+		bad += differ;
+	}
+
+	free(addrs);
+	return bad;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int nr_syms = 150000;
+	unsigned int nr_lookups = 20000000;
+	bool checking = false;
+
+	if (argc > 1 && !strcmp(argv[1], "--check")) {
+		checking = true;
+		nr_lookups = 1000000;
+		argv++;
+		argc--;
+	}
+	if (argc > 1)
+		nr_syms = strtoul(argv[1], NULL, 0);
+	if (argc > 2)
+		nr_lookups = strtoul(argv[2], NULL, 0);
+	if (argc > 3 || !nr_syms || !nr_lookups) {
+		fprintf(stderr, "usage: %s [--check] [nr-syms [nr-lookups]]\n",
+			argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	/* Hold the faster lookups to the results of the plain bsearch.  */
+	if (checking) {
+		if (check(nr_syms, 1, nr_lookups)
+		    + check(nr_syms, 2, nr_lookups))
+			return EXIT_FAILURE;
+		return EXIT_SUCCESS;
+	}
+
+	bench(nr_syms, 1, nr_lookups);
+	/* e.g app@0x555555554000 next to vmlinux.  */
+	bench(nr_syms, 2, nr_lookups);
+	return EXIT_SUCCESS;
+}
@@ -30,18 +30,22 @@
 #include <unistd.h>
 
 #include <sys/types.h>
-#include <sys/wait.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 
 #include <search.h>
+#include <stddef.h>
+#include <elf.h>
+#include <pthread.h>
+#include <bfd.h>
 
-#include "filename.h"
 #include "util.h"
 #include "safeio.h"
 #include "syms.h"
-#include "run.h"
+#include "dwarf.h"
+#include "sym-cache.h"
+#include "intern.h"
 
 #define LOOKUP_STATS 0
 #if LOOKUP_STATS
@@ -50,21 +54,161 @@
 #define LOOKUP_STATSD(x)
 #endif
 
+/*
+ * Address lookup index. struct sym is large, so a bsearch over allsyms
+ * touches a new cache line for every probe. Instead the start addresses
+ * are kept in a dense array in Eytzinger (BFS) order, where the first
+ * levels of the search share a few cache lines and the next ones can be
+ * prefetched. pos maps a slot back to its index in allsyms, start and
+ * end hold the addresses in allsyms order.
+ */
+struct sym_index {
+	uint64_t *eyt;
+	unsigned int *pos;
+	uint64_t *start;
+	uint64_t *end;
+	/* Some sym lies within another, see sym_index_lookup.  */
+	bool overlaps;
+};
+
+/*
+ * Direct lookup table for the pages with syms. Each 4K page maps to the
+ * last sym that starts at or below it and the nr of syms that start
+ * within the page, the sym for an addr is among those. The syms are
+ * split into ranges at gaps of SYM_PT_GAP or more, e.g a kernel and a
+ * user-space program, each range has a table of two levels. Leaves cover
+ * 2MB and only exist where there are syms. Addresses without a leaf use
+ * the index instead.
+ */
+#define SYM_PT_PAGE_BITS	12
+#define SYM_PT_LEAF_BITS	9
+#define SYM_PT_LEAF_SIZE	(1U << SYM_PT_LEAF_BITS)
+/* Bytes of table we are willing to spend.  */
+#define SYM_PT_MAX_SIZE		(16 << 20)
+/* A gap this large costs 4K of directory, larger ones start a new range.  */
+#define SYM_PT_GAP		(1ULL << 30)
+
+struct sym_pt_ent {
+	uint32_t first;
+	uint32_t nr;
+};
+
+struct sym_pt_range {
+	uint64_t base, end;
+	uint64_t nr_dir;
+	struct sym_pt_ent **dir;
+};
+
+struct sym_pt {
+	struct sym_pt_range *ranges;
+	unsigned int nr_ranges;
+};
+
+/*
+ * Memo of the executed TBs. A TB is split into pieces at sym borders
+ * once, repeats of it then only bump the counts of its pieces. The
+ * counts are expanded into the per word counters on sym_store_flush.
+ */
+struct sym_tb_piece {
+	struct sym *sym;
+	unsigned int pos;
+	unsigned int words;
+
+	uint64_t count;
+	uint64_t time;
+	/* Sum of time / words.  */
+	uint64_t quot;
+	/*
+	 * Nr of runs by time % words. Most TBs always take the same time,
+	 * so a single remainder is kept inline until a second one shows up.
+	 */
+	uint64_t nr_rem1;
+	unsigned int rem1;
+	uint64_t *rem;
+};
+
+struct sym_tb {
+	uint64_t start, end;
+	/* SYM_TB_COLD until the TB runs a second time.  */
+	unsigned int nr_pieces;
+	/* Ran again since the last eviction.  */
+	bool ran;
+	struct sym_tb_piece one;
+	/* Only used if the TB covers several syms.  */
+	struct sym_tb_piece *pieces;
+};
+
+#define SYM_TB_COLD	(~0U)
+/* Evict the TBs that didn't run again once the memo holds this many.  */
+#define SYM_TB_MAX	(1U << 16)
+/*
+ * The memo only pays off if TBs run again and again. If fewer of the
+ * last SYM_TB_MAX runs were found in it per TB added, the next runs
+ * are accounted directly, then the memo gets another try. The stretch
+ * of direct runs doubles with every failed try, up to SYM_TB_BYPASS_MAX
+ * times SYM_TB_MAX runs.
+ */
+#define SYM_TB_MIN_REPEATS	4
+#define SYM_TB_BYPASS_MAX	64
+
+struct sym_tb_cache {
+	struct sym_tb *tbs;
+	unsigned int nr;
+	/* Evict once nr gets here, grows with the TBs that run again.  */
+	unsigned int max;
+	/* Runs found in the memo and TBs added to it lately.  */
+	unsigned int nr_found, nr_added;
+	/* Runs left to account directly, and the length of the next stretch.  */
+	uint64_t bypass;
+	unsigned int bypass_len;
+	/*
+	 * Open addressed hash of tbs index + 1, 0 is free. The upper half
+	 * holds more bits of the hash, so that probing rarely has to look
+	 * at the TBs themselves.
+	 */
+	uint64_t *hash;
+	unsigned int hash_size;
+};
+
+/* An ELF mapped into the address space at bias.  */
+struct sym_obj {
+	const char *elf;
+	uint64_t bias;
+	/* Cache file of the ELF, NULL if it isn't cached.  */
+	char *cache;
+	bool has_linemap;
+	/* Compilation units decoded so far, unless has_linemap.  */
+	bool *units_done;
+	unsigned int nr_units;
+};
+
 struct sym_store {
 	uint64_t min, max;
 	/* Binary tree for fast name lookups.  */
 	void *rootp;
 
 	struct sym *allsyms;
+	struct sym_index idx;
+	struct sym_pt pt;
 	struct sym unknown; /* e.g, user-space when profiling the kernel  */
 
-	/* 4 entries seem to do a good job.  */
-	struct sym *last[4];
+	/* The ELFs the syms come from, see sym->obj.  */
+	struct sym_obj *objs;
+	unsigned int nr_objs;
+	/* Decode all units of an ELF rather than those that ran.  */
+	bool full_linemap;
+	/* The counter sets kept, see enum sym_cnt_flags.  */
+	unsigned int cnt_flags;
+
+	/* Private counters, indexed like allsyms, if this is a clone.  */
+	struct sym_counters *cnt;
+	struct sym_tb_cache tbc;
+
 
 	unsigned int nr_stored;
 
 	unsigned int nr_flush;
-	unsigned int hits_l[3];
+	unsigned int hits;
 	unsigned int misses;
 };
 
@@ -77,14 +221,11 @@ void sym_show(const char *prefix, const struct sym *s)
 void sym_show_stats(void **store)
 {
 	struct sym_store *ss = *store;
-	unsigned int i;
 
 	if (!LOOKUP_STATS)
 		return;
 
-	for (i = 0; i < sizeof ss->hits_l / sizeof ss->hits_l[0]; i++) {
-		printf("l%u hits %u\n", i, ss->hits_l[i]);
-	}
+	printf("hits %u\n", ss->hits);
 	printf("misses %u\n", ss->misses);
 	printf("flushes %u\n", ss->nr_flush);
 	printf("nr_stored %u\n", ss->nr_stored);
@@ -156,29 +297,6 @@ int sym_compare(const void *pa, const void *pb)
 	return r;
 }
 
-static inline void sym_push_last(struct sym_store *ss, struct sym *sym)
-{
-	unsigned int i;
-	for (i = (sizeof ss->last / sizeof ss->last[0]) - 1; i > 0; i--) {
-		ss->last[i] = ss->last[i - 1];
-	}
-	ss->last[0] = sym;
-}
-
-static struct sym *sym_last_lookup(struct sym_store *ss, uint64_t addr)
-{
-	int i;
-
-	for (i = 0; i < (sizeof ss->last / sizeof ss->last[0]); i++) {
-		if (!ss->last[i])
-			break;
-		if (sym_find(&addr, ss->last[i]) == 0) {
-			return ss->last[i];
-		}
-	}
-	return NULL;
-}
-
 struct sym *sym_get_unknown(void **store)
 {
 	struct sym_store *ss = *store;
@@ -194,394 +312,1787 @@ struct sym *sym_lookup_by_name(void **store, const char *name)
 	struct sym search;
 
 	memset(&search, 0, sizeof search);
-	search.namelen = strlen(name);
 	assert(name);
+	search.name = name;
+	search.namelen = strlen(name);
 	assert(search.namelen > 0);
-	memcpy(&search.name[0], name, search.namelen + 1);
 	s = tfind(&search, &ss->rootp, sym_str_compare);
 	return s ? *s : NULL;
 }
 
-struct sym *sym_lookup_by_addr(void **store, uint64_t addr)
+static unsigned int sym_index_fill(struct sym_store *ss, unsigned int i,
+				   unsigned int k)
 {
-	struct sym_store *ss = *store;
-	struct sym *symp;
-
-	if (addr < ss->min || addr >= ss->max) {
-		return NULL;
+	if (k <= ss->nr_stored) {
+		i = sym_index_fill(ss, i, 2 * k);
+		ss->idx.eyt[k] = ss->allsyms[i].addr;
+		ss->idx.pos[k] = i++;
+		i = sym_index_fill(ss, i, 2 * k + 1);
 	}
+	return i;
+}
 
-	symp = sym_last_lookup(ss, addr);
-	if (symp) {
-		LOOKUP_STATSD(ss->hits_l[0]++);
-		return symp;
+/* Build the lookup index over the sorted allsyms.  */
+static void sym_index_build(struct sym_store *ss)
+{
+	struct sym_index *ix = &ss->idx;
+	unsigned int i;
+
+	/* Slot 0 is unused, the tree starts at 1.  */
+	ix->eyt = safe_malloc(sizeof ix->eyt[0] * (ss->nr_stored + 1));
+	ix->pos = safe_malloc(sizeof ix->pos[0] * (ss->nr_stored + 1));
+	ix->start = safe_malloc(sizeof ix->start[0] * (ss->nr_stored + 1));
+	ix->end = safe_malloc(sizeof ix->end[0] * (ss->nr_stored + 1));
+	sym_index_fill(ss, 0, 1);
+
+	ix->overlaps = false;
+	for (i = 0; i < ss->nr_stored; i++) {
+		ix->start[i] = ss->allsyms[i].addr;
+		ix->end[i] = ss->allsyms[i].addr + ss->allsyms[i].size;
+		if (i && ss->allsyms[i].addr < ix->end[i - 1])
+			ix->overlaps = true;
 	}
+}
 
-	symp = bsearch(&addr, ss->allsyms,
-                    ss->nr_stored, sizeof ss->allsyms[0], sym_find);
-	if (symp) {
-		sym_push_last(ss, symp);
-		LOOKUP_STATSD(ss->hits_l[2]++);
-		return symp;
+/*
+ * Find the last sym that starts at or below addr. The descent has no
+ * data dependent branches, it ends in the slot of the first start above
+ * addr, or 0 if there is none.
+ */
+static struct sym *sym_index_lookup(struct sym_store *ss, uint64_t addr)
+{
+	const struct sym_index *ix = &ss->idx;
+	unsigned int n = ss->nr_stored;
+	unsigned int k = 1, i;
+
+	while (k <= n) {
+		/* 8 starts per cache line, fetch 3 levels ahead.  */
+		__builtin_prefetch(ix->eyt + 8 * (uint64_t) k);
+		k = 2 * k + (ix->eyt[k] <= addr);
 	}
+	k >>= __builtin_ffs(~k);
 
-	LOOKUP_STATSD(ss->misses++);
+	i = k ? ix->pos[k] : n;
+	if (i == 0)
+		return NULL;
+	i--;
+
+	if (addr < ix->end[i])
+		return &ss->allsyms[i];
+
+	/* addr may still be inside an enclosing sym.  */
+	if (ix->overlaps)
+		return bsearch(&addr, ss->allsyms, ss->nr_stored,
+			       sizeof ss->allsyms[0], sym_find);
 	return NULL;
 }
 
-static void sym_alloc_cov(struct sym *sym)
+static void sym_pt_fill_leaf(struct sym_store *ss, struct sym_pt_range *r,
+			     uint64_t d, unsigned int *i)
 {
-	unsigned int nr_entries = sym->size / 4 + 1;
-	sym->cov = safe_mallocz(sizeof sym->cov->counter[0] * nr_entries);
-	sym->cov_ent = safe_mallocz(sizeof sym->cov_ent->counter[0] * nr_entries);
+	const struct sym_index *ix = &ss->idx;
+	struct sym_pt_ent *leaf = r->dir[d];
+	unsigned int p, j, n = ss->nr_stored;
+
+	for (p = 0; p < SYM_PT_LEAF_SIZE; p++) {
+		uint64_t page = r->base
+			+ ((d * SYM_PT_LEAF_SIZE + p) << SYM_PT_PAGE_BITS);
+		uint64_t page_end = page + (1 << SYM_PT_PAGE_BITS);
+
+		/* The part of the first page below the range maps to the
+		   sym before the range, which ends far below it. Below the
+		   first range there is nothing to look up.  */
+		while (*i + 1 < n && ix->start[*i + 1] <= page)
+			(*i)++;
+
+		for (j = *i + 1; j < n && ix->start[j] < page_end; j++)
+			;
+		leaf[p].first = *i;
+		leaf[p].nr = j - *i - 1;
+	}
 }
 
-static void sym_alloc_linemap(struct sym *sym)
+/*
+ * Build the table of the syms [first, last], the leaves as far as
+ * *size stays within budget. Returns false if not even the directory
+ * fits.
+ */
+static bool sym_pt_build_range(struct sym_store *ss, struct sym_pt_range *r,
+			       unsigned int first, unsigned int last,
+			       uint64_t end, size_t *size)
 {
-	unsigned int nr_entries = sym->size / 4 + 1;
-	sym->linemap = safe_mallocz(sizeof sym->linemap->locs[0] * nr_entries);
+	const struct sym_index *ix = &ss->idx;
+	unsigned int leaf_shift = SYM_PT_PAGE_BITS + SYM_PT_LEAF_BITS;
+	size_t leaf_size = sizeof r->dir[0][0] * SYM_PT_LEAF_SIZE;
+	/* From the sym before the range, see sym_pt_fill_leaf.  */
+	unsigned int i, j = first ? first - 1 : 0;
+	uint64_t d;
+
+	r->base = ix->start[first] & ~((1ULL << SYM_PT_PAGE_BITS) - 1);
+	r->end = end;
+	r->nr_dir = ((end - 1 - r->base) >> leaf_shift) + 1;
+	if (r->nr_dir > (SYM_PT_MAX_SIZE - *size) / sizeof r->dir[0])
+		return false;
+	*size += sizeof r->dir[0] * r->nr_dir;
+	r->dir = safe_mallocz(sizeof r->dir[0] * r->nr_dir);
+
+	/* A leaf for every 2MB that some sym overlaps, within budget.  */
+	for (i = first; i <= last; i++) {
+		uint64_t lo = (ix->start[i] - r->base) >> leaf_shift;
+		uint64_t hi = (ix->end[i] - 1 - r->base) >> leaf_shift;
+
+		for (d = lo; d <= hi; d++) {
+			if (r->dir[d])
+				continue;
+			if (*size + leaf_size > SYM_PT_MAX_SIZE)
+				return true;
+			r->dir[d] = safe_malloc(leaf_size);
+			*size += leaf_size;
+			sym_pt_fill_leaf(ss, r, d, &j);
+		}
+	}
+	return true;
 }
 
-void sym_update_cov(struct sym *sym, uint64_t start, uint64_t end,
-			uint32_t time)
+/* Build the page tables of the ranges, as many as fit the budget.  */
+static void sym_pt_build(struct sym_store *ss)
 {
-	int64_t start_offset = start - sym->addr;
-	int64_t len = end - start;
-	unsigned int i, pos;
-	unsigned int time_per_word;
-	unsigned int words, accounted = 0;
-
-	/* Is this the unknown sym ?? */
-	if (sym->namelen == 0)
+	const struct sym_index *ix = &ss->idx;
+	struct sym_pt *pt = &ss->pt;
+	unsigned int i, first, nr = 1;
+	uint64_t end;
+	size_t size = 0;
+
+	memset(pt, 0, sizeof *pt);
+	if (!ss->nr_stored)
 		return;
 
-	assert(start_offset >= 0);
-	assert(start_offset + len <= sym->size);
+	end = ix->end[0];
+	for (i = 1; i < ss->nr_stored; i++) {
+		if (ix->start[i] >= end && ix->start[i] - end >= SYM_PT_GAP)
+			nr++;
+		if (ix->end[i] > end)
+			end = ix->end[i];
+	}
+	pt->ranges = safe_mallocz(sizeof pt->ranges[0] * nr);
 
-	sym->total_time += time;
+	first = 0;
+	end = ix->end[0];
+	for (i = 1; i <= ss->nr_stored; i++) {
+		struct sym_pt_range *r = &pt->ranges[pt->nr_ranges];
 
-	if (!sym->cov)
-		sym_alloc_cov(sym);
+		if (i < ss->nr_stored
+		    && (ix->start[i] < end || ix->start[i] - end < SYM_PT_GAP)) {
+			if (ix->end[i] > end)
+				end = ix->end[i];
+			continue;
+		}
 
-	words = len / 4;
-	if (words == 0)
-		return;
+		/* Ranges too wide for the budget go through the index.  */
+		if (sym_pt_build_range(ss, r, first, i - 1, end, &size))
+			pt->nr_ranges++;
+		if (i < ss->nr_stored) {
+			first = i;
+			end = ix->end[i];
+		}
+	}
+}
 
-	time_per_word = time / (words == 0 ? 1 : words);
-	if (time_per_word == 0 && time != 0)
-		time_per_word = 1;
+static struct sym *sym_pt_lookup(struct sym_store *ss, uint64_t addr)
+{
+	const struct sym_index *ix = &ss->idx;
+	const struct sym_pt_range *r = ss->pt.ranges;
+	const struct sym_pt_range *r_end = r + ss->pt.nr_ranges;
+	const struct sym_pt_ent *e;
+	uint64_t page, d;
+	unsigned int i, nr;
+
+	/* There are only a few ranges, one per far apart group of ELFs.  */
+	while (r < r_end && addr - r->base >= r->end - r->base)
+		r++;
+	if (r == r_end)
+		return sym_index_lookup(ss, addr);
+
+	page = (addr - r->base) >> SYM_PT_PAGE_BITS;
+	d = page >> SYM_PT_LEAF_BITS;
+	if (!r->dir[d])
+		return sym_index_lookup(ss, addr);
+
+	e = &r->dir[d][page & (SYM_PT_LEAF_SIZE - 1)];
+	i = e->first;
+	nr = e->nr;
+
+	/* Branchless search among the syms starting within the page.  */
+	while (nr) {
+		unsigned int half = (nr + 1) / 2;
+
+		i = ix->start[i + half] <= addr ? i + half : i;
+		nr -= half;
+	}
 
-	pos = start_offset / 4;
+	if (addr < ix->end[i])
+		return &ss->allsyms[i];
+	if (ix->overlaps)
+		return sym_index_lookup(ss, addr);
+	return NULL;
+}
 
-	/* First update the nr entries.  */
-	i = 0;
-	do {
-		sym->cov_ent->counter[pos + i] += 1;
-		i++;
-	} while (i < words);
+/*
+ * The slower lookup paths on their own, for sym-lookup-bench to compare
+ * with sym_lookup_by_addr.
+ */
+struct sym *sym_lookup_bsearch(void **store, uint64_t addr)
+{
+	struct sym_store *ss = *store;
 
-repass:
-	i = 0;
-	do {
-		sym->cov->counter[pos + i] += time_per_word;
-		accounted += time_per_word;
-		if (accounted >= time) {
-			break;
-		}
-		i++;
-	} while (i < words);
+	return bsearch(&addr, ss->allsyms, ss->nr_stored,
+		       sizeof ss->allsyms[0], sym_find);
+}
+
+struct sym *sym_lookup_index(void **store, uint64_t addr)
+{
+	return sym_index_lookup(*store, addr);
+}
+
+struct sym *sym_lookup_by_addr(void **store, uint64_t addr)
+{
+	struct sym_store *ss = *store;
+	struct sym *symp;
 
-	/* FIXME: spread the granularity error evenly.  */
-	if (accounted < time) {
-		time_per_word = 1;
-		goto repass;
+	if (addr < ss->min || addr >= ss->max) {
+		return NULL;
 	}
 
-#if 0
-	if (accounted != time)
-		printf("WRONG COVERAGE accounted=%lu time=%lu tpw=%u words=%u\n",
-			accounted, time, time_per_word, words);
-#endif
-	assert (accounted == time);
+	symp = sym_pt_lookup(ss, addr);
+	if (symp) {
+		LOOKUP_STATSD(ss->hits++);
+		return symp;
+	}
+
+	LOOKUP_STATSD(ss->misses++);
+	return NULL;
 }
 
-void sym_build_linemap(void **store, const char *dwarfdump, const char *elf)
+static inline unsigned int sym_cov_nr_chunks(unsigned int nr)
 {
-	char *od_argv[] = { (char *) dwarfdump, "-l", (char *) elf, NULL };
-	char tmpout_template[] = "/tmp/etrace-dd-out-XXXXXX";
-    unsigned int num_lines = 0;
-	int stdio[3] = {0, 1, 2};
-	int fdout_tmp;
-	struct sym *symp = NULL;
-	char *filename = NULL;
-	uint64_t addr = 0;
-	int pipefd[2];
-	FILE *fp;
-	int r;
-	pid_t wpid;
-	pid_t kid;
+	return (nr + SYM_COV_CHUNK - 1) >> SYM_COV_CHUNK_SHIFT;
+}
 
-	fprintf(stderr, "Building linemap\n");
+/* The chunk directory for nr words, the chunks come on first use.  */
+static struct sym_coverage *sym_cov_alloc(unsigned int nr)
+{
+	struct sym_coverage *c;
 
-	r = pipe(pipefd);
-	if (r < 0) {
-		perror("mkstemp");
-		exit(1);
-	}
-	fcntl(pipefd[1], F_SETFD, FD_CLOEXEC);
+	c = safe_mallocz(sizeof *c + sizeof c->chunks[0]
+			 * sym_cov_nr_chunks(nr));
+	c->nr = nr;
+	return c;
+}
 
-	fdout_tmp = mkstemp(tmpout_template);
-	if (fdout_tmp < 0) {
-		perror("mkstemp");
-		exit(1);
+/* The chunk with word in it, allocated if it's new.  */
+static inline uint64_t *sym_cov_chunk(struct sym_coverage *c,
+				      unsigned int word)
+{
+	unsigned int i = word >> SYM_COV_CHUNK_SHIFT;
+
+	if (!c->chunks[i]) {
+		unsigned int n = c->nr - (i << SYM_COV_CHUNK_SHIFT);
+
+		/* The last chunk, or the only one of most syms, is short.  */
+		if (n > SYM_COV_CHUNK)
+			n = SYM_COV_CHUNK;
+		c->chunks[i] = safe_mallocz(sizeof c->chunks[i][0] * n);
 	}
-	unlink(tmpout_template);
+	return c->chunks[i];
+}
 
-	stdio[0] = pipefd[0];
-	stdio[1] = fdout_tmp;
-	kid = run(od_argv[0], od_argv, stdio);
+/* Allocate the per word counters the store keeps, once sym runs.  */
+static inline void sym_alloc_cov(struct sym_store *ss, struct sym *sym,
+				 struct sym_counters *cnt)
+{
+	unsigned int nr_entries = sym->size / 4 + 1;
 
-	close(pipefd[0]);
-	close(pipefd[1]);
+	if ((ss->cnt_flags & SYM_CNT_COV) && !cnt->cov)
+		cnt->cov = sym_cov_alloc(nr_entries);
+	if ((ss->cnt_flags & SYM_CNT_ENT) && !cnt->cov_ent)
+		cnt->cov_ent = sym_cov_alloc(nr_entries);
+	if ((ss->cnt_flags & SYM_CNT_HITS) && !cnt->hits)
+		cnt->hits = safe_mallocz(sizeof cnt->hits[0]
+					 * ((nr_entries + 63) / 64));
+}
 
-	wpid = waitpid(kid, NULL, 0);
-	if (wpid != kid) {
-		perror("wait");
-		exit(1);
-	}
+void sym_lines_add(struct sym_lines *ls, uint32_t word, uint32_t file,
+		   unsigned int linenr, uint32_t flags, uint32_t unit)
+{
+	struct sym_line *l;
 
-	lseek(fdout_tmp, 0, SEEK_SET);
-	fp = fdopen(fdout_tmp, "r");
-	if (!fp) {
-		fprintf(stderr, "No linemap\n");
-		exit(1);
+	if (ls->nr == ls->nr_alloc) {
+		ls->nr_alloc = ls->nr_alloc ? ls->nr_alloc * 2 : 8;
+		ls->l = safe_realloc(ls->l, sizeof ls->l[0] * ls->nr_alloc);
 	}
-	while (!feof(fp)) {
-		char line[512];
-		char *s, *next;
-		unsigned int linenr;
-		bool inlined = false;
+	l = &ls->l[ls->nr++];
+	l->word = word;
+	l->file = file;
+	l->linenr = linenr;
+	l->flags = flags;
+	l->unit = unit;
+}
 
-		s = fgets(line, sizeof line, fp);
-		if (s == NULL) {
-			break;
-		}
-		//printf("%s", line);
+/*
+ * A packed row starts with a tag byte: the loc flags in bits 0 - 1,
+ * bit 2 if the file changes and the word delta in bits 3 - 7, or 31
+ * if it follows as a uleb128. Then the uleb128 file index if it
+ * changed and the line delta, zig-zag encoded.
+ */
+#define SYM_ROW_FLAGS		3
+#define SYM_ROW_FILE		(1 << 2)
+#define SYM_ROW_WORD_SHIFT	3
+#define SYM_ROW_WORD_MAX	31
 
-		if (strncmp(s, "0x", strlen("0x"))) {
-			continue;
-		}
-		addr = strtoull(s, &next, 16);
-		s = next + 2;
+static uint8_t *sym_row_put_uleb(uint8_t *p, uint64_t v)
+{
+	while (v >= 0x80) {
+		*p++ = v | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
 
-		if (*s != '[')
-			continue;
-		s++;
+static inline uint64_t sym_row_get_uleb(const uint8_t **pp)
+{
+	const uint8_t *p = *pp;
+	uint64_t v = 0;
+	unsigned int shift = 0;
 
-		while (*s && isspace(*s))
-			s++;
+	do {
+		v |= (uint64_t) (*p & 0x7f) << shift;
+		shift += 7;
+	} while (*p++ & 0x80 && shift < 64);
+	*pp = p;
+	return v;
+}
 
-		if (!*s)
-			continue;
+/*
+ * Rows sort by word, then by the unit they came from. Units are decoded
+ * in any order by the dwarf workers, this keeps the linemap the same
+ * from run to run. The rows of a unit keep the order of its line
+ * program, a stable sort is needed.
+ */
+static int sym_line_compare(const struct sym_line *a, const struct sym_line *b)
+{
+	if (a->word != b->word)
+		return a->word < b->word ? -1 : 1;
+	if (a->unit != b->unit)
+		return a->unit < b->unit ? -1 : 1;
+	return 0;
+}
 
-		linenr = strtoull(s, &next, 0);
+/*
+ * Stable bottom-up merge sort of the rows by sym_line_compare. Rows
+ * mostly come in order already, then it is a single pass.
+ */
+static void sym_lines_sort(struct sym_lines *ls)
+{
+	struct sym_line *src = ls->l, *dst, *t;
+	unsigned int n = ls->nr, w, i, a, b, lo, mid, hi, k;
 
-		while (*s && *s != ']')
-			s++;
+	for (i = 1; i < n; i++) {
+		if (sym_line_compare(&src[i - 1], &src[i]) > 0)
+			break;
+	}
+	if (i >= n)
+		return;
 
-		if (!*s) {
-			continue;
+	dst = safe_malloc(sizeof dst[0] * n);
+	for (w = 1; w < n; w *= 2) {
+		for (lo = 0; lo < n; lo += 2 * w) {
+			mid = lo + w < n ? lo + w : n;
+			hi = mid + w < n ? mid + w : n;
+			/* Ties take the left row first, that keeps it stable.  */
+			for (a = lo, b = mid, k = lo; k < hi; k++) {
+				if (b == hi || (a < mid
+				    && sym_line_compare(&src[a], &src[b]) <= 0))
+					dst[k] = src[a++];
+				else
+					dst[k] = src[b++];
+			}
 		}
+		t = src;
+		src = dst;
+		dst = t;
+	}
+	/* src holds the sorted rows, keep whichever buffer that is.  */
+	free(dst);
+	ls->l = src;
+	ls->nr_alloc = n;
+}
 
-		/* Advance "] NS" */
-		s += 2;
+/*
+ * Pack the rows in ls, together with the rows sym has already, into
+ * the linemap of sym. Frees the rows of ls.
+ */
+void sym_linemap_set(struct sym *sym, struct sym_lines *ls)
+{
+	struct sym_linemap_iter it;
+	struct sym_linemap *lm;
+	struct sym_src_loc loc;
+	struct sym_line *l;
+	uint32_t *files = NULL, prev_file = 0;
+	unsigned int nr_files = 0, i;
+	uint64_t prev_linenr = 0;
+	uint32_t prev_word = 0;
+	uint8_t *buf, *p;
+
+	if (!ls->nr)
+		return;
 
-#define STR_URI "uri: "
-		s = strstr(s, STR_URI);
-		if (s) {
-			s += strlen(STR_URI) + 1;
-			filename = strndup(s, strlen(s) - 2);
-		}
+	/* Rows from earlier units go first, as if appended to.  */
+	if (sym->linemap) {
+		struct sym_lines all = { };
+
+		sym_linemap_iter(&it, sym);
+		while (sym_linemap_next(&it, &loc))
+			sym_lines_add(&all, loc.word, loc.file,
+				      loc.linenr, loc.flags, 0);
+		for (i = 0; i < ls->nr; i++)
+			sym_lines_add(&all, ls->l[i].word, ls->l[i].file,
+				      ls->l[i].linenr, ls->l[i].flags,
+				      ls->l[i].unit);
+		free(ls->l);
+		*ls = all;
+		free(sym->linemap);
+		sym->linemap = NULL;
+	}
 
-		assert(linenr);
+	sym_lines_sort(ls);
 
-		symp = sym_lookup_by_addr(store, addr);
-		if (symp) {
-			struct sym_src_loc *loc;
-			uint64_t offset;
+	/* Each row takes at most a tag and three uleb128s.  */
+	buf = safe_malloc((size_t) ls->nr * (1 + 5 + 5 + 10));
+	p = buf;
+	for (i = 0; i < ls->nr; i++) {
+		uint32_t delta, f;
+		int64_t ldelta;
+		uint8_t *tag = p++;
 
-			/* FIXME add a str store to reuse these.  */
-			if (!symp->src_filename)
-				symp->src_filename = filename_sanitize(filename);
+		l = &ls->l[i];
+		for (f = 0; f < nr_files; f++) {
+			if (files[f] == l->file)
+				break;
+		}
+		if (f == nr_files) {
+			files = safe_realloc(files,
+					     sizeof files[0] * (nr_files + 1));
+			files[nr_files++] = l->file;
+		}
 
-			if (!symp->linemap)
-				sym_alloc_linemap(symp);
+		delta = l->word - prev_word;
+		*tag = l->flags & SYM_ROW_FLAGS;
+		if (delta >= SYM_ROW_WORD_MAX) {
+			*tag |= SYM_ROW_WORD_MAX << SYM_ROW_WORD_SHIFT;
+			p = sym_row_put_uleb(p, delta - SYM_ROW_WORD_MAX);
+		} else {
+			*tag |= delta << SYM_ROW_WORD_SHIFT;
+		}
+		if (f != prev_file) {
+			*tag |= SYM_ROW_FILE;
+			p = sym_row_put_uleb(p, f);
+		}
+		ldelta = (int64_t) l->linenr - (int64_t) prev_linenr;
+		p = sym_row_put_uleb(p, ((uint64_t) ldelta << 1)
+					^ (uint64_t) (ldelta >> 63));
 
-			if (linenr >= symp->maxline) {
-				symp->maxline = linenr;
-			}
+		prev_word = l->word;
+		prev_file = f;
+		prev_linenr = l->linenr;
+	}
 
-			offset = addr - symp->addr;
-			offset /= 4;
-
-			loc = &symp->linemap->locs[offset];
-			if (loc->filename) {
-				while (loc->next) {
-					loc = loc->next;
-				}
-				loc->next = safe_mallocz(sizeof *loc);
-				loc = loc->next;
-				loc->next = NULL;
-			}
+	lm = safe_malloc(sizeof *lm + sizeof lm->files[0] * nr_files
+			 + (p - buf));
+	lm->nr = ls->nr;
+	lm->len = p - buf;
+	lm->nr_files = nr_files;
+	memcpy(lm->files, files, sizeof files[0] * nr_files);
+	memcpy(lm->files + nr_files, buf, p - buf);
+	sym->linemap = lm;
+
+	free(files);
+	free(buf);
+	free(ls->l);
+	memset(ls, 0, sizeof *ls);
+}
 
-			if (strcmp(filename, symp->src_filename) == 0)
-				loc->filename = symp->src_filename;
-			else
-				loc->filename = filename_sanitize(filename);
-			loc->linenr = linenr;
-			if (inlined)
-				loc->flags |= LOC_F_INLINED;
-            num_lines++;
-#if 0
-			//			if (!strcmp("bdi_has_dirty_io", symp->name))
-			printf("%s:%p addr=%lx %s:%d flags=%x\n",
-					symp->name, loc, addr, loc->filename, loc->linenr, loc->flags);
-
-			if (0)
-			{
-				loc = &symp->linemap->locs[offset];
-				do {
-					printf("%x: symp=%p %p %s:%u\n", offset, symp, loc, loc->filename, loc->linenr); 
-					loc = loc->next;
-				} while (loc);
-			}
-#endif
-		}
-	}
+void sym_linemap_iter(struct sym_linemap_iter *it, const struct sym *sym)
+{
+	const struct sym_linemap *lm = sym->linemap;
 
-	fclose(fp);
-	if (!num_lines) {
-		fprintf(stderr, "WARNING: Unable to create linemap\n");
-	}
-	fprintf(stderr, "done.\n");
+	memset(it, 0, sizeof *it);
+	if (!lm)
+		return;
+
+	it->lm = lm;
+	it->p = (const uint8_t *) (lm->files + lm->nr_files);
+	it->end = it->p + lm->len;
 }
 
+bool sym_linemap_next(struct sym_linemap_iter *it, struct sym_src_loc *loc)
+{
+	unsigned int tag;
+	uint64_t v;
+
+	if (it->p >= it->end)
+		return false;
+
+	tag = *it->p++;
+	v = tag >> SYM_ROW_WORD_SHIFT;
+	if (v == SYM_ROW_WORD_MAX)
+		v += sym_row_get_uleb(&it->p);
+	it->word += v;
+	if (tag & SYM_ROW_FILE)
+		it->file = sym_row_get_uleb(&it->p);
+	v = sym_row_get_uleb(&it->p);
+	it->linenr += (v >> 1) ^ -(v & 1);
+
+	loc->word = it->word;
+	loc->file = it->lm->files[it->file];
+	loc->filename = str_by_id(loc->file);
+	loc->linenr = it->linenr;
+	loc->flags = tag & SYM_ROW_FLAGS;
+	return true;
+}
 
-static void process_nm_output(void **store, char *s, size_t len)
+static inline struct sym_counters *sym_counters(struct sym_store *ss,
+						struct sym *sym)
 {
-	struct sym_store *ss;
-	struct sym *sym = NULL;
-	char *end = s + len;
-	int i;
+	if (ss->cnt)
+		return &ss->cnt[sym - ss->allsyms];
+	return &sym->cnt;
+}
 
-	ss = safe_mallocz(sizeof *ss);
-	*store = ss;
-	ss->min = ~(0ULL);
+/*
+ * Counters are added to four at a time. The vector extension maps
+ * that onto whatever SIMD the target has, or plain adds without.
+ */
+typedef uint64_t sym_cnt_vec __attribute__((vector_size(32)));
 
-	fprintf(stderr, "Build symtab\n");
-	do {
-		char *next;
-		int type;
+/* Add v to the n counters at c.  */
+static inline void sym_cnt_add(uint64_t *c, unsigned int n, uint64_t v)
+{
+	sym_cnt_vec vv = { v, v, v, v };
+	unsigned int i;
 
-		ss->allsyms = safe_realloc(ss->allsyms,
-					   sizeof *sym * (ss->nr_stored + 1));
-		sym = &ss->allsyms[ss->nr_stored];
-		memset(sym, 0, sizeof *sym);
+	for (i = 0; i + 4 <= n; i += 4) {
+		sym_cnt_vec t;
 
-		sym->addr = strtoull(s, &next, 16);
-		if (sym->addr == ULLONG_MAX && errno == ERANGE)
-			goto fail;
-
-		/* Advance the space.  */
-		s = next + 1;
-		sym->size = strtoull(s, &next, 16);
-		if (sym->size == ULLONG_MAX && errno == ERANGE)
-			goto fail;
-
-		s = next + 1;
-		type = s[0];
-		s += 2;
-
-		i = 0;
-		while (s[0] != '\n') {
-			if (i < (sizeof sym->name - 2)) {
-				sym->name[i] = s[0];
-				i++;
-			}
-			s++;
-		}
-		sym->name[i] = 0;
-		sym->namelen = i;
-		s++;
+		memcpy(&t, c + i, sizeof t);
+		t += vv;
+		memcpy(c + i, &t, sizeof t);
+	}
+	for (; i < n; i++)
+		c[i] += v;
+}
 
-		if (type != 'T' && type != 't'
-		    && type != 'W' && type != 'w')
-			continue;
+/* Add the n counters at src to those at dst.  */
+static inline void sym_cnt_add_all(uint64_t *dst, const uint64_t *src,
+				   unsigned int n)
+{
+	unsigned int i;
 
-		assert(sym->namelen > 0);
-		ss->nr_stored++;
-		if (sym->addr < ss->min)
-			ss->min = sym->addr;
-		if ((sym->addr + sym->size) > ss->max)
-			ss->max = sym->addr + sym->size;
-	} while (s < end);
+	for (i = 0; i + 4 <= n; i += 4) {
+		sym_cnt_vec t, u;
 
-	qsort(ss->allsyms, ss->nr_stored, sizeof *sym, sym_compare);
+		memcpy(&t, dst + i, sizeof t);
+		memcpy(&u, src + i, sizeof u);
+		t += u;
+		memcpy(dst + i, &t, sizeof t);
+	}
+	for (; i < n; i++)
+		dst[i] += src[i];
+}
 
-	/* Now we are done.  */
-	for (i = 0; i < ss->nr_stored; i++) {
-		tsearch(&ss->allsyms[i], &ss->rootp, sym_str_compare);
+/* Add v to the n counters of c from word pos on.  */
+static inline void sym_cov_add(struct sym_coverage *c, unsigned int pos,
+			       unsigned int n, uint64_t v)
+{
+	while (n) {
+		unsigned int off = pos & (SYM_COV_CHUNK - 1);
+		unsigned int k = SYM_COV_CHUNK - off;
+
+		if (k > n)
+			k = n;
+		sym_cnt_add(sym_cov_chunk(c, pos) + off, k, v);
+		pos += k;
+		n -= k;
 	}
+}
 
-	/* Init the unknown.  */
-	ss->unknown.size = ~0;
-	fprintf(stderr, "done.\n");
-	return;
-fail:
-	fprintf(stderr, "Invalid nm output\n");
-	exit(1);
+/* Set the n bits of map from start on.  */
+static void sym_bits_set(uint64_t *map, unsigned int start, unsigned int n)
+{
+	unsigned int end = start + n;
+
+	for (; start < end && start % 64; start++)
+		map[start / 64] |= 1ULL << (start % 64);
+	for (; start + 64 <= end; start += 64)
+		map[start / 64] = ~0ULL;
+	for (; start < end; start++)
+		map[start / 64] |= 1ULL << (start % 64);
 }
 
 /*
- * Build a symtab.
- * TODO: Use binutils libs or libreadelf.
+ * Pick the counter sets to keep, before anything is accounted. The
+ * default is total_time, cov and cov_ent.
  */
-void sym_read_from_elf(void **rootp, char *nm, char *elf)
-{
-	char *nm_argv[] = { nm, "-C", "-S", elf, NULL };
-	char *output;
-	char tmp_template[] = "/tmp/etrace-nm-XXXXXX";
-	long pagesize = sysconf(_SC_PAGE_SIZE);
-	int stdio[3] = {0, 1, 2};
-	int fd_tmp;
-	size_t fsize, fsize_aligned;
-	pid_t wpid;
-	pid_t kid;
-
-	fd_tmp = mkstemp(tmp_template);
-	if (fd_tmp < 0) {
-		perror("mkstemp");
-		exit(1);
-	}
-	unlink(tmp_template);
+void sym_store_set_counters(void **store, unsigned int flags)
+{
+	struct sym_store *ss = *store;
 
-	stdio[1] = fd_tmp;
-	kid = run(nm_argv[0], nm_argv, stdio);
-	wpid = waitpid(kid, NULL, 0);
-	if (wpid != kid) {
-		perror("wait");
-		exit(1);
-	}
+	if (ss)
+		ss->cnt_flags = flags;
+}
 
-	/* Done, now mmap the file.  */
-	fsize = get_filesize(fd_tmp);
-	fsize_aligned = align_pow2(fsize, pagesize);
-	output = mmap(NULL, fsize_aligned, PROT_READ, MAP_PRIVATE, fd_tmp, 0);
-	if (output == MAP_FAILED) {
-		perror("mmap");
-		exit(1);
-	}
-	process_nm_output(rootp, output, fsize);
-	close(fd_tmp);
+unsigned int sym_store_get_counters(void **store)
+{
+	struct sym_store *ss = *store;
+
+	return ss ? ss->cnt_flags : 0;
 }
 
+void sym_update_cov(void **store, struct sym *sym,
+			uint64_t start, uint64_t end, uint32_t time)
+{
+	struct sym_store *ss = *store;
+	int64_t start_offset = start - sym->addr;
+	int64_t len = end - start;
+	struct sym_counters *cnt;
+	unsigned int pos, words, r;
+	uint32_t q;
+
+	/* Is this the unknown sym ?? */
+	if (sym->namelen == 0)
+		return;
+
+	assert(start_offset >= 0);
+	assert(start_offset + len <= sym->size);
+
+	cnt = sym_counters(ss, sym);
+	if (ss->cnt_flags & SYM_CNT_TIME)
+		cnt->total_time += time;
+
+	sym_alloc_cov(ss, sym, cnt);
+
+	words = len / 4;
+	if (words == 0)
+		return;
+
+	pos = start_offset / 4;
+	if (cnt->cov_ent)
+		sym_cov_add(cnt->cov_ent, pos, words, 1);
+	if (cnt->hits)
+		sym_bits_set(cnt->hits, pos, words);
+	if (!cnt->cov)
+		return;
+
+	/* Each word gets time / words, the first time % words one more.  */
+	q = time / words;
+	r = time % words;
+	sym_cov_add(cnt->cov, pos, r, q + 1);
+	sym_cov_add(cnt->cov, pos + r, words - r, q);
+}
+
+static inline uint64_t sym_tb_hash(uint64_t start, uint64_t end)
+{
+	uint64_t h = (start ^ (end << 17) ^ (end >> 47)) * 0x9e3779b97f4a7c15ULL;
+
+	/* Index by the upper bits, they are the best mixed.  */
+	return (h >> 32) | (h << 32);
+}
+
+static inline struct sym_tb_piece *sym_tb_pieces(struct sym_tb *tb)
+{
+	return tb->nr_pieces > 1 ? tb->pieces : &tb->one;
+}
+
+/*
+ * A TB that runs over the end of sym, once per sym. Memoized TBs only
+ * get here when they are resolved, not on every run.
+ */
+static void sym_warn_span(struct sym *sym)
+{
+	if (!__atomic_exchange_n(&sym->span_warned, true, __ATOMIC_RELAXED))
+		fprintf(stderr, "WARNING: fixup sym %s has spans over to "
+			"another symbol\n", sym->name);
+}
+
+/* Split [start, end) at sym borders, like a direct sym_update_cov would.  */
+static void sym_tb_resolve(struct sym_store *ss, struct sym_tb *tb)
+{
+	struct sym_tb_piece *pieces = &tb->one;
+	void *store = ss;
+	uint64_t addr = tb->start;
+	unsigned int nr = 0, nr_alloc = 1;
+	struct sym *sym;
+
+	sym = sym_lookup_by_addr(&store, addr);
+	/* The unknown sym takes no coverage.  */
+	while (sym && addr < tb->end) {
+		struct sym_tb_piece *p;
+		uint64_t tend = tb->end;
+
+		if (tend > (sym->addr + sym->size)) {
+			tend = sym->addr + sym->size;
+			sym_warn_span(sym);
+		}
+
+		if (nr == nr_alloc) {
+			struct sym_tb_piece *old = pieces;
+
+			nr_alloc *= 2;
+			pieces = safe_malloc(sizeof pieces[0] * nr_alloc);
+			memcpy(pieces, old, sizeof pieces[0] * nr);
+			if (old != &tb->one)
+				free(old);
+		}
+		p = &pieces[nr++];
+		memset(p, 0, sizeof *p);
+		p->sym = sym;
+		p->pos = (addr - sym->addr) / 4;
+		p->words = (tend - addr) / 4;
+
+		addr = tend;
+		sym = sym_lookup_by_addr(&store, addr);
+	}
+
+	tb->nr_pieces = nr;
+	tb->pieces = pieces;
+}
+
+/* Account a single run of [start, end) straight into the counters.  */
+static void sym_tb_update_cov(struct sym_store *ss, uint64_t start,
+			      uint64_t end, uint32_t time)
+{
+	void *store = ss;
+	uint64_t addr = start;
+	struct sym *sym;
+
+	sym = sym_lookup_by_addr(&store, addr);
+	while (sym && addr < end) {
+		uint64_t tend = end;
+
+		if (tend > (sym->addr + sym->size)) {
+			tend = sym->addr + sym->size;
+			sym_warn_span(sym);
+		}
+		sym_update_cov(&store, sym, addr, tend, time);
+		addr = tend;
+		sym = sym_lookup_by_addr(&store, addr);
+	}
+}
+
+static void sym_tb_cache_rehash(struct sym_tb_cache *tbc,
+				unsigned int hash_size)
+{
+	unsigned int mask, i;
+
+	free(tbc->hash);
+	tbc->hash_size = hash_size;
+	tbc->hash = safe_mallocz(sizeof tbc->hash[0] * tbc->hash_size);
+	tbc->tbs = safe_realloc(tbc->tbs,
+				sizeof tbc->tbs[0] * tbc->hash_size / 2);
+
+	mask = tbc->hash_size - 1;
+	for (i = 0; i < tbc->nr; i++) {
+		uint64_t hv = sym_tb_hash(tbc->tbs[i].start, tbc->tbs[i].end);
+		unsigned int h = hv & mask;
+
+		while (tbc->hash[h])
+			h = (h + 1) & mask;
+		tbc->hash[h] = (hv & ~0xffffffffULL) | (i + 1);
+	}
+}
+
+static void sym_tb_piece_flush(struct sym_store *ss, struct sym_tb_piece *p);
+
+/*
+ * Drop the TBs that didn't run again since the last eviction. The run
+ * of those that ran once was accounted directly, the counts of the
+ * others are flushed. The TBs that do repeat stay, so traces that run
+ * a lot of code once, like boots, don't keep rebuilding them. If most
+ * TBs repeat, the memo grows instead.
+ */
+static void sym_tb_cache_evict(struct sym_store *ss)
+{
+	struct sym_tb_cache *tbc = &ss->tbc;
+	unsigned int i, j, n = 0;
+
+	for (i = 0; i < tbc->nr; i++) {
+		struct sym_tb *tb = &tbc->tbs[i];
+		struct sym_tb_piece *pieces = sym_tb_pieces(tb);
+
+		if (tb->nr_pieces == SYM_TB_COLD)
+			continue;
+		if (tb->ran) {
+			tb->ran = false;
+			tbc->tbs[n++] = *tb;
+			continue;
+		}
+		for (j = 0; j < tb->nr_pieces; j++) {
+			sym_tb_piece_flush(ss, &pieces[j]);
+			free(pieces[j].rem);
+		}
+		if (tb->nr_pieces > 1)
+			free(tb->pieces);
+	}
+	tbc->nr = n;
+	if (n >= tbc->max / 2)
+		tbc->max *= 2;
+	sym_tb_cache_rehash(tbc, tbc->hash_size);
+}
+
+static void sym_tb_cache_free(struct sym_tb_cache *tbc)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < tbc->nr; i++) {
+		struct sym_tb *tb = &tbc->tbs[i];
+
+		if (tb->nr_pieces == SYM_TB_COLD)
+			continue;
+		for (j = 0; j < tb->nr_pieces; j++)
+			free(sym_tb_pieces(tb)[j].rem);
+		if (tb->nr_pieces > 1)
+			free(tb->pieces);
+	}
+	free(tbc->tbs);
+	free(tbc->hash);
+	memset(tbc, 0, sizeof *tbc);
+}
+
+static inline void sym_tb_piece_add(struct sym_tb_piece *p, uint32_t time)
+{
+	unsigned int r = time % p->words;
+
+	p->quot += time / p->words;
+	if (!r)
+		return;
+
+	if (p->rem) {
+		p->rem[r]++;
+	} else if (!p->nr_rem1 || p->rem1 == r) {
+		p->rem1 = r;
+		p->nr_rem1++;
+	} else {
+		p->rem = safe_mallocz(sizeof p->rem[0] * p->words);
+		p->rem[r]++;
+	}
+}
+
+/*
+ * Account an execution of the TB [start, end) that took time. Gives
+ * the same counters as sym_update_cov on each sym the TB covers, once
+ * the store is flushed. The first run of a TB is accounted directly,
+ * repeats are memoized by (start, end) and only bump the counts of
+ * the sym pieces the TB was split into.
+ */
+void sym_update_cov_tb(void **store, uint64_t start, uint64_t end,
+		       uint32_t time)
+{
+	struct sym_store *ss = *store;
+	struct sym_tb_cache *tbc;
+	struct sym_tb_piece *pieces;
+	struct sym_tb *tb;
+	unsigned int h, mask, i;
+	uint64_t hv, tag;
+
+	if (!ss || end <= start)
+		return;
+
+	tbc = &ss->tbc;
+	if (tbc->bypass) {
+		tbc->bypass--;
+		sym_tb_update_cov(ss, start, end, time);
+		return;
+	}
+	if (!tbc->max) {
+		tbc->max = SYM_TB_MAX;
+		tbc->bypass_len = 1;
+	}
+	if (tbc->nr_found + tbc->nr_added >= SYM_TB_MAX) {
+		if (tbc->nr_found < tbc->nr_added * SYM_TB_MIN_REPEATS) {
+			tbc->bypass = (uint64_t) tbc->bypass_len * SYM_TB_MAX;
+			if (tbc->bypass_len < SYM_TB_BYPASS_MAX)
+				tbc->bypass_len *= 2;
+		} else {
+			tbc->bypass_len = 1;
+		}
+		tbc->nr_found = 0;
+		tbc->nr_added = 0;
+	}
+	if (tbc->nr >= tbc->max)
+		sym_tb_cache_evict(ss);
+	if (tbc->nr >= tbc->hash_size / 2)
+		sym_tb_cache_rehash(tbc, tbc->hash_size
+					 ? tbc->hash_size * 2 : 4096);
+
+	mask = tbc->hash_size - 1;
+	hv = sym_tb_hash(start, end);
+	tag = hv & ~0xffffffffULL;
+	h = hv & mask;
+	while (tbc->hash[h]) {
+		if ((tbc->hash[h] & ~0xffffffffULL) == tag) {
+			tb = &tbc->tbs[(uint32_t) tbc->hash[h] - 1];
+			if (tb->start == start && tb->end == end)
+				goto found;
+		}
+		h = (h + 1) & mask;
+	}
+
+	tb = &tbc->tbs[tbc->nr++];
+	tbc->hash[h] = tag | tbc->nr;
+	tb->start = start;
+	tb->end = end;
+	tb->nr_pieces = SYM_TB_COLD;
+	tb->ran = false;
+	tbc->nr_added++;
+	sym_tb_update_cov(ss, start, end, time);
+	return;
+
+found:
+	if (tb->nr_pieces == SYM_TB_COLD)
+		sym_tb_resolve(ss, tb);
+	tb->ran = true;
+	tbc->nr_found++;
+
+	pieces = sym_tb_pieces(tb);
+	for (i = 0; i < tb->nr_pieces; i++) {
+		struct sym_tb_piece *p = &pieces[i];
+
+		p->count++;
+		if (ss->cnt_flags & SYM_CNT_TIME)
+			p->time += time;
+		if ((ss->cnt_flags & SYM_CNT_COV) && p->words)
+			sym_tb_piece_add(p, time);
+	}
+}
+
+/*
+ * sym_update_cov gives each of the words time / words and the first
+ * time % words of them one more, expand the counts the same way.
+ */
+static void sym_tb_piece_flush(struct sym_store *ss, struct sym_tb_piece *p)
+{
+	struct sym_counters *cnt = sym_counters(ss, p->sym);
+	uint64_t extra = 0;
+	unsigned int k;
+
+	if (!p->count)
+		return;
+
+	sym_alloc_cov(ss, p->sym, cnt);
+	cnt->total_time += p->time;
+	if (cnt->cov_ent)
+		sym_cov_add(cnt->cov_ent, p->pos, p->words, p->count);
+	if (cnt->hits)
+		sym_bits_set(cnt->hits, p->pos, p->words);
+	p->count = 0;
+	p->time = 0;
+	if (!cnt->cov)
+		return;
+
+	/* Runs with remainder r give words 0 to r - 1 one more.  */
+	for (k = p->words; k-- > 0;) {
+		uint64_t *c = sym_cov_chunk(cnt->cov, p->pos + k);
+
+		c[(p->pos + k) & (SYM_COV_CHUNK - 1)] += p->quot + extra;
+		if (k == p->rem1)
+			extra += p->nr_rem1;
+		if (p->rem) {
+			extra += p->rem[k];
+			p->rem[k] = 0;
+		}
+	}
+	p->quot = 0;
+	p->nr_rem1 = 0;
+}
+
+/* Expand the pending TB counts into the counters of store.  */
+void sym_store_flush(void **store)
+{
+	struct sym_store *ss = *store;
+	unsigned int i, j;
+
+	if (!ss)
+		return;
+
+	for (i = 0; i < ss->tbc.nr; i++) {
+		struct sym_tb *tb = &ss->tbc.tbs[i];
+
+		if (tb->nr_pieces == SYM_TB_COLD)
+			continue;
+		for (j = 0; j < tb->nr_pieces; j++)
+			sym_tb_piece_flush(ss, &sym_tb_pieces(tb)[j]);
+	}
+}
+
+/*
+ * Create a store that shares all symbols with store but accounts
+ * coverage into a private set of counters. Lookups don't modify the
+ * store, so each thread can account through its own clone.
+ */
+void *sym_store_clone(void **store)
+{
+	struct sym_store *ss = *store;
+	struct sym_store *c;
+
+	if (!ss)
+		return NULL;
+
+	c = safe_malloc(sizeof *c);
+	*c = *ss;
+	c->nr_flush = 0;
+	c->hits = 0;
+	c->misses = 0;
+	c->cnt = safe_mallocz(sizeof c->cnt[0] * ss->nr_stored);
+	memset(&c->tbc, 0, sizeof c->tbc);
+	return c;
+}
+
+/* Add the counters of src to *dst, chunks dst lacks are handed over.  */
+static void sym_cov_merge(struct sym_coverage **dst, struct sym_coverage *src)
+{
+	struct sym_coverage *d = *dst;
+	unsigned int i;
+
+	if (!src)
+		return;
+	if (!d) {
+		*dst = src;
+		return;
+	}
+
+	for (i = 0; i < sym_cov_nr_chunks(src->nr); i++) {
+		unsigned int n = src->nr - (i << SYM_COV_CHUNK_SHIFT);
+
+		if (!src->chunks[i])
+			continue;
+		if (!d->chunks[i]) {
+			d->chunks[i] = src->chunks[i];
+			continue;
+		}
+		if (n > SYM_COV_CHUNK)
+			n = SYM_COV_CHUNK;
+		sym_cnt_add_all(d->chunks[i], src->chunks[i], n);
+		free(src->chunks[i]);
+	}
+	free(src);
+}
+
+static void sym_counters_merge(struct sym *sym, struct sym_counters *dst,
+				struct sym_counters *src)
+{
+	unsigned int nr_entries = sym->size / 4 + 1;
+	unsigned int i;
+
+	dst->total_time += src->total_time;
+	sym_cov_merge(&dst->cov, src->cov);
+	sym_cov_merge(&dst->cov_ent, src->cov_ent);
+
+	if (!src->hits)
+		return;
+	if (!dst->hits) {
+		dst->hits = src->hits;
+		return;
+	}
+	for (i = 0; i < (nr_entries + 63) / 64; i++)
+		dst->hits[i] |= src->hits[i];
+	free(src->hits);
+}
+
+/* Add the counters of src to those of sym in store, src is taken over.  */
+void sym_store_add_counters(void **store, struct sym *sym,
+			    struct sym_counters *src)
+{
+	struct sym_store *ss = *store;
+
+	sym_counters_merge(sym, sym_counters(ss, sym), src);
+}
+
+/* Add the counters of clone into store and free the clone.  */
+void sym_store_merge(void **store, void *clone)
+{
+	struct sym_store *ss = *store;
+	struct sym_store *c = clone;
+	unsigned int i;
+
+	if (!c)
+		return;
+
+	sym_store_flush(&clone);
+	for (i = 0; i < c->nr_stored; i++) {
+		struct sym *sym = &ss->allsyms[i];
+
+		sym_counters_merge(sym, sym_counters(ss, sym), &c->cnt[i]);
+	}
+	sym_tb_cache_free(&c->tbc);
+	free(c->cnt);
+	free(c);
+}
+
+/*
+ * Exchange the counters of store and clone, so that code walking the
+ * syms of store, e.g coverage_emit, sees those of clone. Swapping twice
+ * restores both.
+ */
+void sym_store_swap_counters(void **store, void *clone)
+{
+	struct sym_store *ss = *store;
+	struct sym_store *c = clone;
+	unsigned int i;
+
+	if (!c)
+		return;
+
+	sym_store_flush(store);
+	sym_store_flush(&clone);
+	for (i = 0; i < c->nr_stored; i++) {
+		struct sym_counters *cnt = sym_counters(ss, &ss->allsyms[i]);
+		struct sym_counters tmp = *cnt;
+
+		*cnt = c->cnt[i];
+		c->cnt[i] = tmp;
+	}
+}
+
+/*
+ * Syms are spread over a set of locks while the linemap is built, so
+ * that workers filling in different compilation units rarely contend.
+ */
+#define SYM_LINEMAP_LOCKS 64
+
+struct sym_linemap_build {
+	void **store;
+	unsigned int obj;
+	uint64_t bias;
+	unsigned int *nr_lines;
+	/* The rows of each sym, indexed like allsyms.  */
+	struct sym_lines *lines;
+	/* The unit the src_filename of each sym came from.  */
+	unsigned int *src_unit;
+	pthread_mutex_t locks[SYM_LINEMAP_LOCKS];
+
+	/*
+	 * The executed syms of obj still without a linemap by address,
+	 * with the highest end of any of them up to each.
+	 */
+	uint64_t *ran_start, *ran_end;
+	size_t nr_ran;
+};
+
+/* Take the units with code in any of the syms that ran.  */
+static bool sym_linemap_want(void *opaque, uint64_t lo, uint64_t hi)
+{
+	struct sym_linemap_build *lb = opaque;
+	size_t l = 0, h = lb->nr_ran;
+
+	lo += lb->bias;
+	hi += lb->bias;
+	/* Find the first sym starting at or after hi.  */
+	while (l < h) {
+		size_t mid = l + (h - l) / 2;
+
+		if (lb->ran_start[mid] < hi)
+			l = mid + 1;
+		else
+			h = mid;
+	}
+	return l && lb->ran_end[l - 1] > lo;
+}
+
+/*
+ * Collect the syms of lb->obj that have counters but no linemap yet.
+ * Returns their number.
+ */
+static size_t sym_linemap_ran(struct sym_linemap_build *lb)
+{
+	struct sym_store *ss = *lb->store;
+	uint64_t end = 0;
+	unsigned int i;
+	size_t n = 0;
+
+	for (i = 0; i < ss->nr_stored; i++) {
+		struct sym *sym = &ss->allsyms[i];
+
+		if (sym->obj == lb->obj && !sym->linemap
+		    && sym_counters_ran(sym_counters(ss, sym)))
+			n++;
+	}
+
+	lb->nr_ran = 0;
+	lb->ran_start = safe_malloc(sizeof lb->ran_start[0] * (n + 1));
+	lb->ran_end = safe_malloc(sizeof lb->ran_end[0] * (n + 1));
+	for (i = 0; i < ss->nr_stored && lb->nr_ran < n; i++) {
+		struct sym *sym = &ss->allsyms[i];
+
+		if (sym->obj != lb->obj || sym->linemap
+		    || !sym_counters_ran(sym_counters(ss, sym)))
+			continue;
+
+		if (sym->addr + sym->size > end)
+			end = sym->addr + sym->size;
+		lb->ran_start[lb->nr_ran] = sym->addr;
+		lb->ran_end[lb->nr_ran] = end;
+		lb->nr_ran++;
+	}
+	return n;
+}
+
+static void sym_linemap_add(void *opaque, unsigned int worker,
+			    const struct dwarf_line *l)
+{
+	struct sym_linemap_build *lb = opaque;
+	struct sym_store *ss;
+	pthread_mutex_t *lock;
+	struct sym *symp;
+	uint64_t offset;
+	uint32_t flags = 0;
+
+	/* Lines that end up in the syms of another ELF are dropped.  */
+	symp = sym_lookup_by_addr(lb->store, l->addr + lb->bias);
+	if (!symp || symp->obj != lb->obj)
+		return;
+
+	offset = l->addr + lb->bias - symp->addr;
+	offset /= 4;
+	if (l->inlined)
+		flags |= LOC_F_INLINED;
+	if (!l->is_stmt)
+		flags |= LOC_F_NOT_STMT;
+
+	ss = *lb->store;
+	lock = &lb->locks[(symp - ss->allsyms) % SYM_LINEMAP_LOCKS];
+	pthread_mutex_lock(lock);
+	/* The file of the first row of the lowest unit, as any run picks.  */
+	if (!symp->src_filename || l->unit < lb->src_unit[symp - ss->allsyms]) {
+		symp->src_filename = l->filename;
+		lb->src_unit[symp - ss->allsyms] = l->unit;
+	}
+
+	if (l->linenr >= symp->maxline)
+		symp->maxline = l->linenr;
+
+	/* Unit 0 is for the rows of earlier builds.  */
+	sym_lines_add(&lb->lines[symp - ss->allsyms], offset,
+		      str_id(l->filename), l->linenr, flags, l->unit + 1);
+	pthread_mutex_unlock(lock);
+
+	lb->nr_lines[worker]++;
+}
+
+/*
+ * Fill in the linemaps of the syms of obj from its DWARF line tables.
+ * Unless all, only the compilation units with code in syms that ran
+ * and that weren't decoded already are. Returns false if no such syms
+ * were left.
+ */
+static bool sym_obj_build_linemap(void **store, unsigned int obj, bool all)
+{
+	struct sym_store *ss = *store;
+	struct sym_obj *o = &ss->objs[obj];
+	struct sym_linemap_build lb;
+	unsigned int nr_workers, i;
+	unsigned int num_lines = 0;
+	struct dwarf *d;
+	long n;
+
+	lb.store = store;
+	lb.obj = obj;
+	lb.bias = o->bias;
+	if (!all && !sym_linemap_ran(&lb)) {
+		free(lb.ran_start);
+		free(lb.ran_end);
+		return false;
+	}
+
+	fprintf(stderr, "Building linemap\n");
+
+	d = dwarf_open(o->elf);
+	if (!d) {
+		fprintf(stderr, "WARNING: Unable to create linemap\n");
+		goto done;
+	}
+
+	if (!all && !o->units_done) {
+		o->nr_units = dwarf_nr_units(d);
+		o->units_done = safe_mallocz(sizeof o->units_done[0]
+					     * (o->nr_units + 1));
+	}
+	/* The units done are only meaningful for the same ELF.  */
+	if (!all && o->nr_units != dwarf_nr_units(d)) {
+		fprintf(stderr, "WARNING: %s changed, not updating its linemap\n",
+			o->elf);
+		dwarf_close(d);
+		goto done;
+	}
+
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+	nr_workers = n > 0 ? n : 1;
+	if (nr_workers > dwarf_nr_units(d))
+		nr_workers = dwarf_nr_units(d) ? dwarf_nr_units(d) : 1;
+
+	lb.nr_lines = safe_mallocz(sizeof lb.nr_lines[0] * nr_workers);
+	lb.lines = safe_mallocz(sizeof lb.lines[0] * (ss->nr_stored + 1));
+	lb.src_unit = safe_mallocz(sizeof lb.src_unit[0]
+				   * (ss->nr_stored + 1));
+	for (i = 0; i < SYM_LINEMAP_LOCKS; i++)
+		pthread_mutex_init(&lb.locks[i], NULL);
+
+	dwarf_foreach_line(d, nr_workers, all ? NULL : sym_linemap_want,
+			   all ? NULL : o->units_done, sym_linemap_add, &lb);
+
+	for (i = 0; i < nr_workers; i++)
+		num_lines += lb.nr_lines[i];
+	for (i = 0; i < SYM_LINEMAP_LOCKS; i++)
+		pthread_mutex_destroy(&lb.locks[i]);
+	free(lb.nr_lines);
+	free(lb.src_unit);
+	dwarf_close(d);
+
+	for (i = 0; i < ss->nr_stored; i++)
+		sym_linemap_set(&ss->allsyms[i], &lb.lines[i]);
+	free(lb.lines);
+
+	if (!num_lines) {
+		fprintf(stderr, "WARNING: Unable to create linemap\n");
+	}
+	fprintf(stderr, "done.\n");
+done:
+	if (!all) {
+		free(lb.ran_start);
+		free(lb.ran_end);
+	}
+	return true;
+}
+
+/*
+ * Linemaps are only needed for the coverage output and only for the
+ * code that ran. By default only the compilation units with code in
+ * syms with counters are decoded, the first time such syms show up.
+ * With full_linemap, all units of the ELFs that had code executed are
+ * decoded and cached, unless they came from the sym cache.
+ */
+void sym_store_load_linemaps(void **store)
+{
+	struct sym_store *ss = *store;
+	unsigned int o, i;
+
+	if (!ss)
+		return;
+
+	for (o = 0; o < ss->nr_objs; o++) {
+		struct sym_obj *obj = &ss->objs[o];
+
+		if (obj->has_linemap)
+			continue;
+
+		if (!ss->full_linemap) {
+			sym_obj_build_linemap(store, o, false);
+			continue;
+		}
+
+		for (i = 0; i < ss->nr_stored; i++) {
+			struct sym *sym = &ss->allsyms[i];
+
+			if (sym->obj == o
+			    && sym_counters_ran(sym_counters(ss, sym)))
+				break;
+		}
+		if (i == ss->nr_stored)
+			continue;
+
+		sym_obj_build_linemap(store, o, true);
+		obj->has_linemap = true;
+		sym_cache_save(obj->cache, obj->elf, ss->allsyms,
+			       ss->nr_stored, o, obj->bias, true);
+	}
+}
+
+/* nm -C demangling, from libiberty's demangle.h.  */
+#ifndef DMGL_PARAMS
+#define DMGL_PARAMS	(1 << 0)
+#define DMGL_ANSI	(1 << 1)
+#endif
+
+/*
+ * libbfd doesn't export the st_size of ELF syms, so the sizes are read
+ * from the .symtab of the ELF file and matched up by value and name.
+ */
+struct sym_elf_size {
+	uint64_t value;
+	uint64_t size;
+	const char *name;
+};
+
+struct sym_elf_sizes {
+	struct sym_elf_size *v;
+	size_t nr;
+	void *map;
+	size_t map_len;
+};
+
+static uint64_t sym_elf_get(const uint8_t *p, unsigned int n, bool be)
+{
+	uint64_t v = 0;
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		v |= (uint64_t) p[i] << (be ? (n - 1 - i) * 8 : i * 8);
+	return v;
+}
+
+/* Reads field of the Elf32_type or Elf64_type at p.  */
+#define SYM_ELF_FIELD(is64, be, p, type, field)				\
+	((is64)								\
+	 ? sym_elf_get((p) + offsetof(Elf64_##type, field),		\
+		       sizeof(((Elf64_##type *) 0)->field), be)		\
+	 : sym_elf_get((p) + offsetof(Elf32_##type, field),		\
+		       sizeof(((Elf32_##type *) 0)->field), be))
+
+static int sym_elf_size_compare(const void *p1, const void *p2)
+{
+	const struct sym_elf_size *s1 = p1, *s2 = p2;
+
+	if (s1->value != s2->value)
+		return s1->value < s2->value ? -1 : 1;
+	return strcmp(s1->name, s2->name);
+}
+
+/*
+ * Collect the sized syms of the .symtab of elf. Anything that doesn't
+ * parse simply leaves es empty, the syms then have no size.
+ */
+static void sym_elf_sizes_read(struct sym_elf_sizes *es, const char *elf)
+{
+	const uint8_t *m, *sh, *symtab = NULL, *strtab;
+	uint64_t shoff, shentsize, shnum, i;
+	uint64_t off, size, entsize = 0, link = 0, strsize;
+	struct stat st;
+	bool is64, be;
+	int fd;
+
+	memset(es, 0, sizeof *es);
+	fd = open(elf, O_RDONLY);
+	if (fd < 0)
+		return;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(Elf64_Ehdr)) {
+		close(fd);
+		return;
+	}
+	es->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (es->map == MAP_FAILED) {
+		es->map = NULL;
+		return;
+	}
+	es->map_len = st.st_size;
+	m = es->map;
+
+	if (memcmp(m, ELFMAG, SELFMAG))
+		return;
+	is64 = m[EI_CLASS] == ELFCLASS64;
+	be = m[EI_DATA] == ELFDATA2MSB;
+	shoff = SYM_ELF_FIELD(is64, be, m, Ehdr, e_shoff);
+	shentsize = SYM_ELF_FIELD(is64, be, m, Ehdr, e_shentsize);
+	shnum = SYM_ELF_FIELD(is64, be, m, Ehdr, e_shnum);
+	if (shentsize < (is64 ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr))
+	    || shoff >= es->map_len || shentsize > es->map_len)
+		return;
+	/* More sections than fit e_shnum are counted in section 0.  */
+	if (!shnum && shoff + shentsize <= es->map_len)
+		shnum = SYM_ELF_FIELD(is64, be, m + shoff, Shdr, sh_size);
+	if (shnum > (es->map_len - shoff) / shentsize)
+		return;
+
+	for (i = 0; i < shnum; i++) {
+		sh = m + shoff + i * shentsize;
+		if (SYM_ELF_FIELD(is64, be, sh, Shdr, sh_type) != SHT_SYMTAB)
+			continue;
+		off = SYM_ELF_FIELD(is64, be, sh, Shdr, sh_offset);
+		size = SYM_ELF_FIELD(is64, be, sh, Shdr, sh_size);
+		entsize = SYM_ELF_FIELD(is64, be, sh, Shdr, sh_entsize);
+		link = SYM_ELF_FIELD(is64, be, sh, Shdr, sh_link);
+		if (off > es->map_len || size > es->map_len - off)
+			return;
+		symtab = m + off;
+		break;
+	}
+	if (!symtab || link >= shnum
+	    || entsize < (is64 ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym)))
+		return;
+
+	sh = m + shoff + link * shentsize;
+	off = SYM_ELF_FIELD(is64, be, sh, Shdr, sh_offset);
+	strsize = SYM_ELF_FIELD(is64, be, sh, Shdr, sh_size);
+	if (off > es->map_len || strsize > es->map_len - off || !strsize
+	    || m[off + strsize - 1])
+		return;
+	strtab = m + off;
+
+	es->v = safe_malloc(sizeof es->v[0] * (size / entsize + 1));
+	for (i = 0; i < size / entsize; i++) {
+		const uint8_t *esym = symtab + i * entsize;
+		struct sym_elf_size *e = &es->v[es->nr];
+		uint64_t name;
+
+		e->size = SYM_ELF_FIELD(is64, be, esym, Sym, st_size);
+		name = SYM_ELF_FIELD(is64, be, esym, Sym, st_name);
+		if (!e->size || name >= strsize)
+			continue;
+		e->value = SYM_ELF_FIELD(is64, be, esym, Sym, st_value);
+		e->name = (const char *) strtab + name;
+		es->nr++;
+	}
+	qsort(es->v, es->nr, sizeof es->v[0], sym_elf_size_compare);
+}
+
+static uint64_t sym_elf_sizes_find(const struct sym_elf_sizes *es,
+				   uint64_t value, const char *name)
+{
+	struct sym_elf_size key = { .value = value, .name = name };
+	struct sym_elf_size *e;
+
+	if (!es->nr)
+		return 0;
+	e = bsearch(&key, es->v, es->nr, sizeof es->v[0],
+		    sym_elf_size_compare);
+	return e ? e->size : 0;
+}
+
+static void sym_elf_sizes_free(struct sym_elf_sizes *es)
+{
+	free(es->v);
+	if (es->map)
+		munmap(es->map, es->map_len);
+}
+
+/* Keep the code syms that nm -S would list with a T, t, W or w.  */
+static bool sym_keep(bfd *abfd, asymbol *asym, symbol_info *info)
+{
+	if (asym->flags & BSF_DEBUGGING)
+		return false;
+	if (bfd_is_target_special_symbol(abfd, asym))
+		return false;
+
+	bfd_symbol_info(asym, info);
+	return info->type == 'T' || info->type == 't'
+		|| info->type == 'W' || info->type == 'w';
+}
+
+static void sym_set_name(bfd *abfd, struct sym *sym, const char *name)
+{
+	char *dname;
+
+	dname = bfd_demangle(abfd, name, DMGL_PARAMS | DMGL_ANSI);
+	if (dname)
+		name = dname;
+
+	sym->name = str_intern(name);
+	sym->namelen = strlen(name);
+	free(dname);
+}
+
+/*
+ * Create a store for the nr syms, sorted by address. The store takes
+ * over syms.
+ */
+void sym_store_create(void **store, struct sym *syms, unsigned int nr)
+{
+	struct sym_store *ss;
+	unsigned int i;
+
+	ss = safe_mallocz(sizeof *ss);
+	ss->cnt_flags = SYM_CNT_TIME | SYM_CNT_COV | SYM_CNT_ENT;
+	*store = ss;
+	ss->min = ~(0ULL);
+	ss->allsyms = syms;
+	ss->nr_stored = nr;
+
+	for (i = 0; i < nr; i++) {
+		struct sym *sym = &syms[i];
+
+		if (sym->addr < ss->min)
+			ss->min = sym->addr;
+		if ((sym->addr + sym->size) > ss->max)
+			ss->max = sym->addr + sym->size;
+	}
+	sym_index_build(ss);
+	sym_pt_build(ss);
+
+	for (i = 0; i < nr; i++) {
+		tsearch(&ss->allsyms[i], &ss->rootp, sym_str_compare);
+	}
+
+	/* Init the unknown.  */
+	ss->unknown.name = str_intern("");
+	ss->unknown.size = ~0;
+}
+
+/* Read the code syms of elf, sorted by address.  */
+static struct sym *sym_read_elf_syms(const char *elf, unsigned int *nr_syms)
+{
+	struct sym_elf_sizes sizes = { 0 };
+	struct sym *allsyms;
+	asymbol **asyms;
+	long storage, nr, i, n;
+	bool is_elf;
+	bfd *abfd;
+
+	abfd = bfd_openr(elf, NULL);
+	if (!abfd || !bfd_check_format(abfd, bfd_object))
+		goto fail;
+	/*
+	 * The sections of relocatable objects, e.g kernel modules, all sit
+	 * at 0 and their debug info needs relocating, neither is handled.
+	 */
+	if (!(bfd_get_file_flags(abfd) & (EXEC_P | DYNAMIC))) {
+		fprintf(stderr, "%s: relocatable objects are not supported, "
+			"give the linked ELF\n", elf);
+		exit(1);
+	}
+
+	storage = bfd_get_symtab_upper_bound(abfd);
+	if (storage < 0)
+		goto fail;
+	asyms = safe_malloc(storage ? storage : sizeof *asyms);
+	nr = bfd_canonicalize_symtab(abfd, asyms);
+	if (nr < 0)
+		goto fail;
+	is_elf = bfd_get_flavour(abfd) == bfd_target_elf_flavour;
+	if (is_elf)
+		sym_elf_sizes_read(&sizes, elf);
+
+	fprintf(stderr, "Build symtab\n");
+	/* Sized up front, trimmed once we know what we kept.  */
+	allsyms = safe_malloc(sizeof allsyms[0] * (nr ? nr : 1));
+	for (i = 0, n = 0; i < nr; i++) {
+		struct sym *sym = &allsyms[n];
+		symbol_info info;
+
+		if (!sym_keep(abfd, asyms[i], &info))
+			continue;
+
+		memset(sym, 0, sizeof *sym);
+		sym->addr = info.value;
+		if (is_elf)
+			sym->size = sym_elf_sizes_find(&sizes, info.value,
+						bfd_asymbol_name(asyms[i]));
+		/* Like nm -S, ELF syms without a size are left out.  */
+		if (is_elf && !sym->size)
+			continue;
+
+		sym_set_name(abfd, sym, bfd_asymbol_name(asyms[i]));
+		if (!sym->namelen)
+			continue;
+		n++;
+	}
+	nr = n;
+	free(asyms);
+	sym_elf_sizes_free(&sizes);
+	bfd_close(abfd);
+
+	qsort(allsyms, nr, sizeof allsyms[0], sym_compare);
+
+	/* Other formats don't record sizes, syms extend to the next one.  */
+	if (!is_elf) {
+		for (i = 0; i + 1 < nr; i++)
+			allsyms[i].size = allsyms[i + 1].addr - allsyms[i].addr;
+	}
+
+	for (i = 0, n = 0; i < nr; i++) {
+		if (allsyms[i].size)
+			allsyms[n++] = allsyms[i];
+	}
+	fprintf(stderr, "done.\n");
+	*nr_syms = n;
+	return allsyms;
+fail:
+	fprintf(stderr, "%s: %s\n", elf, bfd_errmsg(bfd_get_error()));
+	exit(1);
+}
+
+/*
+ * Build one symtab from the code syms of all the elfs, each moved by
+ * its bias. The syms come from the sym cache in cache_dir if possible.
+ * Only full linemaps are cached, so they are loaded with the syms only
+ * if full_linemap. Other linemaps are built on demand by
+ * sym_store_load_linemaps.
+ */
+void sym_read_from_elfs(void **store, const struct sym_elf *elfs,
+			unsigned int nr_elfs, const char *cache_dir,
+			bool full_linemap)
+{
+	struct sym *allsyms = NULL;
+	struct sym_obj *objs;
+	struct sym_store *ss;
+	unsigned int nr_all = 0, o, i;
+
+	objs = safe_mallocz(sizeof objs[0] * nr_elfs);
+	for (o = 0; o < nr_elfs; o++) {
+		struct sym_obj *obj = &objs[o];
+		struct sym *syms;
+		unsigned int nr;
+		bool cached = true;
+
+		obj->elf = elfs[o].path;
+		obj->bias = elfs[o].bias;
+		obj->cache = sym_cache_filename(cache_dir, obj->elf);
+
+		syms = sym_cache_load(obj->cache, obj->elf, full_linemap, &nr,
+				      &obj->has_linemap);
+		if (!syms) {
+			syms = sym_read_elf_syms(obj->elf, &nr);
+			cached = false;
+		}
+
+		for (i = 0; i < nr; i++) {
+			syms[i].addr += obj->bias;
+			syms[i].obj = o;
+		}
+		/* A stripped ELF has nothing worth caching.  */
+		if (!cached && nr)
+			sym_cache_save(obj->cache, obj->elf, syms, nr, o,
+				       obj->bias, false);
+
+		allsyms = safe_realloc(allsyms,
+				       sizeof allsyms[0] * (nr_all + nr + 1));
+		memcpy(allsyms + nr_all, syms, sizeof syms[0] * nr);
+		nr_all += nr;
+		free(syms);
+	}
+
+	/* Each ELF is sorted already.  */
+	if (nr_elfs > 1)
+		qsort(allsyms, nr_all, sizeof allsyms[0], sym_compare);
+
+	/* Now we are done.  */
+	sym_store_create(store, allsyms, nr_all);
+	ss = *store;
+	ss->objs = objs;
+	ss->nr_objs = nr_elfs;
+	ss->full_linemap = full_linemap;
+}
+
+unsigned int sym_store_nr_objs(void **store)
+{
+	struct sym_store *ss = *store;
+
+	return ss ? ss->nr_objs : 0;
+}
+
+/* The path of the ELF obj was read from, and its bias.  */
+const char *sym_store_obj(void **store, unsigned int obj, uint64_t *bias)
+{
+	struct sym_store *ss = *store;
+
+	*bias = ss->objs[obj].bias;
+	return ss->objs[obj].elf;
+}
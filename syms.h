@@ -20,26 +20,112 @@
 #define _SYMS_H
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <stdlib.h>
 
-/* A 64bit counter per 32bit word in the sym.  */
+/*
+ * A 64bit counter per 32bit word in the sym. Huge syms, e.g firmware
+ * blobs, often only run in places, so the counters come in chunks for
+ * 4 KB of code that are allocated when a word in them first runs.
+ */
+#define SYM_COV_CHUNK_SHIFT	10
+#define SYM_COV_CHUNK		(1U << SYM_COV_CHUNK_SHIFT)
+
 struct sym_coverage {
-	uint64_t counter[0];
+	/* Nr of words.  */
+	unsigned int nr;
+	/* NULL for chunks with no word that ran.  */
+	uint64_t *chunks[0];
 };
 
+static inline uint64_t sym_cov_get(const struct sym_coverage *c,
+				   unsigned int word)
+{
+	const uint64_t *chunk = c->chunks[word >> SYM_COV_CHUNK_SHIFT];
+
+	return chunk ? chunk[word & (SYM_COV_CHUNK - 1)] : 0;
+}
+
 enum loc_flags {
 	LOC_F_INLINED = (1 << 0),
+	/* Not a recommended breakpoint location, is_stmt was false.  */
+	LOC_F_NOT_STMT = (1 << 1),
+};
+
+/*
+ * A row of a line table, for the word at offset word * 4 into the sym.
+ * Words without a row have no line of their own, words with inlined
+ * code often have several.
+ */
+struct sym_line {
+	uint32_t word;
+	/* Source file, by its str_id.  */
+	uint32_t file;
+	uint32_t linenr;
+	uint32_t flags;
+	/* Orders rows of a word from several units, see sym_line_compare.  */
+	uint32_t unit;
 };
 
+/* Rows collected for a sym, until sym_linemap_set packs them.  */
+struct sym_lines {
+	struct sym_line *l;
+	unsigned int nr, nr_alloc;
+};
+
+/*
+ * The rows of a sym sorted by word, rows of a word by their unit.
+ * They are packed into a byte stream of deltas to the previous row,
+ * see sym_linemap_set. The files of a sym are few, rows refer to them
+ * through their index in files.
+ */
+struct sym_linemap {
+	uint32_t nr;
+	uint32_t len;
+	uint32_t nr_files;
+	/* The files, followed by len bytes of rows.  */
+	uint32_t files[0];
+};
+
+/* A row as handed out by sym_linemap_next.  */
 struct sym_src_loc {
-	struct sym_src_loc *next;
+	unsigned int word;
+	uint32_t file;
 	const char *filename;
 	unsigned int linenr;
 	uint32_t flags;
 };
 
-struct sym_linemap {
-	struct sym_src_loc locs[0];
+struct sym_linemap_iter {
+	const struct sym_linemap *lm;
+	const uint8_t *p, *end;
+	uint32_t word;
+	uint32_t file;
+	uint64_t linenr;
+};
+
+/*
+ * Execution counters. Normally these live in the sym but per-thread
+ * store clones keep private sets that are merged back at the end.
+ * Only the sets the coverage format reads are kept, the others stay
+ * 0 or NULL, see sym_store_set_counters.
+ */
+struct sym_counters {
+	uint64_t total_time;
+	struct sym_coverage *cov;
+
+	/* For gcov, only counts entries no time.  */
+	struct sym_coverage *cov_ent;
+	/* A bit per word that ran, instead of cov_ent for plain coverage.  */
+	uint64_t *hits;
+};
+
+/* The counter sets a store keeps.  */
+enum sym_cnt_flags {
+	SYM_CNT_TIME = (1 << 0),	/* total_time */
+	SYM_CNT_COV = (1 << 1),		/* cov */
+	SYM_CNT_ENT = (1 << 2),		/* cov_ent */
+	SYM_CNT_HITS = (1 << 3),	/* hits */
 };
 
 struct sym
@@ -48,28 +134,81 @@ struct sym
 	uint64_t addr;
 	uint64_t size;
 	int hits;
-	uint64_t total_time;
-	char *src_filename;
+	const char *src_filename;
 
 	struct sym_linemap *linemap;
 	unsigned int maxline;
-	struct sym_coverage *cov;
+	struct sym_counters cnt;
 
-	/* For gcov, only counts entries no time.  */
-	struct sym_coverage *cov_ent;
+	/* Index of the ELF the sym comes from.  */
+	unsigned int obj;
+
+	/* Interned, see str_intern.  */
+	const char *name;
 	int namelen;
-	char name[128];
+	/* A TB ran over the end of the sym, and we said so.  */
+	bool span_warned;
+};
+
+/* Whether code ran, as far as the per word counters tell.  */
+static inline bool sym_counters_ran(const struct sym_counters *cnt)
+{
+	return cnt->cov || cnt->cov_ent || cnt->hits;
+}
+
+static inline bool sym_ran(const struct sym *s)
+{
+	return sym_counters_ran(&s->cnt);
+}
+
+/* Nr of runs of a word of s, runs only count as 1 with SYM_CNT_HITS.  */
+static inline uint64_t sym_word_count(const struct sym *s, unsigned int word)
+{
+	if (s->cnt.cov_ent)
+		return sym_cov_get(s->cnt.cov_ent, word);
+	if (s->cnt.hits)
+		return (s->cnt.hits[word / 64] >> (word % 64)) & 1;
+	return 0;
+}
+
+/* An ELF to read syms from.  */
+struct sym_elf {
+	const char *path;
+	/* Added to all addresses in the ELF.  */
+	uint64_t bias;
 };
 
 void sym_show_stats(void **store);
 void sym_show(const char *prefix, const struct sym *s);
 struct sym *sym_lookup_by_addr(void **rootp, uint64_t addr);
+struct sym *sym_lookup_bsearch(void **rootp, uint64_t addr);
+struct sym *sym_lookup_index(void **rootp, uint64_t addr);
 struct sym *sym_lookup_by_name(void **rootp, const char *name);
 struct sym *sym_get_all(void **store, size_t *nr_syms);
 struct sym *sym_get_unknown(void **store);
-void sym_read_from_elf(void **rootp, char *nm, char *elf);
-void sym_build_linemap(void **rootp, const char *dwarfdump, const char *elf);
-void sym_update_cov(struct sym *sym, uint64_t start, uint64_t end,
-			uint32_t time);
+void sym_store_create(void **store, struct sym *syms, unsigned int nr);
+void sym_read_from_elfs(void **store, const struct sym_elf *elfs,
+			unsigned int nr_elfs, const char *cache_dir,
+			bool full_linemap);
+void sym_store_load_linemaps(void **store);
+void sym_lines_add(struct sym_lines *ls, uint32_t word, uint32_t file,
+		   unsigned int linenr, uint32_t flags, uint32_t unit);
+void sym_linemap_set(struct sym *sym, struct sym_lines *ls);
+void sym_linemap_iter(struct sym_linemap_iter *it, const struct sym *sym);
+bool sym_linemap_next(struct sym_linemap_iter *it, struct sym_src_loc *loc);
+void sym_update_cov(void **store, struct sym *sym,
+			uint64_t start, uint64_t end, uint32_t time);
+void sym_update_cov_tb(void **store, uint64_t start, uint64_t end,
+		       uint32_t time);
+void sym_store_set_counters(void **store, unsigned int flags);
+unsigned int sym_store_get_counters(void **store);
+void sym_store_flush(void **store);
+void *sym_store_clone(void **store);
+void sym_store_merge(void **store, void *clone);
+void sym_store_swap_counters(void **store, void *clone);
+void sym_store_add_counters(void **store, struct sym *sym,
+			    struct sym_counters *src);
+unsigned int sym_store_nr_objs(void **store);
+const char *sym_store_obj(void **store, unsigned int obj, uint64_t *bias);
 
 #endif
@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+#
+# Writes the etrace fixtures of the regression tests from the code syms
+# of ELFs, as nm -S lists them.
+#
+# Copyright (C) Xilinx Inc.
+# Written by Edgar E. Iglesias
+#
+# Usage: mktrace.py [-r ROUNDS] [-t SCALE] [-n NOISE] OUT ELF[@BIAS]...
+#
+# Each sym of an ELF runs in 1 to 3 of every 3 rounds, some only their
+# first half and never_called not at all. The syms of each round go in
+# one exec pkg. The i:th sym takes SCALE * (i + 1) time units.
+# Default is 3 rounds and SCALE 1.
+#
+# With NOISE, each sym run is followed by that many runs of TBs outside
+# the ELFs, each of them only runs once.
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the
+# Free Software Foundation; version 2.
+#
+
+import getopt
+import struct
+import subprocess
+import sys
+
+TYPE_EXEC = 1
+TYPE_ARCH = 5
+TYPE_INFO = 0x4554
+EM_X86_64 = 62
+# Where the noise TBs run, above the ELFs.
+NOISE_BASE = 0x7f0000000000
+
+def pkg(t, payload):
+	return struct.pack('<HHI', t, 0, len(payload)) + payload
+
+def code_syms(elf):
+	out = subprocess.check_output(['nm', '-S', elf]).decode()
+	syms = []
+	for l in out.splitlines():
+		f = l.split()
+		if len(f) == 4 and f[2] in 'Tt':
+			syms.append((int(f[0], 16), int(f[1], 16), f[3]))
+	return sorted(syms)
+
+def usage():
+	sys.stderr.write('usage: mktrace.py [-r ROUNDS] [-t SCALE] '
+			 '[-n NOISE] OUT ELF[@BIAS]...\n')
+	sys.exit(1)
+
+def main():
+	rounds = 3
+	scale = 1
+	noise = 0
+	try:
+		opts, args = getopt.getopt(sys.argv[1:], 'r:t:n:')
+	except getopt.GetoptError:
+		usage()
+	for o, v in opts:
+		if o == '-r':
+			rounds = int(v, 0)
+		elif o == '-t':
+			scale = int(v, 0)
+		else:
+			noise = int(v, 0)
+	if len(args) < 2:
+		usage()
+
+	f = open(args[0], 'wb')
+	f.write(pkg(TYPE_INFO, struct.pack('<QHH', 0, 0, 1)))
+	f.write(pkg(TYPE_ARCH, struct.pack('<IBBxxIBBxx',
+					   EM_X86_64, 64, 0, EM_X86_64, 64, 0)))
+	t = 1000
+	noise_addr = NOISE_BASE
+	for arg in args[1:]:
+		elf, _, bias = arg.partition('@')
+		bias = int(bias, 0) if bias else 0
+		syms = code_syms(elf)
+		for rnd in range(rounds):
+			ents = b''
+			start = t
+			for i, (addr, size, name) in enumerate(syms):
+				if name == 'never_called' or rnd % 3 > i % 3:
+					continue
+				end = addr + (size // 2 if i % 4 == 1 else size)
+				ents += struct.pack('<IQQ', scale * (i + 1),
+						    addr + bias, end + bias)
+				t += scale * (i + 1)
+				for n in range(noise):
+					ents += struct.pack('<IQQ', 1, noise_addr,
+							    noise_addr + 16)
+					noise_addr += 16
+					t += 1
+			f.write(pkg(TYPE_EXEC, struct.pack('<Q', start) + ents))
+	f.close()
+
+main()
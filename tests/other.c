@@ -0,0 +1,34 @@
+/*
+ * Second test program, loaded next to prog with a bias in the
+ * multi-ELF tests.
+ */
+#include <stdio.h>
+
+static unsigned int fib(unsigned int n)
+{
+	unsigned int a = 0, b = 1, t;
+
+	while (n--) {
+		t = a + b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+static unsigned int gcd(unsigned int a, unsigned int b)
+{
+	while (b) {
+		unsigned int t = a % b;
+
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+int main(int argc, char **argv)
+{
+	printf("%u %u\n", fib(argc + 10), gcd(argc * 12, 18));
+	return 0;
+}
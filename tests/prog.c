@@ -0,0 +1,43 @@
+/*
+ * Test program for the qemu-etrace regression tests. Only its ELF is
+ * used, the traces in this directory are made up from its syms.
+ */
+#include <stdio.h>
+
+static int square(int x)
+{
+	return x * x;
+}
+
+static int sum(const int *v, int n)
+{
+	int i, s = 0;
+
+	for (i = 0; i < n; i++)
+		s += v[i];
+	return s;
+}
+
+static int classify(int x)
+{
+	if (x < 0)
+		return -1;
+	if (x == 0)
+		return 0;
+	return 1;
+}
+
+static void never_called(void)
+{
+	puts("never");
+}
+
+int main(int argc, char **argv)
+{
+	int v[4] = { 1, 2, 3, argc };
+
+	if (argc > 4)
+		never_called();
+	printf("%d %d %d\n", square(argc), sum(v, 4), classify(argc - 2));
+	return 0;
+}
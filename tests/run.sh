@@ -0,0 +1,123 @@
+#!/bin/sh
+#
+# Regression tests of qemu-etrace, run by make check.
+#
+# Copyright (C) Xilinx Inc.
+# Written by Edgar E. Iglesias
+#
+# Usage: tests/run.sh [qemu-etrace]
+#
+# Runs the t-*.sh scripts next to this one in order, each tests one
+# feature in a scratch directory they share. The traces are made by
+# mktrace.py from prog and other, which are built from prog.c and
+# other.c with:
+#   gcc -O0 -g -fdebug-prefix-map=$PWD=. -o prog prog.c
+# Outputs are compared with those in expected/, or with the output of
+# another way to get the same result. After a change that is meant to
+# change the outputs, update expected/ from a run with KEEP=1, which
+# leaves the outputs in the printed directory.
+#
+# The scripts use these helpers:
+#   run ARGS...                  qemu-etrace without sym cache and trace
+#                                output, logged to $OUT/log.
+#   check NAME EXPECTED [OUTPUT] compares expected/EXPECTED with OUTPUT,
+#                                by default of the same name.
+#   same NAME OUTPUT1 OUTPUT2    compares two outputs.
+#   pass NAME, fail NAME         count a result the script checks itself.
+#   skip NAME WHY                for tests that can't run here.
+#   mktrace ARGS...              runs mktrace.py.
+#   await CMD...                 waits up to 10s for CMD to succeed, for
+#                                tests that run qemu-etrace in the
+#                                background.
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the
+# Free Software Foundation; version 2.
+#
+
+TESTS=$(cd "$(dirname "$0")" && pwd)
+ETRACE=$(cd "$(dirname "${1:-./qemu-etrace}")" && pwd)/$(basename "${1:-qemu-etrace}")
+# The other tools are built next to qemu-etrace.
+BIN=$(dirname "$ETRACE")
+OUT=$(mktemp -d "${TMPDIR:-/tmp}/qemu-etrace-tests.XXXXXX") || exit 1
+FAILED=0
+PASSED=0
+SKIPPED=0
+
+run()
+{
+	"$ETRACE" --sym-cache none --trace-output none "$@" >>"$OUT/log" 2>&1
+}
+
+pass()
+{
+	PASSED=$((PASSED + 1))
+	echo "PASS: $1"
+}
+
+fail()
+{
+	FAILED=$((FAILED + 1))
+	echo "FAIL: $1"
+}
+
+check()
+{
+	if cmp -s "$TESTS/expected/$2" "$OUT/${3:-$2}"; then
+		pass "$1"
+	else
+		fail "$1"
+		diff -u "$TESTS/expected/$2" "$OUT/${3:-$2}" | head -20
+	fi
+}
+
+same()
+{
+	if [ -s "$OUT/$2" ] && cmp -s "$OUT/$2" "$OUT/$3"; then
+		pass "$1"
+	else
+		fail "$1"
+		diff -u "$OUT/$2" "$OUT/$3" | head -20
+	fi
+}
+
+skip()
+{
+	SKIPPED=$((SKIPPED + 1))
+	echo "SKIP: $1 ($2)"
+}
+
+mktrace()
+{
+	python3 "$TESTS/mktrace.py" "$@"
+}
+
+await()
+{
+	_i=0
+	until "$@"; do
+		[ $_i -lt 100 ] || return 1
+		sleep 0.1
+		_i=$((_i + 1))
+	done
+}
+
+cd "$OUT" || exit 1
+# qcov annotates the sources, found relative to the compilation dir.
+cp "$TESTS/prog.c" .
+
+PROG="--elf $TESTS/prog"
+# Several ELFs, one of them far above its link address.
+MULTI="--elf $TESTS/prog --elf $TESTS/other@0x555555554000"
+
+for t in "$TESTS"/t-*.sh; do
+	. "$t"
+done
+
+echo "$PASSED passed, $FAILED failed, $SKIPPED skipped"
+if [ -n "$KEEP" ]; then
+	echo "Outputs in $OUT"
+else
+	rm -rf "${OUT:?}"
+fi
+[ "$FAILED" = 0 ]
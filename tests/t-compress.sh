@@ -0,0 +1,31 @@
+# zstd and lz4 compressed traces, sourced by run.sh.
+
+cp "$TESTS/prog.etr" plain.etr
+for c in zstd:zst lz4:lz4; do
+	fmt=${c%:*}
+	z=plain.etr.${c#*:}
+	if ! command -v $fmt >/dev/null; then
+		skip "compress: $fmt" "no $fmt tool"
+		continue
+	fi
+	$fmt -q -c plain.etr >$z
+	if "$ETRACE" --trace $z --trace-output none 2>&1 |
+	   grep -q "without support"; then
+		skip "compress: $fmt" "not built in"
+		continue
+	fi
+
+	run --trace $z $PROG \
+		--coverage-format lcov --coverage-output $fmt-file.info
+	check "compress: $fmt file" prog.info $fmt-file.info
+
+	# Streams can't be told by their magic, they take a prefix.
+	cat $z | run --trace $fmt:- $PROG \
+		--coverage-format lcov --coverage-output $fmt-pipe.info
+	check "compress: $fmt pipe" prog.info $fmt-pipe.info
+
+	run --trace plain.etr \
+		--trace-out-format etrace --trace-output out.etr.${c#*:}
+	$fmt -d -q -c out.etr.${c#*:} >out.etr
+	same "compress: $fmt output" plain.etr out.etr
+done
@@ -0,0 +1,27 @@
+# Coverage databases that runs add to, sourced by run.sh.
+
+for i in 1 2; do
+	run --trace "$TESTS/prog.etr" $PROG --coverage-db twice.db \
+		--coverage-format lcov --coverage-output twice$i.info
+done
+check "db: runs add up" prog-x2.info twice2.info
+
+for i in 1 2; do
+	run --trace "$TESTS/multi.etr" $MULTI --coverage-db multi.db \
+		--coverage-format lcov --coverage-output multi$i.info
+done
+check "db: multi-ELF" multi-x2.info multi2.info
+
+# Runs at the same time take turns at the db, none is lost.
+for i in 1 2 3 4 5; do
+	run --trace "$TESTS/prog.etr" $PROG --coverage-db serial.db \
+		--coverage-format lcov --coverage-output serial.info
+done
+for i in 1 2 3 4; do
+	run --trace "$TESTS/prog.etr" $PROG --coverage-db parallel.db \
+		--coverage-format lcov --coverage-output parallel$i.info &
+done
+wait
+run --trace "$TESTS/prog.etr" $PROG --coverage-db parallel.db \
+	--coverage-format lcov --coverage-output parallel.info
+same "db: parallel runs" serial.info parallel.info
@@ -0,0 +1,9 @@
+# Coverage by line, from the linemaps of the native DWARF decoder,
+# sourced by run.sh.
+
+run --trace "$TESTS/prog.etr" $PROG \
+	--coverage-format lcov --coverage-output prog.info
+check "dwarf: lcov" prog.info
+
+run --trace "$TESTS/prog.etr" $PROG --coverage-format qcov
+check "dwarf: qcov" prog.c.qcov
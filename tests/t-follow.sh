@@ -0,0 +1,17 @@
+# --follow of a trace-file while it is written, sourced by run.sh.
+
+# Cut in the middle of a pkg, the rest shows up once it is waited for.
+exec 3>follow.etr
+head -c 100 "$TESTS/prog.etr" >&3
+timeout 20 "$ETRACE" --sym-cache none --follow --trace follow.etr $PROG \
+	--trace-out-format human --trace-output follow.human \
+	--coverage-format lcov --coverage-output follow.info \
+	>>log 2>&1 3>&- &
+await test -s follow.human
+tail -c +101 "$TESTS/prog.etr" >&3
+# Following ends once the writer closes the file, qemu-etrace doesn't
+# hold it open through fd 3.
+exec 3>&-
+wait $!
+check "follow: human" prog.human follow.human
+check "follow: coverage" prog.info follow.info
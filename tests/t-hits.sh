@@ -0,0 +1,5 @@
+# --coverage-hits, which only records which code ran, sourced by run.sh.
+
+run --trace "$TESTS/prog.etr" $PROG --coverage-hits \
+	--coverage-format lcov --coverage-output prog-hits.info
+check "hits: lcov" prog-hits.info
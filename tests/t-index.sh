@@ -0,0 +1,19 @@
+# Windows that seek through the .eidx index, sourced by run.sh.
+
+mktrace -r 8192 index.etr "$TESTS/prog"
+cp index.etr noindex.etr
+run --trace index.etr --build-index
+if [ -s index.etr.eidx ]; then
+	pass "index: --build-index"
+else
+	fail "index: --build-index"
+fi
+
+for w in "--start-pkg 5000 --count 100" \
+	 "--start-time 50000 --end-time 51000"; do
+	run --trace index.etr $PROG $w \
+		--trace-out-format human --trace-output index.human
+	run --trace noindex.etr $PROG $w \
+		--trace-out-format human --trace-output noindex.human
+	same "index: $w" noindex.human index.human
+done
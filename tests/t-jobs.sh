@@ -0,0 +1,11 @@
+# Trace-files decoded in shards by --jobs, sourced by run.sh.
+
+# Enough pkgs for the index to split the trace at.
+mktrace -r 8192 jobs.etr "$TESTS/prog"
+for f in lcov etrace; do
+	run --trace jobs.etr $PROG --jobs 1 \
+		--coverage-format $f --coverage-output jobs1.$f
+	run --trace jobs.etr $PROG --jobs 4 \
+		--coverage-format $f --coverage-output jobs4.$f
+	same "jobs: $f" jobs1.$f jobs4.$f
+done
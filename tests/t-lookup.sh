@@ -0,0 +1,12 @@
+# Sym lookups checked against a plain bsearch by sym-lookup-bench,
+# sourced by run.sh.
+
+if [ -x "$BIN/sym-lookup-bench" ]; then
+	if "$BIN/sym-lookup-bench" --check 20000 200000 >>log 2>&1; then
+		pass "lookup: same syms as bsearch"
+	else
+		fail "lookup: same syms as bsearch"
+	fi
+else
+	skip "lookup: same syms as bsearch" "no sym-lookup-bench"
+fi
@@ -0,0 +1,25 @@
+# --merge of coverage databases and lcov info files, sourced by run.sh.
+
+for i in 1 2; do
+	run --trace "$TESTS/prog.etr" $PROG --coverage-db shard$i.db \
+		--coverage-format lcov --coverage-output shard$i.info
+done
+
+run --merge $PROG --coverage-format lcov --coverage-output load.info \
+	shard1.db
+check "merge: db load" prog.info load.info
+
+run --merge $PROG --coverage-db merged.db shard1.db shard2.db
+run --merge $PROG --coverage-format lcov --coverage-output merged.info \
+	merged.db
+check "merge: db shards" prog-x2.info merged.info
+
+run --merge --coverage-format lcov --coverage-output shards.info \
+	shard1.info shard2.info
+check "merge: lcov info files" prog-x2.info shards.info
+
+run --trace "$TESTS/multi.etr" $MULTI --coverage-db multi-shard.db \
+	--coverage-format lcov --coverage-output multi-shard.info
+run --merge $MULTI --coverage-format lcov --coverage-output multi-db.info \
+	multi-shard.db
+check "merge: multi-ELF db" multi.info multi-db.info
@@ -0,0 +1,12 @@
+# Trace-files decoded through their mmap window, sourced by run.sh.
+
+run --trace "$TESTS/prog.etr" $PROG \
+	--trace-out-format human --trace-output prog.human
+check "mmap: human" prog.human
+
+# A note pkg too short to hold its time is skipped.
+printf '\003\000\000\000\004\000\000\000abcd' >note.etr
+cat "$TESTS/prog.etr" >>note.etr
+run --trace note.etr $PROG \
+	--trace-out-format human --trace-output note.human
+check "mmap: truncated note" prog.human note.human
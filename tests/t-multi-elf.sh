@@ -0,0 +1,6 @@
+# Several ELFs, one of them far above its link address, sourced by
+# run.sh.
+
+run --trace "$TESTS/multi.etr" $MULTI \
+	--coverage-format lcov --coverage-output multi.info
+check "multi-ELF: bias" multi.info
@@ -0,0 +1,17 @@
+# Streams read into the ring by the reader thread, sourced by run.sh.
+
+cat "$TESTS/prog.etr" | run --trace - $PROG \
+	--trace-out-format human --trace-output pipe.human
+check "ring: human" prog.human pipe.human
+
+# Enough of the trace concatenated to wrap around the ring a few times.
+mktrace -r 3000 ring.etr "$TESTS/prog"
+for i in 1 2 3 4 5 6 7 8; do
+	cat ring.etr ring.etr >ring2.etr
+	mv ring2.etr ring.etr
+done
+run --trace ring.etr $PROG --coverage-format lcov --coverage-output ring.info
+cat ring.etr | run --trace - $PROG \
+	--coverage-format lcov --coverage-output ring-pipe.info
+same "ring: wrap around" ring.info ring-pipe.info
+rm ring.etr ring.etr.eidx
@@ -0,0 +1,14 @@
+# Traces written straight into a shm: ring by etrace-shm-producer,
+# sourced by run.sh.
+
+if [ -x "$BIN/etrace-shm-producer" ]; then
+	shm=shm:qemu-etrace-test-$$
+	run --trace $shm --server 0 $PROG \
+		--coverage-format lcov --coverage-output shm.info &
+	await grep -q "waiting for a producer" log
+	"$BIN/etrace-shm-producer" $shm "$TESTS/prog.etr" >>log 2>&1
+	wait $!
+	check "shm: coverage" prog.info shm.info
+else
+	skip "shm: coverage" "no etrace-shm-producer"
+fi
@@ -0,0 +1,10 @@
+# Syms and linemaps saved to and loaded from the sym cache, sourced by
+# run.sh.
+
+for i in 1 2; do
+	"$ETRACE" --trace "$TESTS/prog.etr" $PROG --sym-cache cache \
+		--full-linemap --trace-output none --coverage-format lcov \
+		--coverage-output cache$i.info >>log 2>&1
+done
+check "sym cache: save" prog.info cache1.info
+check "sym cache: load" prog.info cache2.info
@@ -0,0 +1,29 @@
+# The TB memo, which accounts repeats of a TB by the sym pieces it was
+# split into, sourced by run.sh.
+
+# Every TB runs once per trace, so only the first run of a trace that
+# repeats it takes the direct path. Runs into a db all do.
+mktrace -r 1 -t 1001 once.etr "$TESTS/prog"
+cat once.etr once.etr once.etr >thrice.etr
+for f in etrace lcov; do
+	run --trace thrice.etr $PROG \
+		--coverage-format $f --coverage-output memo.$f
+	for i in 1 2 3; do
+		run --trace once.etr $PROG --coverage-db memo-$f.db \
+			--coverage-format $f --coverage-output direct.$f
+	done
+	same "tb memo: $f" direct.$f memo.$f
+done
+
+# TBs outside the ELFs that only run once make the memo evict TBs and
+# get bypassed for a while, the coverage stays that of the syms.
+mktrace -r 300 -t 1001 quiet.etr "$TESTS/prog"
+mktrace -r 300 -t 1001 -n 300 noise.etr "$TESTS/prog"
+for f in etrace lcov; do
+	run --trace quiet.etr $PROG \
+		--coverage-format $f --coverage-output quiet.$f
+	run --trace noise.etr $PROG \
+		--coverage-format $f --coverage-output noise.$f
+	same "tb memo: evicted and bypassed $f" quiet.$f noise.$f
+done
+rm noise.etr
@@ -0,0 +1,19 @@
+# Streams passed through to the trace output by the kernel while they
+# are decoded, sourced by run.sh.
+
+cat "$TESTS/prog.etr" | run --trace - $PROG \
+	--trace-out-format etrace --trace-output tee.etr \
+	--coverage-format lcov --coverage-output tee.info
+cp "$TESTS/prog.etr" tee-in.etr
+same "tee: file output" tee-in.etr tee.etr
+check "tee: coverage" prog.info tee.info
+
+# To a pipe, and to an O_APPEND file that can't be spliced to.
+cat "$TESTS/prog.etr" | "$ETRACE" --sym-cache none --trace - $PROG \
+	--trace-out-format etrace --trace-output - 2>>log | cat >tee-pipe.etr
+same "tee: pipe output" tee-in.etr tee-pipe.etr
+
+: >tee-append.etr
+cat "$TESTS/prog.etr" | "$ETRACE" --sym-cache none --trace - $PROG \
+	--trace-out-format etrace --trace-output - >>tee-append.etr 2>>log
+same "tee: append output" tee-in.etr tee-append.etr
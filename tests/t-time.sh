@@ -0,0 +1,14 @@
+# Time of TBs spread over their words, sourced by run.sh.
+#
+# Each word gets time / words of a TB run and the first time % words
+# of them one more, summed over the runs.
+
+mktrace -t 1001 time.etr "$TESTS/prog"
+
+run --trace time.etr $PROG \
+	--coverage-format etrace --coverage-output time.etrace
+check "time: etrace" time.etrace
+
+run --trace time.etr $PROG \
+	--coverage-format cachegrind --coverage-output time.cachegrind
+check "time: cachegrind" time.cachegrind
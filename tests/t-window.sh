@@ -0,0 +1,18 @@
+# Windows of the pkgs to decode, sourced by run.sh.
+
+# The second round of syms, pkg 3 after INFO, ARCH and the first.
+run --trace "$TESTS/prog.etr" $PROG --start-pkg 3 --count 1 \
+	--trace-out-format human --trace-output window-pkg.human
+check "window: --start-pkg --count" window.human window-pkg.human
+
+run --trace "$TESTS/prog.etr" $PROG --start-time 1016 --end-time 1027 \
+	--trace-out-format human --trace-output window-time.human
+check "window: --start-time --end-time" window.human window-time.human
+
+for w in "--start-time 2 --end-time 1" "--count 0" "--start-pkg 1x"; do
+	if run --trace "$TESTS/prog.etr" $PROG $w; then
+		fail "window: rejects $w"
+	else
+		pass "window: rejects $w"
+	fi
+done
@@ -0,0 +1,40 @@
+# Many clients served at once by --workers, sourced by run.sh.
+
+workers_done()
+{
+	[ "$(grep -c ': done' workers.log)" = 2 ]
+}
+
+"$ETRACE" --sym-cache none --trace unix:workers.sock --workers 2 \
+	--trace-output none $PROG --per-client-coverage \
+	--coverage-format lcov --coverage-output workers.info \
+	>>log 2>workers.log &
+server=$!
+await test -S workers.sock
+
+for c in 1 2; do
+	run --trace "$TESTS/prog.etr" \
+		--trace-out-format etrace --trace-output unix:workers.sock &
+done
+# SIGINT ends serving, once the clients are decoded.
+await workers_done
+kill -INT $server
+wait
+cat workers.log >>log
+
+check "workers: all clients" prog-x2.info workers.info
+check "workers: client 0" prog.info workers.info.0
+check "workers: client 1" prog.info workers.info.1
+
+# Without the checks these serve with no decoder, until timeout kills
+# them.
+for w in 0 x; do
+	timeout 10 "$ETRACE" --trace unix:workers.sock --workers $w \
+		--trace-output none $PROG >>log 2>&1
+	r=$?
+	if [ $r = 0 ] || [ $r = 124 ]; then
+		fail "workers: rejects --workers $w"
+	else
+		pass "workers: rejects --workers $w"
+	fi
+done
@@ -90,23 +90,7 @@ static void ht_process_exec(struct hextracer *t,
 			now, start, end, sym ? sym->name : "");
 	}
 	if (cov_fmt != NONE) {
-		if (!sym)
-			sym = sym_get_unknown(t->tr.sym_tree);
-
-		if (sym) {
-			uint64_t addr = start;
-			while (sym && addr < end) {
-				uint64_t tend = end;
-
-				if (tend > (sym->addr + sym->size)) {
-					tend = sym->addr + sym->size;
-					printf("WARNING: fixup sym %s has spans over to another symbol\n", sym->name);
-				}
-				sym_update_cov(sym, addr, tend, duration);
-				addr = tend;
-				sym = sym_lookup_by_addr(t->tr.sym_tree, addr);
-			}
-		}
+		sym_update_cov_tb(t->tr.sym_tree, start, end, duration);
 		now += duration;
 	}
 }
@@ -35,29 +35,46 @@
 #include <fcntl.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/mman.h>
 
 #include "trace-open.h"
+#include "util.h"
 #include "safeio.h"
+#include "compress.h"
+#include "ring.h"
 
 #define UNIX_PREFIX "unix:"
+#define SHM_PREFIX "shm:"
+
+/* Data size of the rings behind shm: traces.  */
+#define SHM_RING_SIZE (32 * 1024 * 1024)
+
+static bool sk_unix_addr(const char *descr, struct sockaddr_un *addr)
+{
+	const char *path = descr + strlen(UNIX_PREFIX);
+
+	if (sizeof(addr->sun_path) - 1 < strlen(path)) {
+		fprintf(stderr, "%s: path too long\n", path);
+		return false;
+	}
+
+	memset(addr, 0, sizeof *addr);
+	addr->sun_family = AF_UNIX;
+	strncpy(addr->sun_path, path, sizeof(addr->sun_path) - 1);
+	return true;
+}
 
 static int sk_unix_client(const char *descr)
 {
 	struct sockaddr_un addr;
 	int fd, nfd;
 
-	if (sizeof(addr.sun_path) - 1 < strlen(descr) - strlen(UNIX_PREFIX)) {
-		fprintf(stderr, "%s: path too long\n", descr + strlen(UNIX_PREFIX));
+	if (!sk_unix_addr(descr, &addr))
 		return -1;
-	}
 
 	fd = socket(AF_UNIX, SOCK_STREAM, 0);
-	fprintf(stderr, "connect to %s\n", descr + strlen(UNIX_PREFIX));
+	fprintf(stderr, "connect to %s\n", addr.sun_path);
 
-	memset(&addr, 0, sizeof addr);
-	addr.sun_family = AF_UNIX;
-	strncpy(addr.sun_path, descr + strlen(UNIX_PREFIX),
-		sizeof(addr.sun_path) - 1);
 	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) >= 0)
 		return fd;
 
@@ -76,16 +93,91 @@ fail:
 	return -1;
 }
 
+/* The last shm ring we created, in case no producer ever claims it.  */
+static char *shm_path;
+
+static void shm_ring_cleanup(void)
+{
+	shm_unlink(shm_path);
+}
+
+/*
+ * Create the shared ring for descr (shm:name) and return an fd for it.
+ * The producer attaches to /dev/shm/name and unlinks it.
+ */
+static int shm_ring_consumer(const char *descr)
+{
+	const char *name = descr + strlen(SHM_PREFIX);
+	int fd;
+
+	if (!shm_path) {
+		shm_path = safe_malloc(strlen(name) + 2);
+		sprintf(shm_path, "%s%s", name[0] == '/' ? "" : "/", name);
+		atexit(shm_ring_cleanup);
+	}
+
+	fd = ring_shm_create(shm_path, SHM_RING_SIZE);
+	if (fd < 0)
+		perror(shm_path);
+	else
+		fprintf(stderr, "waiting for a producer on shm %s\n", shm_path);
+	return fd;
+}
+
+/* Returns a listening socket for descr, only unix: is supported.  */
+int trace_listen(const char *descr)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (memcmp(UNIX_PREFIX, descr, strlen(UNIX_PREFIX))) {
+		fprintf(stderr, "%s: can only serve unix: sockets\n", descr);
+		return -1;
+	}
+	if (!sk_unix_addr(descr, &addr))
+		return -1;
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	unlink(addr.sun_path);
+	if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0
+	    || listen(fd, SOMAXCONN) < 0) {
+		perror(addr.sun_path);
+		close(fd);
+		return -1;
+	}
+	fprintf(stderr, "listening on %s\n", addr.sun_path);
+	return fd;
+}
+
+bool trace_is_shm(const char *descr)
+{
+	return descr && !memcmp(SHM_PREFIX, descr, strlen(SHM_PREFIX));
+}
+
 int trace_open(const char *descr, bool write)
 {
+	enum compress_fmt cfmt;
 	int fd = -1;
 
 	if (descr == NULL)
 		return -1;
 
+	cfmt = compress_parse_prefix(&descr);
+
 	if (memcmp(UNIX_PREFIX, descr, strlen(UNIX_PREFIX)) == 0) {
 		/* UNIX.  */
 		fd = sk_unix_client(descr);
+	} else if (memcmp(SHM_PREFIX, descr, strlen(SHM_PREFIX)) == 0) {
+		/* The ring is consumed in place by the etrace decoder.  */
+		if (write || cfmt != COMPRESS_NONE) {
+			fprintf(stderr, "%s: shm traces can only be read, "
+				"uncompressed\n", descr);
+			return -1;
+		}
+		return shm_ring_consumer(descr);
 	} else if (!strcmp(descr, "-")) {
 		if (write)
 			fd = dup(fileno(stdout));
@@ -101,5 +193,17 @@ int trace_open(const char *descr, bool write)
 
 		fd = open(descr, flags, S_IWUSR | S_IRUSR);
 	}
+
+	if (fd < 0)
+		return fd;
+
+	if (cfmt == COMPRESS_NONE) {
+		if (write)
+			cfmt = compress_detect_suffix(descr);
+		else
+			cfmt = compress_detect_fd(fd);
+	}
+	if (cfmt != COMPRESS_NONE)
+		fd = compress_wrap_fd(fd, cfmt, write);
 	return fd;
 }
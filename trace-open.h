@@ -26,3 +26,5 @@
 #include <stdbool.h>
 
 int trace_open(const char *descr, bool write);
+int trace_listen(const char *descr);
+bool trace_is_shm(const char *descr);
@@ -164,10 +164,8 @@ static ssize_t read_trace_buf(qemu_simple_tracer *t, void *data, size_t len)
 
 static void handle_tb_enter_exec(qemu_simple_tracer *t, const TraceRecord *r)
 {
-	uint64_t pc_start, pc_end, duration;
-	struct sym *sym = NULL;
+	uint64_t pc_start, pc_end;
 
-	duration = 0;
 	pc_start = t->args_buf[1];
 	pc_end = t->args_buf[2];
 
@@ -175,30 +173,9 @@ static void handle_tb_enter_exec(qemu_simple_tracer *t, const TraceRecord *r)
 			" pc_start: %08"PRIx64", pc_end: %08"PRIx64"\n",
 			r->timestamp_ns, pc_start, pc_end);
 
-	if (t && t->tr.sym_tree && *t->tr.sym_tree) {
-		sym = sym_lookup_by_addr(t->tr.sym_tree, pc_start);
-	} else {
-		sym = sym_get_unknown(t->tr.sym_tree);
-	}
-
-	if (t->cov_fmt != NONE) {
-		if (sym) {
-			uint64_t addr = pc_start;
-			while (sym && addr < pc_end) {
-				uint64_t tend = pc_end;
-
-				if (tend > (sym->addr + sym->size)) {
-					tend = sym->addr + sym->size;
-					PRINT_ERR("WARNING: fixup sym %s has spans "
-					"over to another symbol\n", sym->name);
-				}
-
-				sym_update_cov(sym, addr, tend, duration);
-				addr = tend;
-				sym = sym_lookup_by_addr(t->tr.sym_tree, addr);
-			}
-		}
-	}
+	/* The trace has no durations, TBs only count their runs.  */
+	if (t->cov_fmt != NONE)
+		sym_update_cov_tb(t->tr.sym_tree, pc_start, pc_end, 0);
 }
 
 static void handle_trace(qemu_simple_tracer *t, const char *name,
@@ -0,0 +1,296 @@
+/*
+ * Multi-client trace server.
+ *
+ * Copyright: 2026 Xilinx Inc
+ * Written by Edgar E. Iglesias <edgar.iglesias@xilinx.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <fcntl.h>
+
+#include "util.h"
+#include "syms.h"
+#include "trace-open.h"
+#include "compress.h"
+#include "trace-server.h"
+
+/*
+ * The main thread owns the listening socket and an epoll set. Accepted
+ * clients sit in the set until they send their first data (or hang up)
+ * and are then queued for the worker pool. A worker decodes a client
+ * from start to end into a private clone of the symbol store, so the
+ * syms themselves are shared read-only and only the counter merge at
+ * the end of each client is serialized.
+ */
+
+struct trace_server_client {
+	struct trace_server_client *next;
+	/* Link on the idle list, only used by the main thread.  */
+	struct trace_server_client *idle_next, **idle_pprev;
+	unsigned int nr;
+	int fd;
+};
+
+struct trace_server {
+	void **store;
+	const struct trace_server_ops *ops;
+	enum compress_fmt cfmt;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	/* FIFO of clients with data, waiting for a worker.  */
+	struct trace_server_client *head, **tail;
+	bool shutdown;
+
+	/* Accepted clients that haven't sent anything yet.  */
+	struct trace_server_client *idle;
+
+	/* Serializes store clones, merges and ops->done.  */
+	pthread_mutex_t store_lock;
+};
+
+static void trace_server_queue(struct trace_server *srv,
+			       struct trace_server_client *c)
+{
+	pthread_mutex_lock(&srv->lock);
+	c->next = NULL;
+	*srv->tail = c;
+	srv->tail = &c->next;
+	pthread_cond_signal(&srv->cond);
+	pthread_mutex_unlock(&srv->lock);
+}
+
+/* Returns the next client or NULL when the server shuts down.  */
+static struct trace_server_client *trace_server_dequeue(struct trace_server *srv)
+{
+	struct trace_server_client *c;
+
+	pthread_mutex_lock(&srv->lock);
+	while (!srv->head && !srv->shutdown)
+		pthread_cond_wait(&srv->cond, &srv->lock);
+	c = srv->head;
+	if (c) {
+		srv->head = c->next;
+		if (!srv->head)
+			srv->tail = &srv->head;
+	}
+	pthread_mutex_unlock(&srv->lock);
+	return c;
+}
+
+static void trace_server_serve(struct trace_server *srv,
+			       struct trace_server_client *c)
+{
+	const struct trace_server_ops *ops = srv->ops;
+	void *clone;
+	int fd = c->fd;
+
+	if (srv->cfmt != COMPRESS_NONE)
+		fd = compress_wrap_fd(fd, srv->cfmt, false);
+
+	pthread_mutex_lock(&srv->store_lock);
+	clone = sym_store_clone(srv->store);
+	pthread_mutex_unlock(&srv->store_lock);
+
+	fprintf(stderr, "client %u: connected\n", c->nr);
+	ops->serve(fd, clone ? &clone : srv->store, ops->opaque);
+	close(fd);
+
+	pthread_mutex_lock(&srv->store_lock);
+	if (ops->done)
+		ops->done(c->nr, srv->store, clone, ops->opaque);
+	sym_store_merge(srv->store, clone);
+	pthread_mutex_unlock(&srv->store_lock);
+	fprintf(stderr, "client %u: done\n", c->nr);
+}
+
+static void *trace_server_worker(void *opaque)
+{
+	struct trace_server *srv = opaque;
+	struct trace_server_client *c;
+
+	while ((c = trace_server_dequeue(srv))) {
+		trace_server_serve(srv, c);
+		free(c);
+	}
+	return NULL;
+}
+
+static void trace_server_idle_link(struct trace_server *srv,
+				   struct trace_server_client *c)
+{
+	c->idle_next = srv->idle;
+	if (srv->idle)
+		srv->idle->idle_pprev = &c->idle_next;
+	c->idle_pprev = &srv->idle;
+	srv->idle = c;
+}
+
+static void trace_server_idle_unlink(struct trace_server_client *c)
+{
+	*c->idle_pprev = c->idle_next;
+	if (c->idle_next)
+		c->idle_next->idle_pprev = c->idle_pprev;
+}
+
+static void trace_server_accept(struct trace_server *srv, int epfd, int lfd,
+				unsigned int *nr_clients)
+{
+	struct trace_server_client *c;
+	struct epoll_event ev;
+	int fd;
+
+	while ((fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+		c = safe_mallocz(sizeof *c);
+		c->fd = fd;
+		c->nr = (*nr_clients)++;
+		trace_server_idle_link(srv, c);
+
+		/* Hand the client to a worker once it has something to say.  */
+		ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+		ev.data.ptr = c;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			perror("epoll_ctl");
+			trace_server_idle_unlink(c);
+			close(fd);
+			free(c);
+		}
+	}
+	if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+		perror("accept");
+}
+
+/*
+ * Serve descr (unix:path, optionally with a compression prefix) to any
+ * number of clients with nr_workers decoding in parallel. Returns when
+ * *stop is set and the clients already accepted have been decoded.
+ */
+bool trace_server_run(const char *descr, unsigned int nr_workers,
+		      void **store, const struct trace_server_ops *ops,
+		      volatile sig_atomic_t *stop)
+{
+	struct trace_server srv;
+	struct epoll_event ev, evs[16];
+	unsigned int nr_clients = 0;
+	pthread_t *workers;
+	sigset_t set, oldset;
+	unsigned int i;
+	int lfd, epfd;
+
+	memset(&srv, 0, sizeof srv);
+	srv.store = store;
+	srv.ops = ops;
+	srv.cfmt = compress_parse_prefix(&descr);
+	srv.tail = &srv.head;
+	pthread_mutex_init(&srv.lock, NULL);
+	pthread_cond_init(&srv.cond, NULL);
+	pthread_mutex_init(&srv.store_lock, NULL);
+
+	lfd = trace_listen(descr);
+	if (lfd < 0)
+		return false;
+	fcntl(lfd, F_SETFL, fcntl(lfd, F_GETFL) | O_NONBLOCK);
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		perror("epoll_create1");
+		close(lfd);
+		return false;
+	}
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev);
+
+	/* Signals go to the main thread and interrupt epoll_wait.  */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, &oldset);
+	workers = safe_malloc(sizeof workers[0] * nr_workers);
+	for (i = 0; i < nr_workers; i++) {
+		int err;
+
+		err = pthread_create(&workers[i], NULL,
+				     trace_server_worker, &srv);
+		if (err) {
+			fprintf(stderr, "pthread_create: %s\n", strerror(err));
+			exit(EXIT_FAILURE);
+		}
+	}
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+	while (!*stop) {
+		int n;
+
+		n = epoll_wait(epfd, evs, sizeof evs / sizeof evs[0], -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			struct trace_server_client *c = evs[i].data.ptr;
+
+			if (!c) {
+				trace_server_accept(&srv, epfd, lfd,
+						    &nr_clients);
+				continue;
+			}
+			epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+			trace_server_idle_unlink(c);
+			trace_server_queue(&srv, c);
+		}
+	}
+
+	/* Stop accepting but finish the clients that are sending.  */
+	close(lfd);
+	close(epfd);
+	while (srv.idle) {
+		struct trace_server_client *c = srv.idle;
+
+		trace_server_idle_unlink(c);
+		close(c->fd);
+		free(c);
+	}
+
+	pthread_mutex_lock(&srv.lock);
+	srv.shutdown = true;
+	pthread_cond_broadcast(&srv.cond);
+	pthread_mutex_unlock(&srv.lock);
+
+	for (i = 0; i < nr_workers; i++)
+		pthread_join(workers[i], NULL);
+	free(workers);
+
+	pthread_mutex_destroy(&srv.store_lock);
+	pthread_cond_destroy(&srv.cond);
+	pthread_mutex_destroy(&srv.lock);
+	fprintf(stderr, "served %u clients\n", nr_clients);
+	return true;
+}
@@ -0,0 +1,49 @@
+/*
+ * Multi-client trace server.
+ *
+ * Copyright: 2026 Xilinx Inc
+ * Written by Edgar E. Iglesias <edgar.iglesias@xilinx.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+#ifndef _TRACE_SERVER_H
+#define _TRACE_SERVER_H
+
+#include <stdbool.h>
+#include <signal.h>
+
+/*
+ * Decode the trace of one client. store is a clone of the servers
+ * store, private to the calling worker.
+ */
+typedef void trace_server_serve_fn(int fd, void **store, void *opaque);
+
+/*
+ * Called once a client is done, with its store clone, before the clone
+ * is merged into the servers store. Calls are serialized.
+ */
+typedef void trace_server_done_fn(unsigned int client, void **store,
+				  void *clone, void *opaque);
+
+struct trace_server_ops {
+	trace_server_serve_fn *serve;
+	trace_server_done_fn *done;
+	void *opaque;
+};
+
+bool trace_server_run(const char *descr, unsigned int nr_workers,
+		      void **store, const struct trace_server_ops *ops,
+		      volatile sig_atomic_t *stop);
+#endif